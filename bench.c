@@ -0,0 +1,622 @@
+/*
+ * Benchmarks for the insert/select hot paths. This binary links simpledb.o
+ * and includes simpledb_internal.h, so internals such as get_page can be
+ * timed too, and driven in-process: no REPL, no parsing, output goes to
+ * /dev/null.
+ *
+ * Every benchmark prints one JSON object per line with its throughput and
+ * latency percentiles, so runs can be diffed or fed to a regression check.
+ * Micro benchmarks (serialize_row, deserialize_row) are timed in batches
+ * because a clock read costs about as much as the operation; their
+ * percentiles are per-operation averages over each batch.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "simpledb_internal.h"
+
+#define BENCH_MICRO_BATCH 256
+
+typedef enum {
+    KEYS_SEQUENTIAL,
+    KEYS_RANDOM,
+    KEYS_ZIPF
+} KeyDistribution;
+
+typedef struct {
+    const char* db_path;
+    uint32_t rows;
+    uint32_t lookups;
+    uint32_t scans;
+    uint32_t range_size;
+    uint32_t txn_size;
+    uint32_t batch_size;
+    KeyDistribution distribution;
+    bool cold;
+    uint64_t seed;
+    const char* only;
+    DbOptions db_options;
+} BenchOptions;
+
+typedef struct {
+    uint64_t* samples;
+    uint64_t num_samples;
+    uint64_t ops_per_sample;
+    uint64_t total_ns;
+    uint64_t ops;
+} LatencyRecorder;
+
+const char* distribution_names[] = {"sequential", "random", "zipf"};
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t bench_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+double bench_random_unit(uint64_t* state) {
+    return (bench_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Zipf(theta) over 1..n, after Gray et al., "Quickly generating billion-record synthetic databases". */
+typedef struct {
+    uint32_t n;
+    double theta;
+    double alpha;
+    double zeta_n;
+    double eta;
+} ZipfGenerator;
+
+void zipf_init(ZipfGenerator* zipf, uint32_t n, double theta) {
+    double zeta_2 = 1.0 + pow(0.5, theta);
+    zipf->n = n;
+    zipf->theta = theta;
+    zipf->zeta_n = 0;
+    for (uint32_t i = 1; i <= n; ++i) {
+        zipf->zeta_n += 1.0 / pow(i, theta);
+    }
+    zipf->alpha = 1.0 / (1.0 - theta);
+    zipf->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta_2 / zipf->zeta_n);
+}
+
+uint32_t zipf_next(ZipfGenerator* zipf, uint64_t* state) {
+    double u = bench_random_unit(state);
+    double uz = u * zipf->zeta_n;
+    if (uz < 1.0) {
+        return 1;
+    }
+    if (uz < 1.0 + pow(0.5, zipf->theta)) {
+        return 2;
+    }
+    uint32_t value = 1 + (uint32_t)(zipf->n * pow(zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+    return value > zipf->n ? zipf->n : value;
+}
+
+/*
+ * Keys 1..n in the requested order. Zipf only changes lookup keys; for
+ * loading it behaves like random so every key is still inserted once.
+ */
+uint32_t* generate_keys(uint32_t n, KeyDistribution distribution, uint64_t* state) {
+    uint32_t* keys = checked_malloc((size_t)n * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; ++i) {
+        keys[i] = i + 1;
+    }
+    if (distribution != KEYS_SEQUENTIAL) {
+        for (uint32_t i = n; i > 1; --i) {
+            uint32_t j = bench_random(state) % i;
+            uint32_t t = keys[i - 1];
+            keys[i - 1] = keys[j];
+            keys[j] = t;
+        }
+    }
+    return keys;
+}
+
+uint32_t* generate_lookup_keys(uint32_t count, uint32_t n, KeyDistribution distribution, uint64_t* state) {
+    uint32_t* keys = checked_malloc((size_t)count * sizeof(uint32_t));
+    ZipfGenerator zipf;
+    if (distribution == KEYS_ZIPF) {
+        zipf_init(&zipf, n, 0.99);
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        switch (distribution) {
+            case (KEYS_SEQUENTIAL):
+                keys[i] = i % n + 1;
+                break;
+            case (KEYS_RANDOM):
+                keys[i] = bench_random(state) % n + 1;
+                break;
+            case (KEYS_ZIPF):
+                /* Scatter the hot keys across the key space instead of clustering them at 1. */
+                keys[i] = (uint32_t)(((uint64_t)zipf_next(&zipf, state) * 2654435761u) % n) + 1;
+                break;
+        }
+    }
+    return keys;
+}
+
+void make_row(Row* row, uint32_t id, uint64_t* state) {
+    row->id = id;
+    row->begin_txn = 1;
+    row->end_txn = TXN_ID_MAX;
+    int username_length = snprintf(row->username, sizeof(row->username), "user%u", id);
+    uint32_t extra = bench_random(state) % (DB_USERNAME_SIZE - username_length);
+    memset(row->username + username_length, 'x', extra);
+    row->username[username_length + extra] = 0;
+    snprintf(row->email, sizeof(row->email), "person%u@example.com", id);
+}
+
+void recorder_init(LatencyRecorder* recorder, uint64_t max_samples, uint64_t ops_per_sample) {
+    recorder->samples = checked_malloc((max_samples ? max_samples : 1) * sizeof(uint64_t));
+    recorder->num_samples = 0;
+    recorder->ops_per_sample = ops_per_sample;
+    recorder->total_ns = 0;
+    recorder->ops = 0;
+}
+
+void recorder_add(LatencyRecorder* recorder, uint64_t elapsed_ns) {
+    recorder->samples[recorder->num_samples++] = elapsed_ns;
+    recorder->total_ns += elapsed_ns;
+    recorder->ops += recorder->ops_per_sample;
+}
+
+uint64_t percentile(LatencyRecorder* recorder, double fraction) {
+    if (recorder->num_samples == 0) {
+        return 0;
+    }
+    uint64_t index = (uint64_t)(fraction * (recorder->num_samples - 1) + 0.5);
+    return recorder->samples[index] / recorder->ops_per_sample;
+}
+
+void report(const char* name, BenchOptions* options, LatencyRecorder* recorder, uint64_t rows_touched) {
+    qsort(recorder->samples, recorder->num_samples, sizeof(uint64_t), compare_u64);
+    double seconds = recorder->total_ns / 1e9;
+    printf("{\"benchmark\":\"%s\",\"distribution\":\"%s\",\"cache\":\"%s\",\"pager\":\"%s\",\"rows\":%u,"
+           "\"ops\":%lu,\"batch\":%lu,\"seconds\":%.6f,\"ops_per_sec\":%.1f,\"rows_per_sec\":%.1f,"
+           "\"p50_ns\":%lu,\"p99_ns\":%lu,\"p999_ns\":%lu,\"max_ns\":%lu}\n",
+           name, distribution_names[options->distribution], options->cold ? "cold" : "warm",
+           options->db_options.pager_mode == DB_PAGER_MODE_MMAP ? "mmap" : "buffered", options->rows,
+           recorder->ops, recorder->ops_per_sample, seconds, seconds > 0 ? recorder->ops / seconds : 0.0,
+           seconds > 0 ? rows_touched / seconds : 0.0, percentile(recorder, 0.50), percentile(recorder, 0.99),
+           percentile(recorder, 0.999), percentile(recorder, 1.0));
+    fflush(stdout);
+    free(recorder->samples);
+}
+
+bool should_run(BenchOptions* options, const char* name) {
+    return options->only == NULL || strstr(options->only, name) != NULL;
+}
+
+void remove_database(const char* path) {
+    char wal_path[4096];
+    snprintf(wal_path, sizeof(wal_path), "%s-wal", path);
+    unlink(path);
+    unlink(wal_path);
+}
+
+DbTable* open_database(BenchOptions* options) {
+    DbTable* table;
+    DbResult result = db_open(options->db_path, &options->db_options, &table);
+    if (result != DB_SUCCESS) {
+        printf("%s\n", db_result_message(result));
+        exit(EXIT_FAILURE);
+    }
+    return table;
+}
+
+/* Drops the buffer pool and asks the kernel to drop the file from its page cache. */
+DbTable* reopen_cold(DbTable* table, BenchOptions* options) {
+    db_close(table);
+    int fd = open(options->db_path, O_RDONLY);
+    if (fd != -1) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    return open_database(options);
+}
+
+void bench_serialize(BenchOptions* options, uint64_t* state) {
+    uint32_t iterations = options->rows;
+    Row row;
+    char buffer[ROW_MAX_SIZE];
+    LatencyRecorder recorder;
+    recorder_init(&recorder, iterations / BENCH_MICRO_BATCH + 1, BENCH_MICRO_BATCH);
+    make_row(&row, 12345, state);
+
+    volatile uint32_t sink = 0;
+    for (uint32_t done = 0; done + BENCH_MICRO_BATCH <= iterations; done += BENCH_MICRO_BATCH) {
+        uint64_t start = now_ns();
+        for (uint32_t i = 0; i < BENCH_MICRO_BATCH; ++i) {
+            row.id = done + i;
+            sink += serialize_row(&row, buffer);
+        }
+        recorder_add(&recorder, now_ns() - start);
+    }
+    report("serialize_row", options, &recorder, recorder.ops);
+
+    uint32_t length = serialize_row(&row, buffer);
+    recorder_init(&recorder, iterations / BENCH_MICRO_BATCH + 1, BENCH_MICRO_BATCH);
+    for (uint32_t done = 0; done + BENCH_MICRO_BATCH <= iterations; done += BENCH_MICRO_BATCH) {
+        uint64_t start = now_ns();
+        for (uint32_t i = 0; i < BENCH_MICRO_BATCH; ++i) {
+            buffer[length - 1] = (char)i;
+            deserialize_row(&row, buffer);
+            sink += row.email[0];
+        }
+        recorder_add(&recorder, now_ns() - start);
+    }
+    report("deserialize_row", options, &recorder, recorder.ops);
+}
+
+/* Inserts in explicit transactions of txn_size rows; a sample is one whole transaction. */
+DbTable* bench_transaction_insert(DbTable* table, BenchOptions* options, uint32_t* keys, uint64_t* state) {
+    Row row;
+    Statement statement;
+    init_statement(&statement);
+    statement.rows = &row;
+    statement.num_rows = 1;
+    Transaction txn;
+    init_transaction(&txn);
+
+    LatencyRecorder recorder;
+    recorder_init(&recorder, options->rows / options->txn_size + 1, options->txn_size);
+    for (uint32_t done = 0; done + options->txn_size <= options->rows; done += options->txn_size) {
+        uint64_t start = now_ns();
+        statement.type = STATEMENT_BEGIN;
+        execute_statement(&statement, table, &txn, NULL);
+        statement.type = STATEMENT_INSERT;
+        for (uint32_t i = done; i < done + options->txn_size; ++i) {
+            make_row(&row, keys[i], state);
+            if (execute_statement(&statement, table, &txn, NULL) != EXECUTE_SUCCESS) {
+                printf("Insert of id %u failed.\n", keys[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        statement.type = STATEMENT_COMMIT;
+        execute_statement(&statement, table, &txn, NULL);
+        recorder_add(&recorder, now_ns() - start);
+    }
+    free_transaction(&txn);
+    free(keys);
+    report("execute_insert_txn", options, &recorder, recorder.ops);
+    return table;
+}
+
+/* Inserts multi-row statements of batch_size rows; a sample is one whole statement. */
+DbTable* bench_batch_insert(DbTable* table, BenchOptions* options, uint32_t* keys, uint64_t* state) {
+    Row* rows = checked_malloc(options->batch_size * sizeof(Row));
+    Statement statement;
+    init_statement(&statement);
+    statement.type = STATEMENT_INSERT;
+    statement.rows = rows;
+    statement.num_rows = options->batch_size;
+    Transaction txn;
+    init_transaction(&txn);
+
+    LatencyRecorder recorder;
+    recorder_init(&recorder, options->rows / options->batch_size + 1, options->batch_size);
+    for (uint32_t done = 0; done + options->batch_size <= options->rows; done += options->batch_size) {
+        for (uint32_t i = 0; i < options->batch_size; ++i) {
+            make_row(&rows[i], keys[done + i], state);
+        }
+        uint64_t start = now_ns();
+        EXECUTE_RESULT result = execute_statement(&statement, table, &txn, NULL);
+        recorder_add(&recorder, now_ns() - start);
+        if (result != EXECUTE_SUCCESS) {
+            printf("Insert of ids %u.. failed.\n", keys[done]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free_transaction(&txn);
+    free(rows);
+    free(keys);
+    report("execute_insert_batch", options, &recorder, recorder.ops);
+    return table;
+}
+
+DbTable* bench_insert(BenchOptions* options, uint64_t* state) {
+    remove_database(options->db_path);
+    DbTable* table = open_database(options);
+    uint32_t* keys = generate_keys(options->rows, options->distribution, state);
+    Row row;
+    Statement statement;
+    init_statement(&statement);
+    statement.type = STATEMENT_INSERT;
+    statement.rows = &row;
+    statement.num_rows = 1;
+
+    LatencyRecorder recorder;
+    if (options->txn_size > 0) {
+        return bench_transaction_insert(table, options, keys, state);
+    }
+    if (options->batch_size > 1) {
+        return bench_batch_insert(table, options, keys, state);
+    }
+    recorder_init(&recorder, options->rows, 1);
+    for (uint32_t i = 0; i < options->rows; ++i) {
+        make_row(&row, keys[i], state);
+        uint64_t start = now_ns();
+        EXECUTE_RESULT result = execute_insert(&statement, table);
+        recorder_add(&recorder, now_ns() - start);
+        if (result != EXECUTE_SUCCESS) {
+            printf("Insert of id %u failed.\n", keys[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(keys);
+    report("execute_insert", options, &recorder, recorder.ops);
+    return table;
+}
+
+DbTable* bench_get_page(DbTable* table, BenchOptions* options, uint64_t* state) {
+    if (options->cold) {
+        table = reopen_cold(table, options);
+    }
+    Pager* pager = table->pager;
+    uint32_t num_pages = pager_num_pages(pager);
+    LatencyRecorder recorder;
+    recorder_init(&recorder, options->lookups, 1);
+    for (uint32_t i = 0; i < options->lookups; ++i) {
+        uint32_t page_num = options->distribution == KEYS_SEQUENTIAL ? i % num_pages
+                                                                      : bench_random(state) % num_pages;
+        uint64_t start = now_ns();
+        get_page(pager, page_num);
+        unpin_page(pager, page_num);
+        recorder_add(&recorder, now_ns() - start);
+    }
+    report("get_page", options, &recorder, recorder.ops);
+    return table;
+}
+
+DbTable* bench_point_select(DbTable* table, BenchOptions* options, OutputSink* output, uint64_t* state) {
+    if (options->cold) {
+        table = reopen_cold(table, options);
+    }
+    uint32_t* keys = generate_lookup_keys(options->lookups, options->rows, options->distribution, state);
+    Predicate predicate;
+    memset(&predicate, 0, sizeof(predicate));
+    predicate.type = PREDICATE_COMPARE;
+    predicate.column = COLUMN_ID;
+    predicate.op = COMPARE_EQ;
+    Statement statement;
+    init_statement(&statement);
+    statement.where = &predicate;
+
+    LatencyRecorder recorder;
+    recorder_init(&recorder, options->lookups, 1);
+    for (uint32_t i = 0; i < options->lookups; ++i) {
+        predicate.id_value = keys[i];
+        uint64_t start = now_ns();
+        execute_select(&statement, table, NULL, output);
+        recorder_add(&recorder, now_ns() - start);
+    }
+    free(keys);
+    report("select_point", options, &recorder, recorder.ops);
+    return table;
+}
+
+DbTable* bench_range_select(DbTable* table, BenchOptions* options, OutputSink* output, uint64_t* state) {
+    if (options->cold) {
+        table = reopen_cold(table, options);
+    }
+    uint32_t count = options->lookups / 10 + 1;
+    uint32_t* keys = generate_lookup_keys(count, options->rows, options->distribution, state);
+    Predicate low;
+    Predicate high;
+    Predicate both;
+    memset(&low, 0, sizeof(low));
+    memset(&high, 0, sizeof(high));
+    memset(&both, 0, sizeof(both));
+    low.type = PREDICATE_COMPARE;
+    low.column = COLUMN_ID;
+    low.op = COMPARE_GE;
+    high = low;
+    high.op = COMPARE_LE;
+    both.type = PREDICATE_AND;
+    both.left = &low;
+    both.right = &high;
+    Statement statement;
+    init_statement(&statement);
+    statement.where = &both;
+
+    LatencyRecorder recorder;
+    recorder_init(&recorder, count, 1);
+    uint64_t rows_touched = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        low.id_value = keys[i];
+        high.id_value = keys[i] + options->range_size - 1;
+        uint64_t start = now_ns();
+        execute_select(&statement, table, NULL, output);
+        recorder_add(&recorder, now_ns() - start);
+        uint64_t last = (uint64_t)keys[i] + options->range_size - 1;
+        rows_touched += (last > options->rows ? options->rows : last) - keys[i] + 1;
+    }
+    free(keys);
+    report("select_range", options, &recorder, rows_touched);
+    return table;
+}
+
+/* The same ranges as select_range, read through the library's cursors. */
+DbTable* bench_cursor_range(DbTable* table, BenchOptions* options, uint64_t* state) {
+    if (options->cold) {
+        table = reopen_cold(table, options);
+    }
+    uint32_t count = options->lookups / 10 + 1;
+    uint32_t* keys = generate_lookup_keys(count, options->rows, options->distribution, state);
+
+    LatencyRecorder recorder;
+    recorder_init(&recorder, count, 1);
+    uint64_t rows_touched = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        DbCursor* cursor;
+        DbRowView row;
+        uint64_t start = now_ns();
+        db_scan(table, keys[i], keys[i] + options->range_size - 1, &cursor);
+        while (db_cursor_next(cursor, &row)) {
+            ++rows_touched;
+        }
+        db_cursor_close(cursor);
+        recorder_add(&recorder, now_ns() - start);
+    }
+    free(keys);
+    report("db_scan_range", options, &recorder, rows_touched);
+    return table;
+}
+
+DbTable* bench_scan(DbTable* table, BenchOptions* options, OutputSink* output, bool count_only) {
+    Statement statement;
+    init_statement(&statement);
+    statement.count_only = count_only;
+
+    LatencyRecorder recorder;
+    recorder_init(&recorder, options->scans, 1);
+    for (uint32_t i = 0; i < options->scans; ++i) {
+        if (options->cold) {
+            table = reopen_cold(table, options);
+        }
+        uint64_t start = now_ns();
+        execute_select(&statement, table, NULL, output);
+        recorder_add(&recorder, now_ns() - start);
+    }
+    report(count_only ? "select_count" : "select_scan", options, &recorder, (uint64_t)options->rows * options->scans);
+    return table;
+}
+
+void print_bench_usage() {
+    printf("Usage: bench [--rows N] [--lookups N] [--scans N] [--range-size N] [--txn-size N] [--batch-size N]\n"
+           "             [--distribution sequential|random|zipf] [--cold] [--seed N]\n"
+           "             [--frames N] [--mmap] [--compress] [--pax] [--commit-interval MS] [--scan-threads N]\n"
+           "             [--db PATH] [--only NAMES]\n");
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    options.db_path = "/tmp/simpledb-bench.db";
+    options.rows = 100000;
+    options.lookups = 100000;
+    options.scans = 10;
+    options.range_size = 100;
+    options.txn_size = 0;
+    options.batch_size = 1;
+    options.distribution = KEYS_RANDOM;
+    options.cold = false;
+    options.seed = 0x9E3779B97F4A7C15ull;
+    options.only = NULL;
+    options.db_options = db_default_options();
+
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--rows") == 0 && has_value) {
+            options.rows = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--lookups") == 0 && has_value) {
+            options.lookups = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--scans") == 0 && has_value) {
+            options.scans = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--range-size") == 0 && has_value) {
+            options.range_size = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--txn-size") == 0 && has_value) {
+            options.txn_size = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--batch-size") == 0 && has_value) {
+            options.batch_size = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--distribution") == 0 && has_value) {
+            const char* name = argv[++i];
+            if (strcmp(name, "sequential") == 0) {
+                options.distribution = KEYS_SEQUENTIAL;
+            } else if (strcmp(name, "random") == 0) {
+                options.distribution = KEYS_RANDOM;
+            } else if (strcmp(name, "zipf") == 0) {
+                options.distribution = KEYS_ZIPF;
+            } else {
+                print_bench_usage();
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--cold") == 0) {
+            options.cold = true;
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            options.seed = strtoull(argv[++i], NULL, 10) | 1;
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            options.db_options.pool_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            options.db_options.pager_mode = DB_PAGER_MODE_MMAP;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            options.db_options.compress = true;
+        } else if (strcmp(argv[i], "--pax") == 0) {
+            options.db_options.pax = true;
+        } else if (strcmp(argv[i], "--commit-interval") == 0 && has_value) {
+            options.db_options.commit_interval_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scan-threads") == 0 && has_value) {
+            options.db_options.scan_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--db") == 0 && has_value) {
+            options.db_path = argv[++i];
+        } else if (strcmp(argv[i], "--only") == 0 && has_value) {
+            options.only = argv[++i];
+        } else {
+            print_bench_usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (options.rows == 0) {
+        printf("--rows must be positive.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options.txn_size > 0 && options.rows % options.txn_size != 0) {
+        printf("--rows must be a multiple of --txn-size.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options.batch_size == 0 || options.rows % options.batch_size != 0) {
+        printf("--rows must be a positive multiple of --batch-size.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options.txn_size > 0 && options.batch_size > 1) {
+        printf("--txn-size and --batch-size cannot be combined.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t state = options.seed;
+    int null_fd = open("/dev/null", O_WRONLY);
+    OutputSink* output = new_output_sink(null_fd);
+
+    if (should_run(&options, "serialize")) {
+        bench_serialize(&options, &state);
+    }
+    DbTable* table = bench_insert(&options, &state);
+    if (should_run(&options, "get_page")) {
+        table = bench_get_page(table, &options, &state);
+    }
+    if (should_run(&options, "select_point")) {
+        table = bench_point_select(table, &options, output, &state);
+    }
+    if (should_run(&options, "select_range")) {
+        table = bench_range_select(table, &options, output, &state);
+    }
+    if (should_run(&options, "db_scan_range")) {
+        table = bench_cursor_range(table, &options, &state);
+    }
+    if (should_run(&options, "select_count")) {
+        table = bench_scan(table, &options, output, true);
+    }
+    if (should_run(&options, "select_scan")) {
+        table = bench_scan(table, &options, output, false);
+    }
+
+    db_close(table);
+    remove_database(options.db_path);
+    free_output_sink(output);
+    close(null_fd);
+    return 0;
+}
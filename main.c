@@ -1,366 +1,977 @@
-#include <stdlib.h>
+/*
+ * The db command: an interactive REPL and a socket server, both front ends
+ * over the engine in simpledb.c. Applications that embed the engine link
+ * libsimpledb and use simpledb.h instead.
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
-#include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
-#include <stdint.h>
-#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
+#include "simpledb_internal.h"
 
 typedef enum {
     META_COMMAND_SUCCESS,
     META_COMMAND_UNRECOGNIZED_COMMAND
 } MetaCommandResult;
 
-typedef enum {
-    PREPARE_NEGATIVE_ID,
-    PREPARE_NOT_ID,
-    PREPARE_STRING_NOT_RIGHT,
-    PREPARE_STRING_TOO_LONG,
-    PREPARE_SUCCESS,
-    PREPARE_SYNTAX_ERROR,
-    PREPARE_UNRECOGNIZED_STATEMENT,
-} PrepareResult;
-
-typedef enum {
-    STATEMENT_INSERT,
-    STATEMENT_SELECT
-} StatementType;
-
-typedef enum {
-    EXECUTE_SUCCESS,
-    EXECUTE_TABLE_EMPTY,
-    EXECUTE_TABLE_FULL,
-} EXECUTE_RESULT;
-
 typedef struct {
     char* buffer;
     size_t buffer_length;
     ssize_t input_length;
 } InputBuffer;
 
-#define COLUMN_USERNAME_SIZE 32
-#define COLUMN_EMAIL_SIZE 255
-typedef struct {
-    uint32_t id;
-    char username[COLUMN_USERNAME_SIZE + 1];
-    char email[COLUMN_EMAIL_SIZE + 1];
-} Row;
-
-typedef struct {
-    StatementType type;
-    Row* row_to_insert;
-} Statement;
-
-
-#define size_of_attribute(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
-
-const uint32_t ID_SIZE = size_of_attribute(Row, id);
-const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
-const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
-const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
-
-const uint32_t PAGE_SIZE = 4096;
-#define TABLE_MAX_PAGES 100
-const uint32_t ROWS_PER_PAGE = PAGE_SIZE / ROW_SIZE;
-const uint32_t TABLE_MAX_ROWS = ROWS_PER_PAGE * TABLE_MAX_PAGES;
-
-typedef struct {
-    int fd;
-    uint32_t file_length;
-    void* pages[TABLE_MAX_PAGES];
-} Pager;
-
-typedef struct {
-    uint32_t num_rows;
-    Pager* pager;
-} Table;
+/* The command-line front ends report engine failures the way they always have. */
+void exit_fatal_handler(const char* message) {
+    printf("%s\n", message);
+    exit(EXIT_FAILURE);
+}
 
-Pager* pager_open(const char* filename) {
-    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
-    if (fd == -1) {
-        printf("Unable to open file\n");
+DbTable* open_table(const char* filename, const DbOptions* options) {
+    DbTable* table;
+    DbResult result = db_open(filename, options, &table);
+    if (result != DB_SUCCESS) {
+        printf("%s\n", db_result_message(result));
         exit(EXIT_FAILURE);
     }
-    off_t file_length = lseek(fd, 0, SEEK_END);
-    Pager* pager = (Pager*) malloc(sizeof(Pager));
-    pager->fd = fd;
-    pager->file_length = file_length;
+    if (table->recovered_rows > 0) {
+        printf("Recovered %u rows from the log.\n", table->recovered_rows);
+    }
+    return table;
+}
 
-    for(int i = 0; i < TABLE_MAX_PAGES; ++i) {
-        pager->pages[i] = NULL;
+void indent(uint32_t level) {
+    for (uint32_t i = 0; i < level; ++i) {
+        printf("  ");
     }
-    return pager;
 }
 
-Table* db_open(const char* filename) {
-    Pager* pager = pager_open(filename);
-    uint32_t num_rows = pager->file_length / ROW_SIZE;
+void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
+    void* node = get_page(pager, page_num);
+    uint32_t num_keys;
 
-    Table* table = (Table*) malloc(sizeof(Table));
-    table->pager = pager;
-    table->num_rows = num_rows;
+    switch (get_node_type(node)) {
+        case (NODE_LEAF):
+        case (NODE_PAX_LEAF):
+            num_keys = *leaf_node_num_cells(node);
+            indent(indentation_level);
+            printf("- leaf (size %u)\n", num_keys);
+            for (uint32_t i = 0; i < num_keys; ++i) {
+                indent(indentation_level + 1);
+                printf("- %u\n", *leaf_node_key(node, i));
+            }
+            break;
+        case (NODE_INTERNAL):
+            num_keys = *internal_node_num_keys(node);
+            indent(indentation_level);
+            printf("- internal (size %u)\n", num_keys);
+            for (uint32_t i = 0; i < num_keys; ++i) {
+                print_tree(pager, *internal_node_child(node, i), indentation_level + 1);
+                indent(indentation_level + 1);
+                printf("- key %u\n", *internal_node_key(node, i));
+            }
+            print_tree(pager, *internal_node_right_child(node), indentation_level + 1);
+            break;
+    }
+    unpin_page(pager, page_num);
 }
 
-void free_table(Table* table) {
-    for(uint32_t i = 0; i < table->num_rows; ++i) {
-        free(table->pager->pages[i]);
-    }
-    free(table);
+void print_constants() {
+    printf("ROW_MAX_SIZE: %zu\n", ROW_MAX_SIZE);
+    printf("COMMON_NODE_HEADER_SIZE: %u\n", COMMON_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_HEADER_SIZE: %u\n", LEAF_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_SLOT_SIZE: %zu\n", LEAF_NODE_SLOT_SIZE);
+    printf("LEAF_NODE_SPACE_FOR_CELLS: %u\n", LEAF_NODE_SPACE_FOR_CELLS);
+    printf("INTERNAL_NODE_MAX_KEYS: %zu\n", INTERNAL_NODE_MAX_KEYS);
 }
 
-void* get_page(Pager* pager, uint32_t page_num) {
-    if (page_num > TABLE_MAX_PAGES) {
-        printf("Tried to fetch page number out of bounds. %d\n", TABLE_MAX_PAGES);
-        exit(EXIT_FAILURE);
+bool parse_on_off(const char* value, bool* flag) {
+    if (strcmp(value, "on") == 0 || strcmp(value, "off") == 0) {
+        *flag = value[1] == 'n';
+        return true;
     }
-    if (pager->pages[page_num] == NULL) {
-        void* page = malloc(PAGE_SIZE);
-        uint32_t num_pages = (pager->file_length + PAGE_SIZE - 1) / PAGE_SIZE;
+    return false;
+}
+
+typedef struct {
+    const char* data;
+    size_t length;
+} Field;
 
-        if (page_num <= num_pages) {
-            lseek(pager->fd, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->fd, page, PAGE_SIZE);
-            if (bytes_read == -1) {
-                printf("Error reading file.\n");
-                exit(EXIT_FAILURE);
+/*
+ * Splits one line of delimited text into fields without copying or
+ * modifying it. CSV fields may be double-quoted with "" as an escaped
+ * quote; such fields are unescaped into scratch. Returns the number of
+ * fields found, or -1 for a malformed line, and advances *position past the
+ * line terminator.
+ */
+int parse_delimited_line(const char** position, const char* end, char delimiter, Field* fields,
+                         uint32_t max_fields, char* scratch, char* scratch_end) {
+    const char* p = *position;
+    int num_fields = 0;
+    bool malformed = false;
+    while (true) {
+        Field field;
+        if (p < end && *p == '"' && delimiter == ',') {
+            char* out = scratch;
+            ++p;
+            while (p < end) {
+                if (*p == '"') {
+                    if (p + 1 < end && p[1] == '"') {
+                        *out++ = '"';
+                        p += 2;
+                        continue;
+                    }
+                    break;
+                }
+                if (out == scratch_end) {
+                    malformed = true;
+                    ++p;
+                    continue;
+                }
+                *out++ = *p++;
+            }
+            if (p >= end) {
+                malformed = true;
+            } else {
+                ++p;
+            }
+            field.data = scratch;
+            field.length = out - scratch;
+            scratch = out;
+        } else {
+            const char* start = p;
+            while (p < end && *p != delimiter && *p != '\n') {
+                ++p;
+            }
+            field.data = start;
+            field.length = p - start;
+            if (field.length > 0 && start[field.length - 1] == '\r') {
+                --field.length;
             }
         }
-        pager->pages[page_num] = page;
+        if ((uint32_t)num_fields < max_fields) {
+            fields[num_fields] = field;
+        }
+        ++num_fields;
+        if (p < end && *p == delimiter) {
+            ++p;
+            continue;
+        }
+        break;
     }
-    return pager->pages[page_num];
+    while (p < end && *p != '\n') {
+        if (*p != '\r') {
+            malformed = true;
+        }
+        ++p;
+    }
+    *position = p < end ? p + 1 : end;
+    return malformed ? -1 : num_fields;
 }
 
-void pager_flush(Pager* pager, uint32_t page_num, uint32_t size) {
-    if (pager->pages[page_num] == NULL) {
-        printf("Error: Tried to flush an empty page.");
-        exit(EXIT_FAILURE);
+bool parse_id_field(Field* field, uint32_t* id) {
+    if (field->length == 0 || field->length > 10) {
+        return false;
     }
+    uint64_t value = 0;
+    for (size_t i = 0; i < field->length; ++i) {
+        char c = field->data[i];
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        value = value * 10 + (c - '0');
+    }
+    if (value == 0 || value > UINT32_MAX) {
+        return false;
+    }
+    *id = value;
+    return true;
+}
 
-    off_t offset = lseek(pager->fd, page_num * PAGE_SIZE, SEEK_SET);
+/*
+ * .import <file>: loads id,username,email rows from a CSV file, or a TSV
+ * file when the name ends in .tsv or the first line contains a tab. A first
+ * line whose id is not a number is taken as a header. The file is mapped
+ * and parsed in place.
+ *
+ * The import runs between two checkpoints instead of logging every row, so
+ * a crash part way through recovers to the state before the import.
+ */
+void db_import(DbTable* table, const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        printf("Unable to open '%s'.\n", filename);
+        return;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        printf("Unable to read '%s'.\n", filename);
+        close(fd);
+        return;
+    }
+    size_t length = file_stat.st_size;
+    const char* data = NULL;
+    if (length > 0) {
+        data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            printf("Unable to map '%s'.\n", filename);
+            close(fd);
+            return;
+        }
+        madvise((void*)data, length, MADV_SEQUENTIAL);
+    }
+    close(fd);
 
-    if (offset == -1) {
-        printf("Error seeking.\n");
-        exit(EXIT_FAILURE);
+    const char* end = data + length;
+    const char* first_newline = length > 0 ? memchr(data, '\n', length) : NULL;
+    size_t first_line_length = first_newline ? (size_t)(first_newline - data) : length;
+    size_t name_length = strlen(filename);
+    char delimiter = ',';
+    if ((name_length > 4 && strcmp(filename + name_length - 4, ".tsv") == 0) ||
+        (length > 0 && memchr(data, '\t', first_line_length) != NULL)) {
+        delimiter = '\t';
+    }
+
+    pthread_mutex_lock(&table->write_lock);
+    if (table->txn != NULL) {
+        pthread_mutex_unlock(&table->write_lock);
+        if (length > 0) {
+            munmap((void*)data, length);
+        }
+        printf("Error: Database is locked by an open transaction.\n");
+        return;
     }
+    db_checkpoint(table);
+    BulkLoader loader;
+    bulk_loader_begin(&loader, table);
+    /* The whole file is one transaction: nothing is visible until it is all in. */
+    uint64_t txn_id = table->next_txn_id++;
 
-    size_t bytes_written = write(pager->fd, pager->pages[page_num], size);
+    uint64_t imported = 0;
+    uint64_t duplicates = 0;
+    uint64_t rejected = 0;
+    uint64_t line_number = 0;
+    uint64_t first_rejected_line = 0;
+    char scratch[ROW_MAX_SIZE];
+    Row row;
+    row.begin_txn = txn_id;
+    row.end_txn = TXN_ID_MAX;
+    const char* position = data;
+    while (position < end) {
+        Field fields[3];
+        ++line_number;
+        if (*position == '\n' || (*position == '\r' && position + 1 < end && position[1] == '\n')) {
+            position += *position == '\r' ? 2 : 1;
+            continue;
+        }
+        int num_fields = parse_delimited_line(&position, end, delimiter, fields, 3, scratch, scratch + sizeof(scratch));
+        bool has_id = num_fields == 3 && parse_id_field(&fields[0], &row.id);
+        if (!has_id && num_fields == 3 && line_number == 1) {
+            continue;
+        }
+        if (!has_id || fields[1].length > DB_USERNAME_SIZE || fields[2].length > DB_EMAIL_SIZE) {
+            ++rejected;
+            first_rejected_line = first_rejected_line ? first_rejected_line : line_number;
+            continue;
+        }
+        memcpy(row.username, fields[1].data, fields[1].length);
+        row.username[fields[1].length] = 0;
+        memcpy(row.email, fields[2].data, fields[2].length);
+        row.email[fields[2].length] = 0;
+        if (bulk_loader_add(&loader, &row) == EXECUTE_SUCCESS) {
+            ++imported;
+        } else {
+            ++duplicates;
+        }
+    }
 
-    if (bytes_written == -1) {
-        printf("Error writing\n");
-        exit(EXIT_FAILURE);
+    bulk_loader_end(&loader);
+    table_commit(table, txn_id, imported);
+    db_checkpoint(table);
+    pthread_mutex_unlock(&table->write_lock);
+    if (length > 0) {
+        munmap((void*)data, length);
     }
+    printf("Imported %lu rows.", imported);
+    if (duplicates > 0) {
+        printf(" Skipped %lu duplicate ids.", duplicates);
+    }
+    if (rejected > 0) {
+        printf(" Rejected %lu malformed lines, the first at line %lu.", rejected, first_rejected_line);
+    }
+    printf("\n");
 }
 
-void* db_close(Table* table) {
-    Pager* pager = table->pager;
-    uint32_t num_full_pages = table->num_rows / ROWS_PER_PAGE;
-    
-    for(int i = 0; i < num_full_pages; ++i) {
-        if (pager->pages[i] == NULL) {
-            continue;
+MetaCommandResult do_meta_command(InputBuffer* input_buffer, DbTable* table, OutputSink* output) {
+    if(strcmp(input_buffer->buffer, ".exit") == 0) {
+        db_close(table);
+        exit(EXIT_SUCCESS);
+    }
+    else if (strncmp(input_buffer->buffer, ".format ", 8) == 0) {
+        if (!parse_output_format(input_buffer->buffer + 8, &output->format)) {
+            printf("Unknown format. Use tuple, csv, tsv, json or binary.\n");
         }
-        pager_flush(pager, i, PAGE_SIZE);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
-    }
-
-    uint32_t num_additional_rows = table->num_rows % ROWS_PER_PAGE;
-    if (num_additional_rows) {
-        uint32_t page_num = num_full_pages;
-        if (pager->pages[page_num] != NULL) {
-            pager_flush(pager, page_num, PAGE_SIZE);
-            free(pager->pages[page_num]);
-            pager->pages[page_num] = NULL;
+        return META_COMMAND_SUCCESS;
+    }
+    else if (strncmp(input_buffer->buffer, ".ordered ", 9) == 0) {
+        if (!parse_on_off(input_buffer->buffer + 9, &output->ordered)) {
+            printf("Use .ordered on or .ordered off.\n");
         }
+        return META_COMMAND_SUCCESS;
     }
-    int result = close(pager->fd);
-    if (result == -1) {
-        printf("Failed to close file.\n");
-        exit(EXIT_FAILURE);
+    else if (strncmp(input_buffer->buffer, ".import ", 8) == 0) {
+        db_import(table, input_buffer->buffer + 8);
+        return META_COMMAND_SUCCESS;
     }
-    for(int i = 0; i < TABLE_MAX_PAGES; ++i) {
-        void* page = pager->pages[i];
-        if (page) {
-            free(page);
-            page = NULL;
+    else if (strcmp(input_buffer->buffer, ".checkpoint") == 0) {
+        pthread_mutex_lock(&table->write_lock);
+        if (table->txn != NULL) {
+            printf("Error: Database is locked by an open transaction.\n");
+        } else {
+            db_checkpoint(table);
         }
+        pthread_mutex_unlock(&table->write_lock);
+        return META_COMMAND_SUCCESS;
+    }
+    else if (strcmp(input_buffer->buffer, ".btree") == 0) {
+        printf("Tree:\n");
+        print_tree(table->pager, table->root_page_num, 0);
+        return META_COMMAND_SUCCESS;
+    }
+    else if (strcmp(input_buffer->buffer, ".constants") == 0) {
+        printf("Constants:\n");
+        print_constants();
+        return META_COMMAND_SUCCESS;
+    }
+    else {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
     }
-    free(pager);
-    free(table);
 }
 
-void* row_slot(Table* table, uint32_t row_num) {
-    uint32_t page_num = row_num / ROWS_PER_PAGE;
-    void* page = get_page(table->pager, page_num);
-    uint32_t row_offset = row_num % ROWS_PER_PAGE;
-    uint32_t byte_offset = row_offset * ROW_SIZE;
-    return page + byte_offset;
+InputBuffer* new_input_Buffer() {
+    InputBuffer* input_buffer = (InputBuffer*)checked_malloc(sizeof(InputBuffer));
+    input_buffer->buffer = NULL;
+    input_buffer->buffer_length = 0;
+    input_buffer->input_length = 0;
+
+    return input_buffer;
 }
 
-Statement* create_statement() {
-    Statement* statement = malloc(sizeof(Statement));
-    statement->row_to_insert = NULL;
-    return statement;
+void print_prompt() {
+    printf("db > ");
 }
 
-void free_statement(Statement* statement) {
-    if (statement->row_to_insert) {
-        free(statement->row_to_insert);
+void read_input(InputBuffer* input_buffer) {
+    ssize_t bytes_read = getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
+
+    if (bytes_read <= 0) {
+        printf("Error reading input\n");
+        exit(EXIT_FAILURE);
     }
-    free(statement);
+    input_buffer->input_length = bytes_read - 1;
+    input_buffer->buffer[bytes_read - 1] = 0;
 }
 
-MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
-    if(strcmp(input_buffer->buffer, ".exit") == 0) {
-        db_close(table);
-        exit(EXIT_SUCCESS);
-    }
-    else {
-        return META_COMMAND_UNRECOGNIZED_COMMAND;
-    }
+void close_input_buffer(InputBuffer* input_buffer) {
+    free(input_buffer->buffer);
+    free(input_buffer);
 }
 
-PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement) {
-    statement->type = STATEMENT_INSERT;
-    statement->row_to_insert = (Row*)malloc(sizeof(Row));
+/*
+ * Server mode. Clients connect over a Unix domain socket or localhost TCP
+ * and send the same statements and meta commands as the REPL, one per
+ * line. Each line is answered with its rows, if any, followed by exactly
+ * one status line, so clients may pipeline requests.
+ *
+ * A pool of workers waits on a single epoll set. Sockets are registered
+ * one-shot, so each connection is served by one worker at a time and is
+ * re-armed once its buffered input has been handled. Selects run in
+ * parallel with each other and with the single writer, under page latches.
+ * The wait for an insert's log commit happens after the writer is done, so
+ * concurrent clients share log flushes; acks are held back until their
+ * inserts are durable. With a commit interval that wait lasts until the
+ * flusher's next sync rather than returning at once, so every ack the
+ * server sends is for a durable insert.
+ *
+ * Client sockets are non-blocking. Statements write into the connection's
+ * output buffer, never to the socket, so a client that stops reading
+ * cannot stall a scan holding latches. Once more than SERVER_OUTPUT_LIMIT
+ * bytes are waiting, the connection runs no more statements until the
+ * client has taken them. A select that gets there stops at the next leaf
+ * and is resumed when the output has drained, so a big result never sits
+ * in memory whole.
+ */
+/* Room for a multi-row insert of some twenty thousand rows. */
+#define SERVER_MAX_LINE (1u << 20)
+#define SERVER_READ_SIZE (16u << 10)
+#define SERVER_OUTPUT_LIMIT (OUTPUT_BUFFER_SIZE / 2)
+#define SERVER_LISTEN_BACKLOG 128
+#define SERVER_MAX_WORKERS 64
+
+typedef struct {
+    const char* socket_path;
+    uint16_t tcp_port;
+    uint32_t workers;
+} ServerOptions;
+
+typedef struct {
+    int fd;
+    bool listener;
+    OutputSink* output;
+    Statement* suspended;
+    bool closing;
+    char* input;
+    size_t input_used;
+    size_t input_capacity;
+    uint64_t pending_lsn;
+    bool has_pending_lsn;
+    Transaction txn;
+    Arena arena;
+    PlanCache plans;
+} Connection;
 
-    char* keywrod = strtok(input_buffer->buffer, " ");
-    char* id_string = strtok(NULL, " ");
-    char* username = strtok(NULL, " ");
-    char* email = strtok(NULL, " ");
-    
-    if(id_string == NULL || username == NULL || email == NULL) {
-        return PREPARE_STRING_NOT_RIGHT;
+/* close_lock is held shared by every statement and log wait, and exclusively by shutdown. */
+typedef struct {
+    DbTable* table;
+    int epoll_fd;
+    pthread_rwlock_t close_lock;
+} Server;
+
+const char* prepare_result_message(PrepareResult result) {
+    switch (result) {
+        case (PREPARE_NEGATIVE_ID):
+            return "ID must be positive.";
+        case (PREPARE_NOT_ID):
+            return "Error: ID must be a number.";
+        case (PREPARE_STRING_NOT_RIGHT):
+            return "Syntax error. Could not parse statement.";
+        case (PREPARE_STRING_TOO_LONG):
+            return "Error: string is too long.";
+        case (PREPARE_PARAMETER_COUNT):
+            return "Error: Wrong number of parameters.";
+        case (PREPARE_UNKNOWN_PREPARED):
+            return "Error: No such prepared statement.";
+        default:
+            return "Syntax error.";
     }
+}
 
-    int id = atoi(id_string);
-    if (!id) {
-        return PREPARE_NOT_ID;
+const char* execute_result_message(EXECUTE_RESULT result) {
+    switch (result) {
+        case (EXECUTE_SUCCESS):
+            return "Executed.";
+        case (EXECUTE_DUPLICATE_KEY):
+            return "Error: Duplicate key.";
+        case (EXECUTE_TABLE_FULL):
+            return "Error: table is full.";
+        case (EXECUTE_TRANSACTION_OPEN):
+            return "Error: A transaction is already open.";
+        case (EXECUTE_NO_TRANSACTION):
+            return "Error: No transaction is open.";
+        case (EXECUTE_LOCKED):
+            return "Error: Database is locked by an open transaction.";
+        case (EXECUTE_UNBOUND_PARAMETER):
+            return "Error: A parameter is not bound.";
+        default:
+            return "Error: table is empty.";
     }
-    if(strlen(username) > USERNAME_SIZE) {
-        return PREPARE_STRING_TOO_LONG;
+}
+
+void sink_write_line(OutputSink* sink, const char* text) {
+    sink_write(sink, text, strlen(text));
+    sink_write_char(sink, '\n');
+}
+
+void sink_write_unrecognized(OutputSink* sink, const char* line, size_t length) {
+    sink_write(sink, "Unrecognized command '", 22);
+    sink_write(sink, line, length);
+    sink_write_line(sink, "'.");
+}
+
+Connection* new_connection(int fd, bool listener) {
+    Connection* connection = checked_malloc(sizeof(Connection));
+    connection->fd = fd;
+    connection->listener = listener;
+    connection->output = listener ? NULL : new_memory_sink(OUTPUT_FORMAT_TUPLE);
+    if (!listener) {
+        connection->output->soft_limit = SERVER_OUTPUT_LIMIT;
     }
-    if(strlen(email) > EMAIL_SIZE) {
-        return PREPARE_STRING_TOO_LONG;
+    connection->suspended = NULL;
+    connection->closing = false;
+    connection->input = NULL;
+    connection->input_used = 0;
+    connection->input_capacity = 0;
+    connection->has_pending_lsn = false;
+    init_transaction(&connection->txn);
+    arena_init(&connection->arena);
+    init_plan_cache(&connection->plans);
+    return connection;
+}
+
+size_t connection_unsent(Connection* connection) {
+    return connection->listener ? 0 : connection->output->used;
+}
+
+/*
+ * A connection with output the client has not taken, or a select still to
+ * resume, waits to become writable instead of readable.
+ */
+void server_watch(Server* server, Connection* connection, int op) {
+    struct epoll_event event;
+    bool writing = connection_unsent(connection) > 0 || (!connection->listener && connection->suspended != NULL);
+    event.events = (writing ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+    event.data.ptr = connection;
+    if (epoll_ctl(server->epoll_fd, op, connection->fd, &event) == -1) {
+        printf("Error registering socket: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
     }
+}
 
-    statement->row_to_insert->id = id;
-    strcpy(statement->row_to_insert->username, username);
-    strcpy(statement->row_to_insert->email, email);
+/* A transaction left open by a client that goes away is rolled back. */
+void close_connection(Server* server, Connection* connection) {
+    if (connection->txn.active) {
+        pthread_rwlock_rdlock(&server->close_lock);
+        execute_rollback(server->table, &connection->txn);
+        pthread_rwlock_unlock(&server->close_lock);
+    }
+    free_transaction(&connection->txn);
+    arena_free(&connection->arena);
+    free_plan_cache(&connection->plans);
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    free_output_sink(connection->output);
+    free(connection->input);
+    free(connection);
+}
 
-    return PREPARE_SUCCESS;
+/*
+ * Waits for the connection's inserts to be durable, which must happen
+ * before their acks go out. Shutdown frees the log, so the wait holds
+ * close_lock like a statement does.
+ */
+void connection_commit(Server* server, Connection* connection) {
+    if (connection->has_pending_lsn) {
+        pthread_rwlock_rdlock(&server->close_lock);
+        wal_wait_durable(server->table->wal, connection->pending_lsn);
+        pthread_rwlock_unlock(&server->close_lock);
+        connection->has_pending_lsn = false;
+    }
 }
 
-PrepareResult prepare_statement(InputBuffer* input_buffer, Statement* statement) {
-    if(strncmp(input_buffer->buffer, "insert", 6) == 0) {
-        return prepare_insert(input_buffer, statement);
+/*
+ * Sends as much buffered output as the socket takes and moves the rest to
+ * the front of the buffer; returns false once the client is gone.
+ */
+bool connection_send(Server* server, Connection* connection) {
+    OutputSink* output = connection->output;
+    size_t output_sent = 0;
+    if (output->used > 0) {
+        connection_commit(server, connection);
     }
-    else if(strcmp(input_buffer->buffer, "select") == 0) {
-        statement->type = STATEMENT_SELECT;
-        return PREPARE_SUCCESS;
+    while (output_sent < output->used) {
+        ssize_t sent = send(connection->fd, output->buffer + output_sent, output->used - output_sent, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            break;
+        }
+        output_sent += sent;
     }
-    else {
-        return PREPARE_UNRECOGNIZED_STATEMENT;
+    output->used -= output_sent;
+    memmove(output->buffer, output->buffer + output_sent, output->used);
+    if (output->used == 0 && output->capacity > OUTPUT_BUFFER_SIZE) {
+        /* A big select's output does not stay allocated once it is gone. */
+        output->capacity = OUTPUT_BUFFER_SIZE;
+        output->buffer = checked_realloc(output->buffer, output->capacity);
     }
+    return true;
 }
 
-void serialize_row(Row* source, void* destination) {
-    memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-    memcpy(destination + USERNAME_OFFSET, &(source->username), USERNAME_SIZE);
-    memcpy(destination + EMAIL_OFFSET, &(source->email), EMAIL_SIZE);
+/* Handles one request line; returns false when the connection should be closed. */
+bool serve_line(Server* server, Connection* connection, char* line, size_t length) {
+    OutputSink* output = connection->output;
+    if (length > 0 && line[length - 1] == '\r') {
+        line[--length] = 0;
+    }
+    if (length == 0) {
+        return true;
+    }
+
+    if (line[0] == '.') {
+        if (strcmp(line, ".exit") == 0) {
+            return false;
+        } else if (strncmp(line, ".format ", 8) == 0) {
+            if (!parse_output_format(line + 8, &output->format)) {
+                sink_write_line(output, "Unknown format. Use tuple, csv, tsv, json or binary.");
+                return true;
+            }
+        } else if (strncmp(line, ".ordered ", 9) == 0) {
+            if (!parse_on_off(line + 9, &output->ordered)) {
+                sink_write_line(output, "Use .ordered on or .ordered off.");
+                return true;
+            }
+        } else if (strcmp(line, ".checkpoint") == 0) {
+            pthread_rwlock_rdlock(&server->close_lock);
+            pthread_mutex_lock(&server->table->write_lock);
+            bool locked = server->table->txn != NULL;
+            if (!locked) {
+                db_checkpoint(server->table);
+            }
+            pthread_mutex_unlock(&server->table->write_lock);
+            pthread_rwlock_unlock(&server->close_lock);
+            if (locked) {
+                sink_write_line(output, execute_result_message(EXECUTE_LOCKED));
+                return true;
+            }
+        } else {
+            sink_write_unrecognized(output, line, length);
+            return true;
+        }
+        sink_write_line(output, execute_result_message(EXECUTE_SUCCESS));
+        return true;
+    }
+
+    arena_reset(&connection->arena);
+    Statement* statement = create_statement(&connection->arena);
+    PrepareResult prepare_result = prepare_statement(line, statement, &connection->arena, &connection->plans);
+    if (prepare_result == PREPARE_UNRECOGNIZED_STATEMENT) {
+        sink_write_unrecognized(output, line, length);
+        return true;
+    }
+    if (prepare_result != PREPARE_SUCCESS) {
+        sink_write_line(output, prepare_result_message(prepare_result));
+        return true;
+    }
+
+    uint64_t lsn;
+    pthread_rwlock_rdlock(&server->close_lock);
+    EXECUTE_RESULT result = apply_statement(statement, server->table, &connection->txn, output, &lsn);
+    pthread_rwlock_unlock(&server->close_lock);
+    if (lsn != NO_LSN) {
+        connection->pending_lsn = lsn;
+        connection->has_pending_lsn = true;
+    }
+
+    if (result == EXECUTE_SUSPENDED) {
+        connection->suspended = statement;
+        return true;
+    }
+    sink_write_line(output, execute_result_message(result));
+    return true;
 }
 
-void deserialize_row(Row* destination, void* source) {
-    memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
+/* Runs the suspended select on from where it stopped; its statement is still in the arena. */
+void resume_select(Server* server, Connection* connection) {
+    uint64_t lsn;
+    pthread_rwlock_rdlock(&server->close_lock);
+    EXECUTE_RESULT result =
+        apply_statement(connection->suspended, server->table, &connection->txn, connection->output, &lsn);
+    pthread_rwlock_unlock(&server->close_lock);
+    if (result != EXECUTE_SUSPENDED) {
+        connection->suspended = NULL;
+        sink_write_line(connection->output, execute_result_message(result));
+    }
 }
 
-InputBuffer* new_input_Buffer() {
-    InputBuffer* input_buffer = (InputBuffer*)malloc(sizeof(InputBuffer));
-    input_buffer->buffer = NULL;
-    input_buffer->buffer_length = 0;
-    input_buffer->input_length = 0;
+/*
+ * Finishes any suspended select, then serves the complete lines buffered
+ * so far, stopping early once too much output is waiting, and keeps the
+ * rest.
+ */
+bool serve_input(Server* server, Connection* connection) {
+    char* start = connection->input;
+    char* end = connection->input + connection->input_used;
+    bool partial_line = false;
+    bool open = true;
+    while (open && connection_unsent(connection) <= SERVER_OUTPUT_LIMIT) {
+        if (connection->suspended != NULL) {
+            resume_select(server, connection);
+            continue;
+        }
+        char* newline = memchr(start, '\n', end - start);
+        if (newline == NULL) {
+            partial_line = true;
+            break;
+        }
+        *newline = 0;
+        open = serve_line(server, connection, start, newline - start);
+        start = newline + 1;
+    }
+    connection->input_used = end - start;
+    memmove(connection->input, start, connection->input_used);
+    if (open && partial_line && connection->input_used > SERVER_MAX_LINE) {
+        sink_write_line(connection->output, "Error: line is too long.");
+        open = false;
+    }
+    return open;
+}
 
-    return input_buffer;
+/*
+ * Runs the connection's statements until its input runs dry or its output
+ * backs up. A connection that is closing only finishes sending.
+ */
+void serve_connection(Server* server, Connection* connection) {
+    bool open = !connection->closing;
+    while (open) {
+        open = serve_input(server, connection);
+        if (!open) {
+            break;
+        }
+        if (connection_unsent(connection) > SERVER_OUTPUT_LIMIT) {
+            open = connection_send(server, connection);
+            if (connection_unsent(connection) > SERVER_OUTPUT_LIMIT) {
+                break;
+            }
+            continue;
+        }
+        if (connection->input_capacity - connection->input_used < SERVER_READ_SIZE) {
+            connection->input_capacity = connection->input_used + 2 * SERVER_READ_SIZE;
+            connection->input = checked_realloc(connection->input, connection->input_capacity);
+        }
+        ssize_t bytes_read = recv(connection->fd, connection->input + connection->input_used,
+                                  connection->input_capacity - connection->input_used, 0);
+        if (bytes_read > 0) {
+            connection->input_used += bytes_read;
+        } else if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        } else if (bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            open = false;
+        }
+    }
+    bool reachable = connection_send(server, connection);
+    if (reachable && (open || connection_unsent(connection) > 0)) {
+        /* A client that hung up or sent .exit still gets the answers it asked for. */
+        connection->closing = !open;
+        server_watch(server, connection, EPOLL_CTL_MOD);
+    } else {
+        close_connection(server, connection);
+    }
 }
 
-void print_prompt() {
-    printf("db > ");
+void server_accept(Server* server, Connection* listener) {
+    while (1) {
+        int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        server_watch(server, new_connection(fd, false), EPOLL_CTL_ADD);
+    }
+    server_watch(server, listener, EPOLL_CTL_MOD);
 }
 
-void read_input(InputBuffer* input_buffer) {
-    ssize_t bytes_read = getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
+void* server_worker_main(void* arg) {
+    Server* server = arg;
+    struct epoll_event event;
+    while (1) {
+        int num_events = epoll_wait(server->epoll_fd, &event, 1, -1);
+        if (num_events == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error waiting for connections: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        Connection* connection = event.data.ptr;
+        if (connection->listener) {
+            server_accept(server, connection);
+        } else {
+            serve_connection(server, connection);
+        }
+    }
+    return NULL;
+}
 
-    if (bytes_read <= 0) {
-        printf("Error reading input\n");
+void server_add_listener(Server* server, int fd, const char* description) {
+    if (listen(fd, SERVER_LISTEN_BACKLOG) == -1) {
+        printf("Unable to listen on %s: %s\n", description, strerror(errno));
         exit(EXIT_FAILURE);
     }
-    input_buffer->input_length = bytes_read - 1;
-    input_buffer->buffer[bytes_read - 1] = 0;
-}  
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    server_watch(server, new_connection(fd, true), EPOLL_CTL_ADD);
+    printf("Listening on %s\n", description);
+}
 
-void print_row(Row* row) {
-    printf("(%d, %s, %s)\n", row->id, row->username, row->email);
+int server_bind_unix(const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Socket path is too long.\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (fd == -1 || bind(fd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        printf("Unable to bind %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return fd;
 }
 
-EXECUTE_RESULT execute_insert(Statement* statement, Table* table) {
-    if (table->num_rows >= TABLE_MAX_ROWS) {
-        return EXECUTE_TABLE_FULL;
+int server_bind_tcp(uint16_t port) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+        bind(fd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        printf("Unable to bind 127.0.0.1:%u: %s\n", port, strerror(errno));
+        exit(EXIT_FAILURE);
     }
-    Row* row_to_insert = statement->row_to_insert;
+    return fd;
+}
 
-    serialize_row(row_to_insert, row_slot(table, table->num_rows));
-    ++(table->num_rows);
+/*
+ * Runs until SIGINT or SIGTERM, then checkpoints and exits. The signals are
+ * blocked before any thread starts, including the log flusher, so only the
+ * main thread ever sees them.
+ */
+void run_server(const char* filename, DbOptions* db_options, ServerOptions* options) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
 
-    return EXECUTE_SUCCESS;
-}
+    Server server;
+    server.table = open_table(filename, db_options);
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&server.close_lock, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server.epoll_fd == -1) {
+        printf("Unable to create epoll instance.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options->socket_path != NULL) {
+        server_add_listener(&server, server_bind_unix(options->socket_path), options->socket_path);
+    }
+    if (options->tcp_port != 0) {
+        char description[32];
+        snprintf(description, sizeof(description), "127.0.0.1:%u", options->tcp_port);
+        server_add_listener(&server, server_bind_tcp(options->tcp_port), description);
+    }
+    fflush(stdout);
 
-EXECUTE_RESULT execute_select(Statement* statement, Table* table) {
-    if(table->num_rows == 0) {
-        return EXECUTE_TABLE_EMPTY;
+    for (uint32_t i = 0; i < options->workers; ++i) {
+        pthread_t worker;
+        pthread_create(&worker, NULL, server_worker_main, &server);
+        pthread_detach(worker);
     }
-    Row row;
-    for(uint32_t i = 0; i < table->num_rows; ++i) {
-        deserialize_row(&row, row_slot(table, i));
-        print_row(&row);
+
+    int signal_number;
+    sigwait(&signals, &signal_number);
+    pthread_rwlock_wrlock(&server.close_lock);
+    db_close(server.table);
+    if (options->socket_path != NULL) {
+        unlink(options->socket_path);
     }
-    return EXECUTE_SUCCESS;
+    exit(EXIT_SUCCESS);
 }
 
-EXECUTE_RESULT execute_statement(Statement* statement, Table* table) {
-    switch (statement->type) {
-    case (STATEMENT_INSERT):
-        return execute_insert(statement, table);
-    case (STATEMENT_SELECT):
-        return execute_select(statement, table);
+/* Parses a thread count, clamping it to 1..max. */
+uint32_t parse_thread_count(const char* text, uint32_t max) {
+    long count = strtol(text, NULL, 10);
+    if (count < 1) {
+        return 1;
     }
+    return count < max ? count : max;
 }
 
-void close_input_buffer(InputBuffer* input_buffer) {
-    free(input_buffer->buffer);
-    free(input_buffer);
+void print_usage() {
+    printf("Usage: db [--frames N] [--mmap] [--compress] [--pax] [--commit-interval MS]\n"
+           "          [--scan-threads N] [--socket PATH] [--port N] [--workers N] <database>\n");
 }
 
 int main(int argc, char* argv[]) {
-    if(argc < 2) {
+    db_set_fatal_handler(exit_fatal_handler);
+    DbOptions options = db_default_options();
+    ServerOptions server_options;
+    server_options.socket_path = NULL;
+    server_options.tcp_port = 0;
+    server_options.workers = online_processors(SERVER_MAX_WORKERS);
+    const char* filename = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            options.pool_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            server_options.socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            server_options.tcp_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            server_options.workers = parse_thread_count(argv[++i], SERVER_MAX_WORKERS);
+        } else if (strcmp(argv[i], "--commit-interval") == 0 && i + 1 < argc) {
+            options.commit_interval_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scan-threads") == 0 && i + 1 < argc) {
+            options.scan_threads = parse_thread_count(argv[++i], UINT32_MAX);
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            options.pager_mode = DB_PAGER_MODE_MMAP;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            options.compress = true;
+        } else if (strcmp(argv[i], "--pax") == 0) {
+            options.pax = true;
+        } else if (argv[i][0] == '-') {
+            print_usage();
+            exit(EXIT_FAILURE);
+        } else {
+            filename = argv[i];
+        }
+    }
+    if(filename == NULL) {
         printf("Must supply a database name.\n");
         exit(EXIT_FAILURE);
     }
-    const char* filename = argv[1];
-    Table* table = db_open(filename);
+    if (server_options.socket_path != NULL || server_options.tcp_port != 0) {
+        run_server(filename, &options, &server_options);
+    }
+    DbTable* table = open_table(filename, &options);
     InputBuffer* input_buffer = new_input_Buffer();
+    OutputSink* output = new_output_sink(STDOUT_FILENO);
+    Transaction txn;
+    init_transaction(&txn);
+    Arena arena;
+    arena_init(&arena);
+    PlanCache plans;
+    init_plan_cache(&plans);
 
     printf("Welcome to db: %s\n", filename);
     while (1) {
         print_prompt();
         read_input(input_buffer);
         if (input_buffer->buffer[0] == '.') {
-            switch (do_meta_command(input_buffer, table)) {
+            switch (do_meta_command(input_buffer, table, output)) {
                 case (META_COMMAND_SUCCESS):
                     continue;
                 case (META_COMMAND_UNRECOGNIZED_COMMAND):
@@ -368,33 +979,67 @@ int main(int argc, char* argv[]) {
                     continue;
             }
         }
-        Statement* statement = create_statement();
-        switch (prepare_statement(input_buffer, statement)) {
+        /* Whatever the previous line allocated goes, however it ended. */
+        arena_reset(&arena);
+        Statement* statement = create_statement(&arena);
+        switch (prepare_statement(input_buffer->buffer, statement, &arena, &plans)) {
             case (PREPARE_NEGATIVE_ID):
                 printf("ID must be positive.\n");
                 continue;
+            case (PREPARE_NOT_ID):
+                printf("Error: ID must be a number.\n");
+                continue;
+            case (PREPARE_STRING_NOT_RIGHT):
+                printf("Syntax error. Could not parse statement.\n");
+                continue;
             case (PREPARE_SUCCESS):
                 break;
             case (PREPARE_STRING_TOO_LONG):
                 printf("Error: string is too long.\n");
+                continue;
             case (PREPARE_SYNTAX_ERROR):
                 printf("Syntax error.\n");
                 continue;
             case (PREPARE_UNRECOGNIZED_STATEMENT):
                 printf("Unrecognized command '%s'.\n", input_buffer->buffer);
                 continue;
+            case (PREPARE_PARAMETER_COUNT):
+                printf("Error: Wrong number of parameters.\n");
+                continue;
+            case (PREPARE_UNKNOWN_PREPARED):
+                printf("Error: No such prepared statement.\n");
+                continue;
         }
-        switch (execute_statement(statement, table)) {
+        /* The sink writes rows straight to the descriptor, behind whatever stdio still holds. */
+        fflush(stdout);
+        switch (execute_statement(statement, table, &txn, output)) {
             case (EXECUTE_SUCCESS):
                 printf("Executed.\n");
                 break;
+            case (EXECUTE_DUPLICATE_KEY):
+                printf("Error: Duplicate key.\n");
+                break;
             case (EXECUTE_TABLE_FULL):
                 printf("Error: table is full.\n");
                 break;
             case (EXECUTE_TABLE_EMPTY):
                 printf("Error: table is empty.\n");
                 break;
+            case (EXECUTE_TRANSACTION_OPEN):
+                printf("Error: A transaction is already open.\n");
+                break;
+            case (EXECUTE_NO_TRANSACTION):
+                printf("Error: No transaction is open.\n");
+                break;
+            case (EXECUTE_LOCKED):
+                printf("Error: Database is locked by an open transaction.\n");
+                break;
+            case (EXECUTE_UNBOUND_PARAMETER):
+                printf("Error: A parameter is not bound.\n");
+                break;
+            case (EXECUTE_SUSPENDED):
+                /* Only a bounded memory sink stops a select early; the REPL's writes straight out. */
+                break;
         }
-        free_statement(statement);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,5935 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <immintrin.h>
+
+#include "simpledb_internal.h"
+
+/*
+ * Failures the engine cannot back out of: I/O errors and damage found in
+ * the middle of an operation, and broken invariants. The message goes to
+ * the fatal handler, and if that returns the process aborts.
+ */
+void stderr_fatal_handler(const char* message) {
+    fprintf(stderr, "simpledb: %s\n", message);
+}
+
+DbFatalHandler fatal_handler = stderr_fatal_handler;
+
+void db_set_fatal_handler(DbFatalHandler handler) {
+    fatal_handler = handler != NULL ? handler : stderr_fatal_handler;
+}
+
+__attribute__((noreturn, format(printf, 1, 2))) void db_fatal(const char* format, ...) {
+    char message[256];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(message, sizeof(message), format, arguments);
+    va_end(arguments);
+    fatal_handler(message);
+    abort();
+}
+
+/*
+ * For allocations made where the engine cannot back out, such as with
+ * pages pinned or a statement half applied: running out of memory there is
+ * fatal, as it is in arena_alloc.
+ */
+void* checked_malloc(size_t size) {
+    void* memory = malloc(size);
+    if (memory == NULL) {
+        db_fatal("Error: out of memory.");
+    }
+    return memory;
+}
+
+void* checked_realloc(void* memory, size_t size) {
+    memory = realloc(memory, size);
+    if (memory == NULL) {
+        db_fatal("Error: out of memory.");
+    }
+    return memory;
+}
+
+#define size_of_attribute(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
+
+/*
+ * Rows are stored variable-length: id | begin txn | end txn | username
+ * length | username | email length | email, with no padding or terminators.
+ * Lengths fit in one byte since both columns are capped below 256
+ * characters.
+ *
+ * The transaction ids make rows multi-version. A row is visible to a
+ * snapshot taken at transaction s when begin_txn <= s < end_txn; end_txn is
+ * TXN_ID_MAX until something deletes the row.
+ */
+const uint32_t ID_SIZE = size_of_attribute(Row, id);
+const uint32_t TXN_ID_SIZE = size_of_attribute(Row, begin_txn);
+const uint32_t STRING_LENGTH_SIZE = sizeof(uint8_t);
+
+const uint32_t PAGE_SIZE = 4096;
+
+/*
+ * Write-ahead log. execute_insert appends a redo record for each row and
+ * then commits it. Records are buffered in memory and written with a single
+ * write + fdatasync per group:
+ *
+ *  - commit_interval_ms == 0: wal_commit blocks until the record is durable.
+ *    The first committer to find no flush in progress becomes the leader and
+ *    syncs everything buffered so far; committers arriving meanwhile wait and
+ *    are usually covered by the leader's fsync or the next one.
+ *  - commit_interval_ms > 0: wal_commit returns at once and a background
+ *    flusher syncs the buffer every interval, bounding the loss window on a
+ *    crash to one interval. A caller that must not acknowledge a record
+ *    before it is durable, like the server, waits for that sync with
+ *    wal_wait_durable.
+ *
+ * Inserts are logged logically, which cannot repair a B+tree whose pages
+ * reached disk from different points in time. So each log starts with a
+ * checkpoint record holding the page count of the checkpointed file, and
+ * the first time a checkpointed page is dirtied its checkpointed image is
+ * logged too. Recovery writes those images back, truncates the file to the
+ * checkpointed length and then replays the inserts on top.
+ *
+ * An explicit transaction logs all of its rows as a single record at
+ * COMMIT, and a multi-row insert outside one does the same, so recovery
+ * replays either whole or not at all.
+ *
+ * Record layout: checksum | length | lsn | type | payload. Recovery stops at
+ * the first record that is truncated or fails its checksum.
+ */
+#define WAL_RECORD_INSERT 1
+#define WAL_RECORD_CHECKPOINT 2
+#define WAL_RECORD_PAGE_IMAGE 3
+#define WAL_RECORD_TRANSACTION 4
+#define WAL_RECORD_HEADER_SIZE (sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t))
+#define WAL_INITIAL_BUFFER_SIZE (64u << 10)
+#define WAL_CHECKPOINT_SIZE (64u << 20)
+#define DEFAULT_COMMIT_INTERVAL_MS 10
+
+struct Wal {
+    int fd;
+    char* buffer;
+    size_t buffer_used;
+    size_t buffer_capacity;
+    char* flush_buffer;
+    size_t flush_buffer_capacity;
+    off_t file_length;
+    uint64_t next_lsn;
+    uint64_t durable_lsn;
+    uint32_t commit_interval_ms;
+    bool flush_in_progress;
+    bool stop_flusher;
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t flushed;
+    pthread_cond_t flusher_wakeup;
+};
+
+uint32_t crc32_table[256];
+pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+void init_crc32_table() {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+        }
+        crc32_table[i] = crc;
+    }
+}
+
+uint32_t crc32(const void* data, size_t length) {
+    const uint8_t* bytes = data;
+    uint32_t crc = 0xFFFFFFFFu;
+    pthread_once(&crc32_table_once, init_crc32_table);
+    for (size_t i = 0; i < length; ++i) {
+        crc = crc32_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void write_fully(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            db_fatal("Error writing log.");
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+/*
+ * Writes and syncs everything buffered so far. Called and returns with
+ * wal->lock held, but drops it around the I/O so appends can continue into
+ * the other buffer.
+ */
+void wal_flush_locked(Wal* wal) {
+    while (wal->flush_in_progress) {
+        pthread_cond_wait(&wal->flushed, &wal->lock);
+    }
+    if (wal->durable_lsn == wal->next_lsn) {
+        return;
+    }
+    char* data = wal->buffer;
+    size_t length = wal->buffer_used;
+    uint64_t target_lsn = wal->next_lsn;
+    wal->buffer = wal->flush_buffer;
+    wal->buffer_used = 0;
+    size_t capacity = wal->buffer_capacity;
+    wal->buffer_capacity = wal->flush_buffer_capacity;
+    wal->flush_in_progress = true;
+    pthread_mutex_unlock(&wal->lock);
+
+    write_fully(wal->fd, data, length);
+    if (fdatasync(wal->fd) == -1) {
+        db_fatal("Error syncing log.");
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    wal->flush_buffer = data;
+    wal->flush_buffer_capacity = capacity;
+    wal->file_length += length;
+    wal->durable_lsn = target_lsn;
+    wal->flush_in_progress = false;
+    pthread_cond_broadcast(&wal->flushed);
+}
+
+void wal_flush(Wal* wal) {
+    pthread_mutex_lock(&wal->lock);
+    wal_flush_locked(wal);
+    pthread_mutex_unlock(&wal->lock);
+}
+
+void* wal_flusher_main(void* arg) {
+    Wal* wal = arg;
+    pthread_mutex_lock(&wal->lock);
+    while (!wal->stop_flusher) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)wal->commit_interval_ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&wal->flusher_wakeup, &wal->lock, &deadline);
+        wal_flush_locked(wal);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return NULL;
+}
+
+DbResult wal_open(const char* db_filename, uint32_t commit_interval_ms, Wal** result) {
+    size_t name_length = strlen(db_filename) + sizeof("-wal");
+    char* filename = malloc(name_length);
+    if (filename == NULL) {
+        return DB_OUT_OF_MEMORY;
+    }
+    snprintf(filename, name_length, "%s-wal", db_filename);
+    int fd = open(filename, O_RDWR | O_CREAT | O_APPEND, S_IWUSR | S_IRUSR);
+    free(filename);
+    if (fd == -1) {
+        return DB_CANNOT_OPEN;
+    }
+
+    Wal* wal = malloc(sizeof(Wal));
+    char* buffer = malloc(WAL_INITIAL_BUFFER_SIZE);
+    char* flush_buffer = malloc(WAL_INITIAL_BUFFER_SIZE);
+    if (wal == NULL || buffer == NULL || flush_buffer == NULL) {
+        close(fd);
+        free(wal);
+        free(buffer);
+        free(flush_buffer);
+        return DB_OUT_OF_MEMORY;
+    }
+    wal->fd = fd;
+    wal->buffer_capacity = WAL_INITIAL_BUFFER_SIZE;
+    wal->buffer = buffer;
+    wal->buffer_used = 0;
+    wal->flush_buffer_capacity = WAL_INITIAL_BUFFER_SIZE;
+    wal->flush_buffer = flush_buffer;
+    wal->file_length = lseek(fd, 0, SEEK_END);
+    wal->next_lsn = 0;
+    wal->durable_lsn = 0;
+    wal->commit_interval_ms = commit_interval_ms;
+    wal->flush_in_progress = false;
+    wal->stop_flusher = false;
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->flushed, NULL);
+    pthread_cond_init(&wal->flusher_wakeup, NULL);
+    *result = wal;
+    return DB_SUCCESS;
+}
+
+void wal_start_flusher(Wal* wal) {
+    if (wal->commit_interval_ms > 0) {
+        pthread_create(&wal->flusher, NULL, wal_flusher_main, wal);
+    }
+}
+
+/* Buffers one record and returns its LSN. */
+uint64_t wal_append(Wal* wal, uint32_t type, const void* payload, uint32_t length) {
+    pthread_mutex_lock(&wal->lock);
+    size_t record_size = WAL_RECORD_HEADER_SIZE + length;
+    if (wal->buffer_used + record_size > wal->buffer_capacity) {
+        while (wal->buffer_used + record_size > wal->buffer_capacity) {
+            wal->buffer_capacity *= 2;
+        }
+        wal->buffer = checked_realloc(wal->buffer, wal->buffer_capacity);
+    }
+    char* record = wal->buffer + wal->buffer_used;
+    uint64_t lsn = wal->next_lsn++;
+    memcpy(record + sizeof(uint32_t), &length, sizeof(uint32_t));
+    memcpy(record + 2 * sizeof(uint32_t), &lsn, sizeof(uint64_t));
+    memcpy(record + 2 * sizeof(uint32_t) + sizeof(uint64_t), &type, sizeof(uint32_t));
+    memcpy(record + WAL_RECORD_HEADER_SIZE, payload, length);
+    uint32_t checksum = crc32(record + sizeof(uint32_t), record_size - sizeof(uint32_t));
+    memcpy(record, &checksum, sizeof(uint32_t));
+    wal->buffer_used += record_size;
+    pthread_mutex_unlock(&wal->lock);
+    return lsn;
+}
+
+/* Waits until the record at lsn and everything before it is on disk. */
+void wal_flush_to(Wal* wal, uint64_t lsn) {
+    pthread_mutex_lock(&wal->lock);
+    while (wal->durable_lsn <= lsn) {
+        wal_flush_locked(wal);
+    }
+    pthread_mutex_unlock(&wal->lock);
+}
+
+bool wal_is_durable(Wal* wal, uint64_t lsn) {
+    pthread_mutex_lock(&wal->lock);
+    bool durable = lsn < wal->durable_lsn;
+    pthread_mutex_unlock(&wal->lock);
+    return durable;
+}
+
+void wal_commit(Wal* wal, uint64_t lsn) {
+    if (wal->commit_interval_ms > 0) {
+        return;
+    }
+    wal_flush_to(wal, lsn);
+}
+
+/*
+ * Blocks until the record at lsn is durable whatever the commit interval:
+ * with a background flusher it waits for the next sync, which covers every
+ * waiter at once, instead of syncing itself.
+ */
+void wal_wait_durable(Wal* wal, uint64_t lsn) {
+    if (wal->commit_interval_ms == 0) {
+        wal_flush_to(wal, lsn);
+        return;
+    }
+    pthread_mutex_lock(&wal->lock);
+    while (wal->durable_lsn <= lsn) {
+        pthread_cond_wait(&wal->flushed, &wal->lock);
+    }
+    pthread_mutex_unlock(&wal->lock);
+}
+
+/* Discards the log once every change it holds has reached the database file. */
+void wal_truncate(Wal* wal) {
+    pthread_mutex_lock(&wal->lock);
+    while (wal->flush_in_progress) {
+        pthread_cond_wait(&wal->flushed, &wal->lock);
+    }
+    if (ftruncate(wal->fd, 0) == -1 || fdatasync(wal->fd) == -1) {
+        db_fatal("Error truncating log.");
+    }
+    wal->buffer_used = 0;
+    wal->file_length = 0;
+    wal->durable_lsn = wal->next_lsn;
+    pthread_cond_broadcast(&wal->flushed);
+    pthread_mutex_unlock(&wal->lock);
+}
+
+bool wal_needs_checkpoint(Wal* wal) {
+    pthread_mutex_lock(&wal->lock);
+    bool needed = wal->file_length + (off_t)wal->buffer_used > WAL_CHECKPOINT_SIZE;
+    pthread_mutex_unlock(&wal->lock);
+    return needed;
+}
+
+/* Frees a log whose flusher was never started. */
+void wal_release(Wal* wal) {
+    close(wal->fd);
+    free(wal->buffer);
+    free(wal->flush_buffer);
+    pthread_mutex_destroy(&wal->lock);
+    pthread_cond_destroy(&wal->flushed);
+    pthread_cond_destroy(&wal->flusher_wakeup);
+    free(wal);
+}
+
+void wal_close(Wal* wal) {
+    pthread_mutex_lock(&wal->lock);
+    wal->stop_flusher = true;
+    pthread_cond_signal(&wal->flusher_wakeup);
+    pthread_mutex_unlock(&wal->lock);
+    if (wal->commit_interval_ms > 0) {
+        pthread_join(wal->flusher, NULL);
+    }
+    wal_flush(wal);
+    wal_release(wal);
+}
+
+char* wal_read_log(Wal* wal) {
+    char* log = checked_malloc(wal->file_length);
+    ssize_t bytes_read = pread(wal->fd, log, wal->file_length, 0);
+    if (bytes_read != wal->file_length) {
+        db_fatal("Error reading log.");
+    }
+    return log;
+}
+
+/* Steps over one record, returning false at the end of the valid log. */
+bool wal_next_record(char* log, off_t log_length, off_t* offset, uint32_t* type, char** payload,
+                     uint32_t* length) {
+    if (*offset + (off_t)WAL_RECORD_HEADER_SIZE > log_length) {
+        return false;
+    }
+    char* record = log + *offset;
+    uint32_t checksum;
+    memcpy(&checksum, record, sizeof(uint32_t));
+    memcpy(length, record + sizeof(uint32_t), sizeof(uint32_t));
+    memcpy(type, record + 2 * sizeof(uint32_t) + sizeof(uint64_t), sizeof(uint32_t));
+    size_t record_size = WAL_RECORD_HEADER_SIZE + *length;
+    if (*offset + (off_t)record_size > log_length ||
+        crc32(record + sizeof(uint32_t), record_size - sizeof(uint32_t)) != checksum) {
+        return false;
+    }
+    *payload = record + WAL_RECORD_HEADER_SIZE;
+    *offset += record_size;
+    return true;
+}
+
+#define DEFAULT_POOL_FRAMES 256
+#define MMAP_INITIAL_RESERVE (64u << 20)
+#define INVALID_FRAME -1
+#define INVALID_PAGE_NUM UINT32_MAX
+#define PAGE_LATCH_CHUNK 1024
+
+/*
+ * A frame is one PAGE_SIZE slot of the buffer pool. Frames with a zero pin
+ * count sit on the LRU list (head = least recently used) and are the only
+ * candidates for eviction; dirty frames are written back before reuse.
+ * image_lsn is the LSN of the page's logged checkpoint image, which must be
+ * durable before the frame is written back; NO_LSN once it is.
+ *
+ * loading is set while the frame's page is being written back or read in
+ * without the pager lock. Other threads may pin the frame meanwhile, but
+ * wait on loaded before they touch its data.
+ */
+typedef struct {
+    void* data;
+    uint32_t page_num;
+    uint32_t pin_count;
+    bool dirty;
+    bool loading;
+    pthread_cond_t loaded;
+    uint64_t image_lsn;
+    int32_t hash_next;
+    int32_t lru_prev;
+    int32_t lru_next;
+} Frame;
+
+typedef struct {
+    uint32_t page_num;
+    void* image;
+} ShadowPage;
+
+/*
+ * Compressed files store each page as an extent of whole sectors anywhere
+ * in the file, found through a translation table indexed by page number.
+ * A length of PAGE_SIZE means the page did not compress and is stored as
+ * is; a length of 0 means the page was never written.
+ */
+#define COMPRESSED_SECTOR_SIZE 256
+#define COMPRESSED_PAGE_SECTORS (4096 / COMPRESSED_SECTOR_SIZE)
+#define COMPRESSED_FILE_MAGIC "SDBPAGES"
+
+typedef struct {
+    uint32_t sector;
+    uint32_t length;
+} PageExtent;
+
+/*
+ * Kept in the last bytes of page 0, after the database header, to say where
+ * the checkpointed translation table is.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t num_pages;
+    uint32_t table_sector;
+    uint32_t table_length;
+    uint32_t table_checksum;
+} CompressedFileInfo;
+
+#define COMPRESSED_INFO_OFFSET (PAGE_SIZE - sizeof(CompressedFileInfo))
+
+/*
+ * In DB_PAGER_MODE_MMAP the frames are unused: get_page returns pointers into a
+ * shared mapping of the whole file and the kernel page cache does the
+ * caching and write-back. The mapping reserves more address space than the
+ * file needs so that growing the file rarely has to move it.
+ *
+ * A compressed pager (buffered mode only) compresses pages as they are
+ * written back and decompresses them as they are read, so the pool holds
+ * plain pages. A page is never written over its checkpointed extent: it
+ * goes to free sectors, and a checkpoint switches to the new versions by
+ * writing a new translation table and then page 0, which points at it.
+ * live_sectors marks the sectors of the current versions and the table;
+ * checkpoint_sectors the ones the last checkpoint still needs. A sector is
+ * free when it is in neither.
+ *
+ * Concurrency: lock guards the pager's own state (page table, LRU, pins,
+ * dirty flags, the mapping) and is only held inside pager calls, though
+ * not across the reads and write-backs of a page fault. Page
+ * contents are guarded by a reader-writer latch per page, which callers
+ * take on pages they have pinned. Latches live in chunks allocated on first
+ * use, so a latch never moves while it may be held.
+ */
+struct Pager {
+    int fd;
+    DbPagerMode mode;
+    off_t file_length;
+    uint32_t num_pages;
+    char* map;
+    size_t map_capacity;
+    size_t map_file_length;
+    uint32_t map_pins;
+    uint32_t num_frames;
+    Frame* frames;
+    void* frame_memory;
+    int32_t* page_table;
+    uint32_t page_table_mask;
+    int32_t lru_head;
+    int32_t lru_tail;
+    Wal* wal;
+    uint32_t checkpoint_num_pages;
+    uint8_t* logged_pages;
+    bool in_transaction;
+    uint32_t transaction_num_pages;
+    uint8_t* shadowed_pages;
+    ShadowPage* shadow_pages;
+    uint32_t num_shadow_pages;
+    uint32_t shadow_capacity;
+    bool compressed;
+    PageExtent* extents;
+    uint32_t extent_capacity;
+    PageExtent table_extent;
+    uint64_t* live_sectors;
+    uint64_t* checkpoint_sectors;
+    uint32_t num_sectors;
+    uint32_t sector_capacity;
+    uint32_t sector_cursors[COMPRESSED_PAGE_SECTORS + 1];
+    pthread_mutex_t lock;
+    pthread_rwlock_t** latch_chunks;
+    uint32_t num_latch_chunks;
+};
+
+/*
+ * Thread pool for parallel scans. A batch is a set of tasks numbered 0..n-1;
+ * each worker starts on its own contiguous share of them, taking tasks
+ * from the front, and once that runs out it steals from the back of the
+ * other workers' shares. One batch runs at a time: a caller that finds the
+ * pool busy does its work serially instead. Pools are capped at
+ * MAX_SCAN_THREADS workers.
+ */
+#define MAX_SCAN_THREADS 64
+
+typedef void (*TaskFunction)(void* arg, uint32_t task);
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t head;
+    uint32_t tail;
+} TaskRange;
+
+typedef struct {
+    ThreadPool* pool;
+    uint32_t index;
+} PoolWorker;
+
+struct ThreadPool {
+    uint32_t num_threads;
+    pthread_t* threads;
+    PoolWorker* workers;
+    TaskRange* ranges;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    uint64_t generation;
+    uint32_t active;
+    bool busy;
+    bool stop;
+    TaskFunction function;
+    void* arg;
+};
+
+bool thread_pool_next_task(ThreadPool* pool, uint32_t self, uint32_t* task) {
+    for (uint32_t i = 0; i < pool->num_threads; ++i) {
+        TaskRange* range = &pool->ranges[(self + i) % pool->num_threads];
+        pthread_mutex_lock(&range->lock);
+        bool found = range->head < range->tail;
+        if (found) {
+            *task = i == 0 ? range->head++ : --range->tail;
+        }
+        pthread_mutex_unlock(&range->lock);
+        if (found) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void* thread_pool_worker_main(void* arg) {
+    PoolWorker* worker = arg;
+    ThreadPool* pool = worker->pool;
+    uint64_t seen_generation = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->stop && pool->generation == seen_generation) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen_generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        uint32_t task;
+        while (thread_pool_next_task(pool, worker->index, &task)) {
+            pool->function(pool->arg, task);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) {
+            pthread_cond_broadcast(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Returns NULL if there is no memory for the pool. */
+ThreadPool* new_thread_pool(uint32_t num_threads) {
+    ThreadPool* pool = malloc(sizeof(ThreadPool));
+    pthread_t* threads = malloc(num_threads * sizeof(pthread_t));
+    PoolWorker* workers = malloc(num_threads * sizeof(PoolWorker));
+    TaskRange* ranges = malloc(num_threads * sizeof(TaskRange));
+    if (pool == NULL || threads == NULL || workers == NULL || ranges == NULL) {
+        free(pool);
+        free(threads);
+        free(workers);
+        free(ranges);
+        return NULL;
+    }
+    pool->num_threads = num_threads;
+    pool->threads = threads;
+    pool->workers = workers;
+    pool->ranges = ranges;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->generation = 0;
+    pool->active = 0;
+    pool->busy = false;
+    pool->stop = false;
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        pthread_mutex_init(&pool->ranges[i].lock, NULL);
+        pool->ranges[i].head = 0;
+        pool->ranges[i].tail = 0;
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_create(&pool->threads[i], NULL, thread_pool_worker_main, &pool->workers[i]);
+    }
+    return pool;
+}
+
+/* Starts a batch of num_tasks tasks, or returns false if another batch is running. */
+bool thread_pool_begin(ThreadPool* pool, uint32_t num_tasks, TaskFunction function, void* arg) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->busy) {
+        pthread_mutex_unlock(&pool->lock);
+        return false;
+    }
+    pool->busy = true;
+    pool->function = function;
+    pool->arg = arg;
+    for (uint32_t i = 0; i < pool->num_threads; ++i) {
+        pool->ranges[i].head = (uint64_t)num_tasks * i / pool->num_threads;
+        pool->ranges[i].tail = (uint64_t)num_tasks * (i + 1) / pool->num_threads;
+    }
+    pool->active = pool->num_threads;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+/* Waits until every task of the current batch has run. */
+void thread_pool_finish(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pool->busy = false;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void free_thread_pool(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t i = 0; i < pool->num_threads; ++i) {
+        pthread_join(pool->threads[i], NULL);
+        pthread_mutex_destroy(&pool->ranges[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->ranges);
+    free(pool);
+}
+
+/* sysconf returns -1 when it cannot count the processors. */
+uint32_t online_processors(uint32_t max) {
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processors < 1) {
+        return 1;
+    }
+    return processors < max ? processors : max;
+}
+
+DbOptions db_default_options(void) {
+    DbOptions options;
+    options.pager_mode = DB_PAGER_MODE_BUFFERED;
+    options.pool_frames = DEFAULT_POOL_FRAMES;
+    options.commit_interval_ms = DEFAULT_COMMIT_INTERVAL_MS;
+    options.scan_threads = online_processors(MAX_SCAN_THREADS);
+    options.compress = false;
+    options.pax = false;
+    return options;
+}
+
+uint32_t page_table_slot(Pager* pager, uint32_t page_num) {
+    return (page_num * 2654435761u) & pager->page_table_mask;
+}
+
+void page_table_insert(Pager* pager, int32_t frame_index) {
+    uint32_t slot = page_table_slot(pager, pager->frames[frame_index].page_num);
+    pager->frames[frame_index].hash_next = pager->page_table[slot];
+    pager->page_table[slot] = frame_index;
+}
+
+void page_table_remove(Pager* pager, int32_t frame_index) {
+    uint32_t slot = page_table_slot(pager, pager->frames[frame_index].page_num);
+    int32_t* link = &pager->page_table[slot];
+    while (*link != frame_index) {
+        link = &pager->frames[*link].hash_next;
+    }
+    *link = pager->frames[frame_index].hash_next;
+    pager->frames[frame_index].hash_next = INVALID_FRAME;
+}
+
+int32_t page_table_lookup(Pager* pager, uint32_t page_num) {
+    int32_t frame_index = pager->page_table[page_table_slot(pager, page_num)];
+    while (frame_index != INVALID_FRAME && pager->frames[frame_index].page_num != page_num) {
+        frame_index = pager->frames[frame_index].hash_next;
+    }
+    return frame_index;
+}
+
+void lru_remove(Pager* pager, int32_t frame_index) {
+    Frame* frame = &pager->frames[frame_index];
+    if (frame->lru_prev != INVALID_FRAME) {
+        pager->frames[frame->lru_prev].lru_next = frame->lru_next;
+    } else {
+        pager->lru_head = frame->lru_next;
+    }
+    if (frame->lru_next != INVALID_FRAME) {
+        pager->frames[frame->lru_next].lru_prev = frame->lru_prev;
+    } else {
+        pager->lru_tail = frame->lru_prev;
+    }
+    frame->lru_prev = INVALID_FRAME;
+    frame->lru_next = INVALID_FRAME;
+}
+
+void lru_push_back(Pager* pager, int32_t frame_index) {
+    Frame* frame = &pager->frames[frame_index];
+    frame->lru_prev = pager->lru_tail;
+    frame->lru_next = INVALID_FRAME;
+    if (pager->lru_tail != INVALID_FRAME) {
+        pager->frames[pager->lru_tail].lru_next = frame_index;
+    } else {
+        pager->lru_head = frame_index;
+    }
+    pager->lru_tail = frame_index;
+}
+
+bool pager_map_file(Pager* pager) {
+    size_t capacity = MMAP_INITIAL_RESERVE;
+    while (capacity < pager->map_file_length * 2) {
+        capacity *= 2;
+    }
+    void* map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, pager->fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    pager->map = map;
+    pager->map_capacity = capacity;
+    return true;
+}
+
+/*
+ * LZ4-style page codec. A compressed page is a series of sequences, each a
+ * token byte (literal count in the high nibble, match length - 4 in the low
+ * one, 15 meaning more length bytes follow), the literals, and a 2-byte
+ * offset back into the output to copy the match from. The last sequence
+ * has literals only. Zero padding collapses into a few long matches.
+ */
+#define COMPRESS_HASH_BITS 12
+#define COMPRESS_MIN_MATCH 4
+
+bool compress_emit(uint8_t* destination, uint32_t capacity, uint32_t* out, const uint8_t* literals,
+                   uint32_t num_literals, uint32_t offset, uint32_t match_length) {
+    uint32_t extra_match = offset ? match_length - COMPRESS_MIN_MATCH : 0;
+    uint32_t worst_case = 1 + num_literals / 255 + 1 + num_literals + 2 + extra_match / 255 + 1;
+    if (*out + worst_case > capacity) {
+        return false;
+    }
+    uint8_t* cursor = destination + *out;
+    *cursor++ = (num_literals < 15 ? num_literals : 15) << 4 | (extra_match < 15 ? extra_match : 15);
+    if (num_literals >= 15) {
+        uint32_t rest = num_literals - 15;
+        for (; rest >= 255; rest -= 255) {
+            *cursor++ = 255;
+        }
+        *cursor++ = rest;
+    }
+    memcpy(cursor, literals, num_literals);
+    cursor += num_literals;
+    if (offset) {
+        *cursor++ = offset & 0xFF;
+        *cursor++ = offset >> 8;
+        if (extra_match >= 15) {
+            uint32_t rest = extra_match - 15;
+            for (; rest >= 255; rest -= 255) {
+                *cursor++ = 255;
+            }
+            *cursor++ = rest;
+        }
+    }
+    *out = cursor - destination;
+    return true;
+}
+
+/* Returns the compressed length, or 0 if the page does not fit in capacity. */
+uint32_t compress_page(const uint8_t* source, uint8_t* destination, uint32_t capacity) {
+    uint16_t positions[1 << COMPRESS_HASH_BITS];
+    memset(positions, 0, sizeof(positions));
+    uint32_t out = 0;
+    uint32_t anchor = 0;
+    uint32_t position = 0;
+    while (position + COMPRESS_MIN_MATCH <= PAGE_SIZE) {
+        uint32_t sequence;
+        memcpy(&sequence, source + position, sizeof(sequence));
+        uint32_t slot = (sequence * 2654435761u) >> (32 - COMPRESS_HASH_BITS);
+        uint32_t candidate = positions[slot];
+        positions[slot] = position;
+        if (candidate >= position || memcmp(source + candidate, source + position, COMPRESS_MIN_MATCH) != 0) {
+            ++position;
+            continue;
+        }
+        uint32_t match_length = COMPRESS_MIN_MATCH;
+        while (position + match_length < PAGE_SIZE && source[candidate + match_length] == source[position + match_length]) {
+            ++match_length;
+        }
+        if (!compress_emit(destination, capacity, &out, source + anchor, position - anchor, position - candidate,
+                           match_length)) {
+            return 0;
+        }
+        position += match_length;
+        anchor = position;
+    }
+    if (!compress_emit(destination, capacity, &out, source + anchor, PAGE_SIZE - anchor, 0, 0)) {
+        return 0;
+    }
+    return out;
+}
+
+bool read_sequence_length(const uint8_t* source, uint32_t length, uint32_t* in, uint32_t* value) {
+    uint8_t byte;
+    do {
+        if (*in >= length) {
+            return false;
+        }
+        byte = source[(*in)++];
+        *value += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/* Returns false if source is not a valid compressed page. */
+bool decompress_page(const uint8_t* source, uint32_t length, uint8_t* destination) {
+    uint32_t in = 0;
+    uint32_t out = 0;
+    while (in < length) {
+        uint8_t token = source[in++];
+        uint32_t num_literals = token >> 4;
+        if (num_literals == 15 && !read_sequence_length(source, length, &in, &num_literals)) {
+            return false;
+        }
+        if (num_literals > length - in || num_literals > PAGE_SIZE - out) {
+            return false;
+        }
+        memcpy(destination + out, source + in, num_literals);
+        in += num_literals;
+        out += num_literals;
+        if (in == length) {
+            break;
+        }
+        if (length - in < 2) {
+            return false;
+        }
+        uint32_t offset = source[in] | source[in + 1] << 8;
+        in += 2;
+        uint32_t match_length = token & 15;
+        if (match_length == 15 && !read_sequence_length(source, length, &in, &match_length)) {
+            return false;
+        }
+        match_length += COMPRESS_MIN_MATCH;
+        if (offset == 0 || offset > out || match_length > PAGE_SIZE - out) {
+            return false;
+        }
+        /* Byte by byte: the match may overlap the bytes it produces. */
+        for (uint32_t i = 0; i < match_length; ++i, ++out) {
+            destination[out] = destination[out - offset];
+        }
+    }
+    return out == PAGE_SIZE;
+}
+
+uint32_t sectors_for_length(uint32_t length) {
+    return (length + COMPRESSED_SECTOR_SIZE - 1) / COMPRESSED_SECTOR_SIZE;
+}
+
+/*
+ * Sets or clears sectors in one of the bitmaps. sector_cursors[n] is where
+ * allocations of n sectors (or more, for the last one) start looking, and
+ * only moves back when a run that size is freed, so allocations do not keep
+ * rescanning holes too small for them. A run pieced together from smaller
+ * frees may go unused until the next checkpoint resets the cursors.
+ */
+void pager_mark_sectors(Pager* pager, uint64_t* bitmap, uint32_t first, uint32_t count, bool used) {
+    for (uint32_t sector = first; sector < first + count; ++sector) {
+        if (used) {
+            bitmap[sector / 64] |= 1ull << (sector % 64);
+        } else {
+            bitmap[sector / 64] &= ~(1ull << (sector % 64));
+        }
+    }
+    for (uint32_t n = 1; !used && n <= count && n <= COMPRESSED_PAGE_SECTORS; ++n) {
+        if (first < pager->sector_cursors[n]) {
+            pager->sector_cursors[n] = first;
+        }
+    }
+}
+
+/* Makes the current versions the checkpointed ones, freeing the older ones. */
+void pager_checkpoint_sectors(Pager* pager) {
+    memcpy(pager->checkpoint_sectors, pager->live_sectors, pager->sector_capacity / 8);
+    memset(pager->sector_cursors, 0, sizeof(pager->sector_cursors));
+}
+
+/* Grows the sector bitmaps to cover num_sectors sectors. */
+void pager_reserve_sectors(Pager* pager, uint32_t num_sectors) {
+    if (num_sectors <= pager->sector_capacity) {
+        return;
+    }
+    uint32_t old_words = pager->sector_capacity / 64;
+    uint32_t capacity = pager->sector_capacity ? pager->sector_capacity : 4096;
+    while (capacity < num_sectors) {
+        capacity *= 2;
+    }
+    uint32_t words = capacity / 64;
+    pager->live_sectors = checked_realloc(pager->live_sectors, words * sizeof(uint64_t));
+    pager->checkpoint_sectors = checked_realloc(pager->checkpoint_sectors, words * sizeof(uint64_t));
+    memset(pager->live_sectors + old_words, 0, (words - old_words) * sizeof(uint64_t));
+    memset(pager->checkpoint_sectors + old_words, 0, (words - old_words) * sizeof(uint64_t));
+    pager->sector_capacity = capacity;
+}
+
+/*
+ * Takes the lowest run of count free sectors, or else appends them to the
+ * file. Filling from the front keeps the pages packed, so the free tail a
+ * checkpoint gives back grows.
+ */
+uint32_t pager_allocate_sectors(Pager* pager, uint32_t count) {
+    uint32_t size_class = count < COMPRESSED_PAGE_SECTORS ? count : COMPRESSED_PAGE_SECTORS;
+    uint32_t run_start = 0;
+    uint32_t run = 0;
+    uint32_t sector = pager->sector_cursors[size_class];
+    while (sector < pager->num_sectors && run < count) {
+        uint64_t used = pager->live_sectors[sector / 64] | pager->checkpoint_sectors[sector / 64];
+        if (sector % 64 == 0 && used == UINT64_MAX) {
+            run = 0;
+            sector += 64;
+            continue;
+        }
+        if (used >> (sector % 64) & 1) {
+            run = 0;
+        } else if (run++ == 0) {
+            run_start = sector;
+        }
+        ++sector;
+    }
+    if (run < count) {
+        if (run == 0) {
+            run_start = pager->num_sectors;
+        }
+        pager->num_sectors = run_start + count;
+        pager_reserve_sectors(pager, pager->num_sectors);
+    }
+    pager_mark_sectors(pager, pager->live_sectors, run_start, count, true);
+    if (count == size_class) {
+        pager->sector_cursors[size_class] = run_start + count;
+    }
+    return run_start;
+}
+
+void pager_reserve_extents(Pager* pager, uint32_t num_pages) {
+    if (num_pages <= pager->extent_capacity) {
+        return;
+    }
+    uint32_t capacity = pager->extent_capacity ? pager->extent_capacity : 1024;
+    while (capacity < num_pages) {
+        capacity *= 2;
+    }
+    pager->extents = checked_realloc(pager->extents, capacity * sizeof(PageExtent));
+    memset(pager->extents + pager->extent_capacity, 0, (capacity - pager->extent_capacity) * sizeof(PageExtent));
+    pager->extent_capacity = capacity;
+}
+
+/* Frees the sectors of a page's current version; the checkpointed one stays until the next checkpoint. */
+void pager_release_extent(Pager* pager, uint32_t page_num) {
+    PageExtent* extent = &pager->extents[page_num];
+    if (extent->length > 0) {
+        pager_mark_sectors(pager, pager->live_sectors, extent->sector, sectors_for_length(extent->length), false);
+    }
+    extent->sector = 0;
+    extent->length = 0;
+}
+
+/* Page 0 is kept uncompressed at the start of the file, where db_open reads the header. */
+void pager_init_compression(Pager* pager) {
+    pager->compressed = true;
+    uint32_t header_sectors = sectors_for_length(PAGE_SIZE);
+    pager_reserve_extents(pager, 1);
+    pager->extents[0].sector = 0;
+    pager->extents[0].length = PAGE_SIZE;
+    if (pager->num_sectors < header_sectors) {
+        pager->num_sectors = header_sectors;
+    }
+    pager_reserve_sectors(pager, pager->num_sectors);
+    pager_mark_sectors(pager, pager->live_sectors, 0, header_sectors, true);
+    pager_mark_sectors(pager, pager->checkpoint_sectors, 0, header_sectors, true);
+}
+
+/* Reads the translation table the last checkpoint left behind; returns false if it is damaged. */
+bool pager_load_translation_table(Pager* pager, CompressedFileInfo* info) {
+    pager->num_sectors = (pager->file_length + COMPRESSED_SECTOR_SIZE - 1) / COMPRESSED_SECTOR_SIZE;
+    pager_init_compression(pager);
+    pager->num_pages = info->num_pages;
+    if (info->num_pages == 0) {
+        return true;
+    }
+    pager_reserve_extents(pager, info->num_pages);
+    if (info->table_length != info->num_pages * sizeof(PageExtent) ||
+        (uint64_t)info->table_sector + sectors_for_length(info->table_length) > pager->num_sectors ||
+        pread(pager->fd, pager->extents, info->table_length, (off_t)info->table_sector * COMPRESSED_SECTOR_SIZE) !=
+            info->table_length ||
+        crc32(pager->extents, info->table_length) != info->table_checksum) {
+        return false;
+    }
+    pager->table_extent.sector = info->table_sector;
+    pager->table_extent.length = info->table_length;
+    pager_mark_sectors(pager, pager->live_sectors, info->table_sector, sectors_for_length(info->table_length), true);
+    for (uint32_t page_num = 1; page_num < info->num_pages; ++page_num) {
+        PageExtent* extent = &pager->extents[page_num];
+        if (extent->length > PAGE_SIZE ||
+            (uint64_t)extent->sector + sectors_for_length(extent->length) > pager->num_sectors) {
+            return false;
+        }
+        if (extent->length > 0) {
+            pager_mark_sectors(pager, pager->live_sectors, extent->sector, sectors_for_length(extent->length), true);
+        }
+    }
+    pager_checkpoint_sectors(pager);
+    return true;
+}
+
+/* Frees the pager without writing anything back; returns false if the file did not close cleanly. */
+bool pager_release(Pager* pager) {
+    bool closed = pager->map == NULL || munmap(pager->map, pager->map_capacity) == 0;
+    closed = close(pager->fd) == 0 && closed;
+    for (uint32_t i = 0; i < pager->num_latch_chunks; ++i) {
+        free(pager->latch_chunks[i]);
+    }
+    free(pager->latch_chunks);
+    pthread_mutex_destroy(&pager->lock);
+    for (uint32_t i = 0; i < pager->num_frames; ++i) {
+        pthread_cond_destroy(&pager->frames[i].loaded);
+    }
+    free(pager->frames);
+    free(pager->page_table);
+    free(pager->frame_memory);
+    free(pager->logged_pages);
+    free(pager->shadowed_pages);
+    free(pager->shadow_pages);
+    free(pager->extents);
+    free(pager->live_sectors);
+    free(pager->checkpoint_sectors);
+    free(pager);
+    return closed;
+}
+
+/*
+ * compress only applies to a new file; an existing one is opened in the
+ * format it was created with.
+ */
+DbResult pager_open(const char* filename, DbPagerMode mode, uint32_t pool_frames, bool compress, Pager** result) {
+    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    if (fd == -1) {
+        return DB_CANNOT_OPEN;
+    }
+    off_t file_length = lseek(fd, 0, SEEK_END);
+    CompressedFileInfo info;
+    bool compressed = file_length == 0 && compress;
+    if (file_length >= PAGE_SIZE && pread(fd, &info, sizeof(info), COMPRESSED_INFO_OFFSET) == sizeof(info)) {
+        compressed = memcmp(info.magic, COMPRESSED_FILE_MAGIC, sizeof(info.magic)) == 0;
+    }
+    if ((compressed && mode == DB_PAGER_MODE_MMAP) || (!compressed && file_length % PAGE_SIZE != 0)) {
+        close(fd);
+        return compressed ? DB_INVALID_OPTIONS : DB_CORRUPT;
+    }
+    Pager* pager = (Pager*) malloc(sizeof(Pager));
+    if (pager == NULL) {
+        close(fd);
+        return DB_OUT_OF_MEMORY;
+    }
+    pager->fd = fd;
+    pager->mode = mode;
+    pager->file_length = file_length;
+    pager->num_pages = file_length / PAGE_SIZE;
+    pager->map = NULL;
+    pager->map_file_length = file_length;
+    pager->map_pins = 0;
+    pager->wal = NULL;
+    pager->checkpoint_num_pages = 0;
+    pager->logged_pages = NULL;
+    pager->in_transaction = false;
+    pager->transaction_num_pages = 0;
+    pager->shadowed_pages = NULL;
+    pager->shadow_pages = NULL;
+    pager->num_shadow_pages = 0;
+    pager->shadow_capacity = 0;
+    pager->compressed = false;
+    pager->extents = NULL;
+    pager->extent_capacity = 0;
+    pager->table_extent.sector = 0;
+    pager->table_extent.length = 0;
+    pager->live_sectors = NULL;
+    pager->checkpoint_sectors = NULL;
+    pager->num_sectors = 0;
+    pager->sector_capacity = 0;
+    memset(pager->sector_cursors, 0, sizeof(pager->sector_cursors));
+    pthread_mutex_init(&pager->lock, NULL);
+    pager->latch_chunks = NULL;
+    pager->num_latch_chunks = 0;
+    pager->num_frames = 0;
+    pager->frames = NULL;
+    pager->frame_memory = NULL;
+    pager->page_table = NULL;
+    *result = pager;
+    if (compressed && file_length > 0 && !pager_load_translation_table(pager, &info)) {
+        pager_release(pager);
+        return DB_CORRUPT;
+    }
+    if (compressed && file_length == 0) {
+        /*
+         * Mark the file compressed before anything else reaches it, so a
+         * crash before the first checkpoint still reopens it as a new one.
+         */
+        pager_init_compression(pager);
+        char page[PAGE_SIZE];
+        memset(page, 0, PAGE_SIZE);
+        memset(&info, 0, sizeof(info));
+        memcpy(info.magic, COMPRESSED_FILE_MAGIC, sizeof(info.magic));
+        memcpy(page + COMPRESSED_INFO_OFFSET, &info, sizeof(info));
+        if (pwrite(fd, page, PAGE_SIZE, 0) != PAGE_SIZE || fsync(fd) == -1) {
+            pager_release(pager);
+            return DB_CANNOT_OPEN;
+        }
+    }
+
+    if (mode == DB_PAGER_MODE_MMAP) {
+        if (!pager_map_file(pager)) {
+            pager_release(pager);
+            return DB_OUT_OF_MEMORY;
+        }
+        return DB_SUCCESS;
+    }
+
+    if (posix_memalign(&pager->frame_memory, PAGE_SIZE, (size_t)pool_frames * PAGE_SIZE) != 0) {
+        pager->frame_memory = NULL;
+        pager_release(pager);
+        return DB_OUT_OF_MEMORY;
+    }
+    uint32_t page_table_size = 1;
+    while (page_table_size < pool_frames * 2) {
+        page_table_size <<= 1;
+    }
+    pager->page_table_mask = page_table_size - 1;
+    pager->page_table = malloc(page_table_size * sizeof(int32_t));
+    pager->frames = malloc(pool_frames * sizeof(Frame));
+    if (pager->page_table == NULL || pager->frames == NULL) {
+        pager_release(pager);
+        return DB_OUT_OF_MEMORY;
+    }
+    for (uint32_t i = 0; i < page_table_size; ++i) {
+        pager->page_table[i] = INVALID_FRAME;
+    }
+
+    pager->num_frames = pool_frames;
+    pager->lru_head = INVALID_FRAME;
+    pager->lru_tail = INVALID_FRAME;
+    for (uint32_t i = 0; i < pool_frames; ++i) {
+        Frame* frame = &pager->frames[i];
+        frame->data = (char*)pager->frame_memory + (size_t)i * PAGE_SIZE;
+        frame->page_num = INVALID_PAGE_NUM;
+        frame->pin_count = 0;
+        frame->dirty = false;
+        frame->loading = false;
+        pthread_cond_init(&frame->loaded, NULL);
+        frame->image_lsn = NO_LSN;
+        frame->hash_next = INVALID_FRAME;
+        lru_push_back(pager, i);
+    }
+    return DB_SUCCESS;
+}
+
+/*
+ * Compresses a page for a compressed file into buffer, which holds
+ * PAGE_SIZE bytes, and returns the length to write; *data is the page
+ * itself if it did not compress.
+ */
+uint32_t compress_extent(const void* page, uint8_t* buffer, const void** data) {
+    uint32_t length = compress_page(page, buffer, PAGE_SIZE - COMPRESSED_SECTOR_SIZE);
+    *data = buffer;
+    if (length == 0) {
+        length = PAGE_SIZE;
+        *data = page;
+    }
+    return length;
+}
+
+/*
+ * Gives a page of a compressed file a new extent of length bytes in free
+ * sectors and returns its first sector. The checkpointed version stays
+ * intact, so unlike an in-place write this need not wait for the log.
+ */
+uint32_t pager_place_extent(Pager* pager, uint32_t page_num, uint32_t length) {
+    pager_reserve_extents(pager, page_num + 1);
+    pager_release_extent(pager, page_num);
+    uint32_t sector = pager_allocate_sectors(pager, sectors_for_length(length));
+    pager->extents[page_num].sector = sector;
+    pager->extents[page_num].length = length;
+    return sector;
+}
+
+void write_page_data(int fd, const void* data, uint32_t length, off_t offset) {
+    if (pwrite(fd, data, length, offset) != length) {
+        db_fatal("Error writing");
+    }
+}
+
+/* Reads the page at extent; a page never written reads as zeros. */
+void read_extent(int fd, uint32_t page_num, PageExtent extent, void* page) {
+    if (extent.length == 0) {
+        return;
+    }
+    uint8_t buffer[PAGE_SIZE];
+    void* data = extent.length == PAGE_SIZE ? page : buffer;
+    ssize_t bytes_read = pread(fd, data, extent.length, (off_t)extent.sector * COMPRESSED_SECTOR_SIZE);
+    if (bytes_read == -1) {
+        db_fatal("Error reading file.");
+    }
+    if (data != page && (bytes_read != extent.length || !decompress_page(data, extent.length, page))) {
+        db_fatal("Compressed page %u is damaged. Corrupt file.", page_num);
+    }
+}
+
+/*
+ * Writes a frame back to the database file. The caller has made the frame's
+ * image_lsn durable, so the checkpointed version of the page can always be
+ * restored from the log.
+ */
+void pager_flush(Pager* pager, int32_t frame_index) {
+    Frame* frame = &pager->frames[frame_index];
+    if (pager->compressed) {
+        uint8_t buffer[PAGE_SIZE];
+        const void* data;
+        uint32_t length = compress_extent(frame->data, buffer, &data);
+        uint32_t sector = pager_place_extent(pager, frame->page_num, length);
+        write_page_data(pager->fd, data, length, (off_t)sector * COMPRESSED_SECTOR_SIZE);
+    } else {
+        write_page_data(pager->fd, frame->data, PAGE_SIZE, (off_t)frame->page_num * PAGE_SIZE);
+    }
+    frame->dirty = false;
+}
+
+/*
+ * pager_flush for an eviction: the lock, held on entry and exit, is dropped
+ * around the compression and the write, and only taken again in between to
+ * place a compressed page. The frame keeps its page and is marked loading
+ * meanwhile, so a thread that wants the page waits for it rather than
+ * reading the stale version in the file.
+ */
+void pager_write_back(Pager* pager, int32_t frame_index) {
+    Frame* frame = &pager->frames[frame_index];
+    frame->loading = true;
+    pthread_mutex_unlock(&pager->lock);
+    if (pager->compressed) {
+        uint8_t buffer[PAGE_SIZE];
+        const void* data;
+        uint32_t length = compress_extent(frame->data, buffer, &data);
+        pthread_mutex_lock(&pager->lock);
+        uint32_t sector = pager_place_extent(pager, frame->page_num, length);
+        pthread_mutex_unlock(&pager->lock);
+        write_page_data(pager->fd, data, length, (off_t)sector * COMPRESSED_SECTOR_SIZE);
+    } else {
+        write_page_data(pager->fd, frame->data, PAGE_SIZE, (off_t)frame->page_num * PAGE_SIZE);
+    }
+    pthread_mutex_lock(&pager->lock);
+    frame->dirty = false;
+    frame->loading = false;
+    pthread_cond_broadcast(&frame->loaded);
+}
+
+/*
+ * Returns the page pinned in the buffer pool. Every get_page must be paired
+ * with an unpin_page once the caller is done with the pointer; callers that
+ * modify the page call mark_page_dirty before writing to it.
+ */
+void* mmap_get_page(Pager* pager, uint32_t page_num) {
+    size_t needed = ((size_t)page_num + 1) * PAGE_SIZE;
+    if (needed > pager->map_file_length) {
+        size_t new_length = pager->map_file_length * 2;
+        if (new_length < needed) {
+            new_length = needed;
+        }
+        if (ftruncate(pager->fd, new_length) == -1) {
+            db_fatal("Error extending file.");
+        }
+        pager->map_file_length = new_length;
+    }
+    /*
+     * Pointers handed out earlier must stay valid while pinned, so the mapping
+     * may only move when nothing is pinned. Grow it early at such a point so
+     * that the pages allocated while an operation holds pins still fit.
+     */
+    bool can_move = pager->map_pins == 0;
+    size_t high_water = (size_t)pager->num_pages * PAGE_SIZE;
+    if (high_water < needed) {
+        high_water = needed;
+    }
+    if (needed > pager->map_capacity || (can_move && high_water > pager->map_capacity / 2)) {
+        size_t new_capacity = pager->map_capacity;
+        while (new_capacity < high_water * 2) {
+            new_capacity *= 2;
+        }
+        void* map = mremap(pager->map, pager->map_capacity, new_capacity, can_move ? MREMAP_MAYMOVE : 0);
+        if (map == MAP_FAILED) {
+            db_fatal("Unable to grow file mapping with %u pages pinned.", pager->map_pins);
+        }
+        pager->map = map;
+        pager->map_capacity = new_capacity;
+    }
+    ++pager->map_pins;
+    return pager->map + (size_t)page_num * PAGE_SIZE;
+}
+
+void* get_page_locked(Pager* pager, uint32_t page_num) {
+    if (page_num == INVALID_PAGE_NUM) {
+        db_fatal("Tried to fetch page number out of bounds. %u", page_num);
+    }
+    if (pager->mode == DB_PAGER_MODE_MMAP) {
+        return mmap_get_page(pager, page_num);
+    }
+    int32_t frame_index = page_table_lookup(pager, page_num);
+    if (frame_index != INVALID_FRAME) {
+        Frame* frame = &pager->frames[frame_index];
+        if (frame->pin_count++ == 0) {
+            lru_remove(pager, frame_index);
+        }
+        while (frame->loading) {
+            pthread_cond_wait(&frame->loaded, &pager->lock);
+        }
+        return frame->data;
+    }
+
+    frame_index = pager->lru_head;
+    if (frame_index == INVALID_FRAME) {
+        db_fatal("Buffer pool exhausted: all %u frames are pinned.", pager->num_frames);
+    }
+    lru_remove(pager, frame_index);
+    Frame* frame = &pager->frames[frame_index];
+    if (frame->dirty && frame->image_lsn != NO_LSN && !wal_is_durable(pager->wal, frame->image_lsn)) {
+        /*
+         * Waits for the log with the victim pinned and the pool unlocked, so
+         * other threads keep using the pool meanwhile, then starts over.
+         */
+        uint64_t lsn = frame->image_lsn;
+        frame->pin_count = 1;
+        pthread_mutex_unlock(&pager->lock);
+        wal_flush_to(pager->wal, lsn);
+        pthread_mutex_lock(&pager->lock);
+        frame->image_lsn = NO_LSN;
+        if (--frame->pin_count == 0) {
+            lru_push_back(pager, frame_index);
+        }
+        return get_page_locked(pager, page_num);
+    }
+    if (frame->page_num != INVALID_PAGE_NUM && frame->dirty) {
+        /*
+         * The victim was pinned for the write-back, and while the lock was
+         * down someone may have wanted it back or started loading page_num
+         * elsewhere; either way, start over.
+         */
+        frame->pin_count = 1;
+        pager_write_back(pager, frame_index);
+        if (--frame->pin_count > 0 || page_table_lookup(pager, page_num) != INVALID_FRAME) {
+            if (frame->pin_count == 0) {
+                lru_push_back(pager, frame_index);
+            }
+            return get_page_locked(pager, page_num);
+        }
+    }
+    if (frame->page_num != INVALID_PAGE_NUM) {
+        page_table_remove(pager, frame_index);
+    }
+
+    /* The page is found in the table from here on, but read without the lock. */
+    frame->page_num = page_num;
+    frame->pin_count = 1;
+    frame->dirty = false;
+    frame->image_lsn = NO_LSN;
+    frame->loading = true;
+    page_table_insert(pager, frame_index);
+    bool on_disk = page_num < pager->num_pages;
+    PageExtent extent = {0, 0};
+    if (pager->compressed && page_num < pager->extent_capacity) {
+        extent = pager->extents[page_num];
+    }
+    pthread_mutex_unlock(&pager->lock);
+    memset(frame->data, 0, PAGE_SIZE);
+    if (on_disk && pager->compressed) {
+        read_extent(pager->fd, page_num, extent, frame->data);
+    } else if (on_disk) {
+        ssize_t bytes_read = pread(pager->fd, frame->data, PAGE_SIZE, (off_t)page_num * PAGE_SIZE);
+        if (bytes_read == -1) {
+            db_fatal("Error reading file.");
+        }
+    }
+    pthread_mutex_lock(&pager->lock);
+    frame->loading = false;
+    pthread_cond_broadcast(&frame->loaded);
+    if (pager->compressed && page_num == 0) {
+        /* Page 0 may only be written by a checkpoint, so it is never evicted. */
+        ++frame->pin_count;
+    }
+    return frame->data;
+}
+
+void* get_page(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&pager->lock);
+    void* page = get_page_locked(pager, page_num);
+    pthread_mutex_unlock(&pager->lock);
+    return page;
+}
+
+uint32_t pager_num_pages(Pager* pager) {
+    pthread_mutex_lock(&pager->lock);
+    uint32_t num_pages = pager->num_pages;
+    pthread_mutex_unlock(&pager->lock);
+    return num_pages;
+}
+
+pthread_rwlock_t* page_latch(Pager* pager, uint32_t page_num) {
+    uint32_t chunk = page_num / PAGE_LATCH_CHUNK;
+    pthread_mutex_lock(&pager->lock);
+    if (chunk >= pager->num_latch_chunks) {
+        uint32_t num_chunks = pager->num_latch_chunks ? pager->num_latch_chunks : 16;
+        while (num_chunks <= chunk) {
+            num_chunks *= 2;
+        }
+        pager->latch_chunks = checked_realloc(pager->latch_chunks, num_chunks * sizeof(pthread_rwlock_t*));
+        memset(pager->latch_chunks + pager->num_latch_chunks, 0,
+               (num_chunks - pager->num_latch_chunks) * sizeof(pthread_rwlock_t*));
+        pager->num_latch_chunks = num_chunks;
+    }
+    if (pager->latch_chunks[chunk] == NULL) {
+        /* Prefer the writer, or a steady stream of scans could starve it. */
+        pthread_rwlockattr_t attributes;
+        pthread_rwlockattr_init(&attributes);
+        pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        pager->latch_chunks[chunk] = checked_malloc(PAGE_LATCH_CHUNK * sizeof(pthread_rwlock_t));
+        for (uint32_t i = 0; i < PAGE_LATCH_CHUNK; ++i) {
+            pthread_rwlock_init(&pager->latch_chunks[chunk][i], &attributes);
+        }
+        pthread_rwlockattr_destroy(&attributes);
+    }
+    pthread_rwlock_t* latch = &pager->latch_chunks[chunk][page_num % PAGE_LATCH_CHUNK];
+    pthread_mutex_unlock(&pager->lock);
+    return latch;
+}
+
+/*
+ * Latches a pinned page: shared to read it, exclusive to modify it. Latches
+ * are always taken top-down (parent before child, left leaf before right),
+ * which keeps readers and the writer from deadlocking.
+ */
+void latch_page(Pager* pager, uint32_t page_num, bool exclusive) {
+    pthread_rwlock_t* latch = page_latch(pager, page_num);
+    if (exclusive) {
+        pthread_rwlock_wrlock(latch);
+    } else {
+        pthread_rwlock_rdlock(latch);
+    }
+}
+
+void unlatch_page(Pager* pager, uint32_t page_num) {
+    pthread_rwlock_unlock(page_latch(pager, page_num));
+}
+
+/*
+ * Logs the checkpointed image of a page the first time it is dirtied after a
+ * checkpoint, returning the record's LSN, or NO_LSN if nothing was logged.
+ * A compressed file never overwrites its checkpointed pages and needs no
+ * images.
+ */
+uint64_t pager_log_page_image(Pager* pager, uint32_t page_num, void* page) {
+    if (pager->wal == NULL || pager->compressed || page_num >= pager->checkpoint_num_pages) {
+        return NO_LSN;
+    }
+    uint8_t bit = 1 << (page_num % 8);
+    if (pager->logged_pages[page_num / 8] & bit) {
+        return NO_LSN;
+    }
+    pager->logged_pages[page_num / 8] |= bit;
+
+    char record[sizeof(uint32_t) + PAGE_SIZE];
+    memcpy(record, &page_num, sizeof(uint32_t));
+    memcpy(record + sizeof(uint32_t), page, PAGE_SIZE);
+    return wal_append(pager->wal, WAL_RECORD_PAGE_IMAGE, record, sizeof(record));
+}
+
+/* Starts a new checkpoint interval: no page has had its image logged yet. */
+void pager_reset_logged_pages(Pager* pager) {
+    pthread_mutex_lock(&pager->lock);
+    pager->checkpoint_num_pages = pager->num_pages;
+    pager->logged_pages = checked_realloc(pager->logged_pages, pager->num_pages / 8 + 1);
+    memset(pager->logged_pages, 0, pager->num_pages / 8 + 1);
+    pthread_mutex_unlock(&pager->lock);
+}
+
+/*
+ * While a transaction is open, the first change to each page that existed
+ * at BEGIN saves a copy of it, and rolling back copies those back and
+ * forgets the pages allocated since. Transaction pages may still be
+ * evicted: the copies make rollback independent of what reached the file,
+ * and the logged checkpoint images already make crash recovery so.
+ */
+void pager_shadow_page(Pager* pager, uint32_t page_num, void* page) {
+    if (!pager->in_transaction || page_num >= pager->transaction_num_pages) {
+        return;
+    }
+    uint8_t bit = 1 << (page_num % 8);
+    if (pager->shadowed_pages[page_num / 8] & bit) {
+        return;
+    }
+    pager->shadowed_pages[page_num / 8] |= bit;
+    if (pager->num_shadow_pages == pager->shadow_capacity) {
+        pager->shadow_capacity = pager->shadow_capacity ? pager->shadow_capacity * 2 : 64;
+        pager->shadow_pages = checked_realloc(pager->shadow_pages, pager->shadow_capacity * sizeof(ShadowPage));
+    }
+    ShadowPage* shadow = &pager->shadow_pages[pager->num_shadow_pages++];
+    shadow->page_num = page_num;
+    shadow->image = checked_malloc(PAGE_SIZE);
+    memcpy(shadow->image, page, PAGE_SIZE);
+}
+
+void mark_page_dirty(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&pager->lock);
+    if (pager->mode == DB_PAGER_MODE_MMAP) {
+        void* page = pager->map + (size_t)page_num * PAGE_SIZE;
+        pager_shadow_page(pager, page_num, page);
+        uint64_t lsn = pager_log_page_image(pager, page_num, page);
+        pthread_mutex_unlock(&pager->lock);
+        if (lsn != NO_LSN) {
+            /* The kernel may write the page back as soon as it is modified. */
+            wal_flush_to(pager->wal, lsn);
+        }
+        return;
+    }
+    int32_t frame_index = page_table_lookup(pager, page_num);
+    if (frame_index == INVALID_FRAME || pager->frames[frame_index].pin_count == 0) {
+        db_fatal("Error: Tried to dirty an unpinned page %u.", page_num);
+    }
+    Frame* frame = &pager->frames[frame_index];
+    pager_shadow_page(pager, page_num, frame->data);
+    if (!frame->dirty) {
+        uint64_t lsn = pager_log_page_image(pager, page_num, frame->data);
+        if (lsn != NO_LSN) {
+            frame->image_lsn = lsn;
+        }
+    }
+    frame->dirty = true;
+    pthread_mutex_unlock(&pager->lock);
+}
+
+void unpin_page(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&pager->lock);
+    if (pager->mode == DB_PAGER_MODE_MMAP) {
+        --pager->map_pins;
+        pthread_mutex_unlock(&pager->lock);
+        return;
+    }
+    int32_t frame_index = page_table_lookup(pager, page_num);
+    if (frame_index == INVALID_FRAME || pager->frames[frame_index].pin_count == 0) {
+        db_fatal("Error: Tried to unpin page %u which is not pinned.", page_num);
+    }
+    if (--pager->frames[frame_index].pin_count == 0) {
+        lru_push_back(pager, frame_index);
+    }
+    pthread_mutex_unlock(&pager->lock);
+}
+
+void pager_begin_transaction(Pager* pager) {
+    pthread_mutex_lock(&pager->lock);
+    pager->in_transaction = true;
+    pager->transaction_num_pages = pager->num_pages;
+    pager->shadowed_pages = checked_realloc(pager->shadowed_pages, pager->num_pages / 8 + 1);
+    memset(pager->shadowed_pages, 0, pager->num_pages / 8 + 1);
+    pthread_mutex_unlock(&pager->lock);
+}
+
+void pager_drop_shadow_pages(Pager* pager) {
+    for (uint32_t i = 0; i < pager->num_shadow_pages; ++i) {
+        free(pager->shadow_pages[i].image);
+    }
+    pager->num_shadow_pages = 0;
+}
+
+void pager_commit_transaction(Pager* pager) {
+    pthread_mutex_lock(&pager->lock);
+    pager->in_transaction = false;
+    pager_drop_shadow_pages(pager);
+    pthread_mutex_unlock(&pager->lock);
+}
+
+/* The caller must keep every other thread off the tree while the pages are put back. */
+void pager_rollback_transaction(Pager* pager) {
+    pthread_mutex_lock(&pager->lock);
+    pager->in_transaction = false;
+    pthread_mutex_unlock(&pager->lock);
+
+    for (uint32_t i = 0; i < pager->num_shadow_pages; ++i) {
+        ShadowPage* shadow = &pager->shadow_pages[i];
+        void* page = get_page(pager, shadow->page_num);
+        mark_page_dirty(pager, shadow->page_num);
+        memcpy(page, shadow->image, PAGE_SIZE);
+        unpin_page(pager, shadow->page_num);
+    }
+
+    pthread_mutex_lock(&pager->lock);
+    pager_drop_shadow_pages(pager);
+    for (uint32_t i = 0; i < pager->num_frames; ++i) {
+        Frame* frame = &pager->frames[i];
+        if (frame->page_num != INVALID_PAGE_NUM && frame->page_num >= pager->transaction_num_pages) {
+            page_table_remove(pager, i);
+            frame->page_num = INVALID_PAGE_NUM;
+            frame->dirty = false;
+        }
+    }
+    for (uint32_t page_num = pager->transaction_num_pages;
+         pager->compressed && page_num < pager->num_pages && page_num < pager->extent_capacity; ++page_num) {
+        pager_release_extent(pager, page_num);
+    }
+    pager->num_pages = pager->transaction_num_pages;
+    pthread_mutex_unlock(&pager->lock);
+}
+
+/* Pins and latches a page in one step. */
+void* get_page_latched(Pager* pager, uint32_t page_num, bool exclusive) {
+    void* page = get_page(pager, page_num);
+    latch_page(pager, page_num, exclusive);
+    return page;
+}
+
+void release_page(Pager* pager, uint32_t page_num) {
+    unlatch_page(pager, page_num);
+    unpin_page(pager, page_num);
+}
+
+int compare_frames_by_page(const void* a, const void* b, void* arg) {
+    Frame* frames = arg;
+    uint32_t left = frames[*(const int32_t*)a].page_num;
+    uint32_t right = frames[*(const int32_t*)b].page_num;
+    return left < right ? -1 : left > right;
+}
+
+/*
+ * Writes every dirty frame back in page order, so the writes are sequential.
+ * Page 0 of a compressed file is left to pager_write_translation_table.
+ * Called by the writer, so no page gets a new image logged once the log has
+ * been flushed here.
+ */
+void pager_flush_all(Pager* pager) {
+    if (pager->wal != NULL) {
+        wal_flush(pager->wal);
+    }
+    pthread_mutex_lock(&pager->lock);
+    /*
+     * Lets the evictions' write-backs in flight finish. Waiting drops the
+     * lock, so another may start meanwhile; none can once a pass finds
+     * nothing to wait for.
+     */
+    bool waited = true;
+    while (waited) {
+        waited = false;
+        for (uint32_t i = 0; i < pager->num_frames; ++i) {
+            while (pager->frames[i].loading) {
+                pthread_cond_wait(&pager->frames[i].loaded, &pager->lock);
+                waited = true;
+            }
+        }
+    }
+    int32_t* dirty_frames = checked_malloc(pager->num_frames * sizeof(int32_t));
+    uint32_t num_dirty = 0;
+    for (uint32_t i = 0; i < pager->num_frames; ++i) {
+        Frame* frame = &pager->frames[i];
+        if (frame->page_num != INVALID_PAGE_NUM && frame->dirty && !(pager->compressed && frame->page_num == 0)) {
+            dirty_frames[num_dirty++] = i;
+        }
+    }
+    qsort_r(dirty_frames, num_dirty, sizeof(int32_t), compare_frames_by_page, pager->frames);
+    for (uint32_t i = 0; i < num_dirty; ++i) {
+        pager_flush(pager, dirty_frames[i]);
+    }
+    free(dirty_frames);
+    pthread_mutex_unlock(&pager->lock);
+}
+
+/*
+ * Checkpoints a compressed file once every page is flushed: the table goes
+ * to free sectors and is synced before page 0 is rewritten to point at it,
+ * so a crash leaves either the old checkpoint or the new one. Afterwards
+ * only the new versions are kept and the file gives back its free tail.
+ */
+void pager_write_translation_table(Pager* pager) {
+    pthread_mutex_lock(&pager->lock);
+    uint32_t length = pager->num_pages * sizeof(PageExtent);
+    pager_reserve_extents(pager, pager->num_pages);
+    if (pager->table_extent.length > 0) {
+        pager_mark_sectors(pager, pager->live_sectors, pager->table_extent.sector,
+                           sectors_for_length(pager->table_extent.length), false);
+    }
+    uint32_t sector = pager_allocate_sectors(pager, sectors_for_length(length));
+    if (pwrite(pager->fd, pager->extents, length, (off_t)sector * COMPRESSED_SECTOR_SIZE) != length ||
+        fsync(pager->fd) == -1) {
+        db_fatal("Error writing page translation table.");
+    }
+    pager->table_extent.sector = sector;
+    pager->table_extent.length = length;
+
+    CompressedFileInfo info;
+    memset(&info, 0, sizeof(info));
+    memcpy(info.magic, COMPRESSED_FILE_MAGIC, sizeof(info.magic));
+    info.num_pages = pager->num_pages;
+    info.table_sector = sector;
+    info.table_length = length;
+    info.table_checksum = crc32(pager->extents, length);
+    Frame* header = &pager->frames[page_table_lookup(pager, 0)];
+    memcpy((char*)header->data + COMPRESSED_INFO_OFFSET, &info, sizeof(info));
+    if (pwrite(pager->fd, header->data, PAGE_SIZE, 0) != PAGE_SIZE || fsync(pager->fd) == -1) {
+        db_fatal("Error writing");
+    }
+    header->dirty = false;
+
+    pager_checkpoint_sectors(pager);
+    while (pager->num_sectors > 0 &&
+           !(pager->live_sectors[(pager->num_sectors - 1) / 64] >> ((pager->num_sectors - 1) % 64) & 1)) {
+        --pager->num_sectors;
+    }
+    if (ftruncate(pager->fd, (off_t)pager->num_sectors * COMPRESSED_SECTOR_SIZE) == -1) {
+        db_fatal("Error truncating file.");
+    }
+    pthread_mutex_unlock(&pager->lock);
+}
+
+void pager_close(Pager* pager) {
+    pager_flush_all(pager);
+    if (!pager_release(pager)) {
+        db_fatal("Failed to close file.");
+    }
+}
+
+/*
+ * Pages are only ever appended; a page number handed out here is backed by
+ * a zeroed frame until it is first written.
+ */
+uint32_t get_unused_page_num(Pager* pager) {
+    pthread_mutex_lock(&pager->lock);
+    if (pager->num_pages == INVALID_PAGE_NUM) {
+        db_fatal("Database file is full.");
+    }
+    uint32_t page_num = pager->num_pages++;
+    pthread_mutex_unlock(&pager->lock);
+    return page_num;
+}
+
+uint32_t serialized_row_size(Row* row) {
+    return ROW_HEADER_SIZE + 2 * STRING_LENGTH_SIZE + strlen(row->username) + strlen(row->email);
+}
+
+/* Returns the number of bytes written. */
+uint32_t serialize_row(Row* source, void* destination) {
+    uint8_t* cursor = destination;
+    uint8_t username_length = strlen(source->username);
+    uint8_t email_length = strlen(source->email);
+
+    memcpy(cursor, &(source->id), ID_SIZE);
+    cursor += ID_SIZE;
+    memcpy(cursor, &(source->begin_txn), TXN_ID_SIZE);
+    cursor += TXN_ID_SIZE;
+    memcpy(cursor, &(source->end_txn), TXN_ID_SIZE);
+    cursor += TXN_ID_SIZE;
+    *cursor++ = username_length;
+    memcpy(cursor, source->username, username_length);
+    cursor += username_length;
+    *cursor++ = email_length;
+    memcpy(cursor, source->email, email_length);
+    cursor += email_length;
+    return cursor - (uint8_t*)destination;
+}
+
+uint64_t row_begin_txn(const void* cell) {
+    uint64_t txn_id;
+    memcpy(&txn_id, (const uint8_t*)cell + ID_SIZE, TXN_ID_SIZE);
+    return txn_id;
+}
+
+uint64_t row_end_txn(const void* cell) {
+    uint64_t txn_id;
+    memcpy(&txn_id, (const uint8_t*)cell + ID_SIZE + TXN_ID_SIZE, TXN_ID_SIZE);
+    return txn_id;
+}
+
+void deserialize_row(Row* destination, void* source) {
+    uint8_t* cursor = source;
+
+    memcpy(&(destination->id), cursor, ID_SIZE);
+    cursor += ID_SIZE;
+    memcpy(&(destination->begin_txn), cursor, TXN_ID_SIZE);
+    cursor += TXN_ID_SIZE;
+    memcpy(&(destination->end_txn), cursor, TXN_ID_SIZE);
+    cursor += TXN_ID_SIZE;
+    uint8_t username_length = *cursor++;
+    memcpy(destination->username, cursor, username_length);
+    destination->username[username_length] = 0;
+    cursor += username_length;
+    uint8_t email_length = *cursor++;
+    memcpy(destination->email, cursor, email_length);
+    destination->email[email_length] = 0;
+}
+
+/*
+ * B+tree node layout. Every node starts with a common header. Leaves are
+ * slotted pages: a slot directory of (key, offset, length) entries sorted by
+ * key grows up from the header while the serialized rows grow down from the
+ * end of the page, so a leaf holds as many rows as their actual lengths
+ * allow. Leaves are chained through next_leaf so a range scan can walk them
+ * in order. Internal nodes hold (child, key) cells plus a right_child: cell
+ * i's child holds keys < key i, and right_child holds everything >= the last
+ * key. The root always lives at page 1 (page 0 is the file header), so a
+ * root split copies the old root out instead of moving the root.
+ *
+ * A table created with the PAX layout uses NODE_PAX_LEAF leaves instead,
+ * which keep the same header but store each column in its own minipage:
+ *
+ *   ids[n] | begin_txns[n] | end_txns[n] | username_ends[n] | email_ends[n] |
+ *   usernames | emails
+ *
+ * The string minipages hold the values back to back, and entry i of an
+ * ends array is where value i ends. A scan that only needs ids reads a
+ * dense array of keys, and a filter on one column touches only that
+ * column's bytes. The minipages are packed, so an insert shifts the ones
+ * after each insertion point. New leaves take the type of the leaf they
+ * split from, and every leaf access goes through the leaf_node_ accessors,
+ * which dispatch on the page's type.
+ */
+
+const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
+const uint32_t NODE_TYPE_OFFSET = 0;
+const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
+const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
+const uint32_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE;
+
+const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_CONTENT_START_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_MAX_BEGIN_TXN_SIZE = sizeof(uint64_t);
+const uint32_t LEAF_NODE_MAX_BEGIN_TXN_OFFSET = LEAF_NODE_CONTENT_START_OFFSET + LEAF_NODE_CONTENT_START_SIZE;
+const uint32_t LEAF_NODE_MIN_END_TXN_SIZE = sizeof(uint64_t);
+const uint32_t LEAF_NODE_MIN_END_TXN_OFFSET = LEAF_NODE_MAX_BEGIN_TXN_OFFSET + LEAF_NODE_MAX_BEGIN_TXN_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE +
+                                       LEAF_NODE_CONTENT_START_SIZE + LEAF_NODE_MAX_BEGIN_TXN_SIZE +
+                                       LEAF_NODE_MIN_END_TXN_SIZE;
+
+const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_KEY_OFFSET = 0;
+const uint32_t LEAF_NODE_CELL_OFFSET_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
+const uint32_t LEAF_NODE_CELL_LENGTH_OFFSET = LEAF_NODE_CELL_OFFSET_OFFSET + sizeof(uint16_t);
+
+const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
+const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+
+const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+
+#define BTREE_MAX_DEPTH 32
+
+/*
+ * The most frames a single operation can hold pinned at once: an insert
+ * latches its whole path when every ancestor is full, and on top of that
+ * pins the leaf, the new page of the split at each level, the new root's
+ * left child and the rightmost leaf a bulk load keeps. The username
+ * index's meta, directory, bucket and overflow pages come after the tree's
+ * are released, so they fit in the same margin. A smaller pool could run
+ * out of frames in the middle of an insert.
+ */
+#define MIN_POOL_FRAMES (BTREE_MAX_DEPTH + 8)
+
+NodeType get_node_type(void* node) {
+    return (NodeType) *((uint8_t*)(node + NODE_TYPE_OFFSET));
+}
+
+void set_node_type(void* node, NodeType type) {
+    *((uint8_t*)(node + NODE_TYPE_OFFSET)) = (uint8_t) type;
+}
+
+bool is_node_root(void* node) {
+    return *((uint8_t*)(node + IS_ROOT_OFFSET));
+}
+
+void set_node_root(void* node, bool is_root) {
+    *((uint8_t*)(node + IS_ROOT_OFFSET)) = is_root;
+}
+
+uint32_t* leaf_node_num_cells(void* node) {
+    return node + LEAF_NODE_NUM_CELLS_OFFSET;
+}
+
+uint32_t* leaf_node_next_leaf(void* node) {
+    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+uint16_t* leaf_node_content_start(void* node) {
+    return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+/*
+ * The newest begin and oldest end transaction of the leaf's rows. When a
+ * snapshot falls between the two, every row on the page is visible to it
+ * and scans skip the per-row check.
+ */
+uint64_t* leaf_node_max_begin_txn(void* node) {
+    return node + LEAF_NODE_MAX_BEGIN_TXN_OFFSET;
+}
+
+uint64_t* leaf_node_min_end_txn(void* node) {
+    return node + LEAF_NODE_MIN_END_TXN_OFFSET;
+}
+
+bool leaf_node_all_visible(void* node, uint64_t snapshot) {
+    return *leaf_node_max_begin_txn(node) <= snapshot && snapshot < *leaf_node_min_end_txn(node);
+}
+
+bool is_pax_leaf(void* node) {
+    return get_node_type(node) == NODE_PAX_LEAF;
+}
+
+void* leaf_node_slot(void* node, uint32_t cell_num) {
+    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_SLOT_SIZE;
+}
+
+/* Offsets of a PAX leaf's fixed-width minipages for a page of num_cells rows. */
+uint32_t pax_begin_txns_offset(uint32_t num_cells) {
+    return LEAF_NODE_HEADER_SIZE + num_cells * sizeof(uint32_t);
+}
+
+uint32_t pax_end_txns_offset(uint32_t num_cells) {
+    return pax_begin_txns_offset(num_cells) + num_cells * sizeof(uint64_t);
+}
+
+uint32_t pax_username_ends_offset(uint32_t num_cells) {
+    return pax_end_txns_offset(num_cells) + num_cells * sizeof(uint64_t);
+}
+
+uint32_t pax_email_ends_offset(uint32_t num_cells) {
+    return pax_username_ends_offset(num_cells) + num_cells * sizeof(uint16_t);
+}
+
+uint32_t pax_usernames_offset(uint32_t num_cells) {
+    return pax_email_ends_offset(num_cells) + num_cells * sizeof(uint16_t);
+}
+
+/* Where string i ends in the minipage whose ends array is at ends_offset; -1 gives 0. */
+uint16_t pax_string_end(void* node, uint32_t ends_offset, int64_t cell_num) {
+    uint16_t end = 0;
+    if (cell_num >= 0) {
+        memcpy(&end, node + ends_offset + cell_num * sizeof(uint16_t), sizeof(uint16_t));
+    }
+    return end;
+}
+
+uint32_t pax_emails_offset(void* node) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    return pax_usernames_offset(num_cells) + pax_string_end(node, pax_username_ends_offset(num_cells), (int64_t)num_cells - 1);
+}
+
+uint32_t* leaf_node_key(void* node, uint32_t cell_num) {
+    if (is_pax_leaf(node)) {
+        return node + LEAF_NODE_HEADER_SIZE + cell_num * sizeof(uint32_t);
+    }
+    return leaf_node_slot(node, cell_num) + LEAF_NODE_KEY_OFFSET;
+}
+
+/* The keys as an array with the given stride in bytes, for the scan kernels. */
+const uint8_t* leaf_node_keys(void* node, uint32_t* stride) {
+    *stride = is_pax_leaf(node) ? sizeof(uint32_t) : LEAF_NODE_SLOT_SIZE;
+    return (const uint8_t*)leaf_node_key(node, 0);
+}
+
+uint16_t* leaf_node_cell_offset(void* node, uint32_t cell_num) {
+    return leaf_node_slot(node, cell_num) + LEAF_NODE_CELL_OFFSET_OFFSET;
+}
+
+uint16_t* leaf_node_cell_length(void* node, uint32_t cell_num) {
+    return leaf_node_slot(node, cell_num) + LEAF_NODE_CELL_LENGTH_OFFSET;
+}
+
+/* The serialized row of a slotted leaf's cell. */
+void* leaf_node_value(void* node, uint32_t cell_num) {
+    return node + *leaf_node_cell_offset(node, cell_num);
+}
+
+/*
+ * Column accessors. They read a row's fields in place, from the cell of a
+ * slotted leaf or from the minipages of a PAX one.
+ */
+uint64_t leaf_node_begin_txn(void* node, uint32_t cell_num) {
+    if (!is_pax_leaf(node)) {
+        return row_begin_txn(leaf_node_value(node, cell_num));
+    }
+    uint64_t txn_id;
+    memcpy(&txn_id, node + pax_begin_txns_offset(*leaf_node_num_cells(node)) + cell_num * sizeof(uint64_t),
+           sizeof(uint64_t));
+    return txn_id;
+}
+
+uint64_t leaf_node_end_txn(void* node, uint32_t cell_num) {
+    if (!is_pax_leaf(node)) {
+        return row_end_txn(leaf_node_value(node, cell_num));
+    }
+    uint64_t txn_id;
+    memcpy(&txn_id, node + pax_end_txns_offset(*leaf_node_num_cells(node)) + cell_num * sizeof(uint64_t),
+           sizeof(uint64_t));
+    return txn_id;
+}
+
+bool leaf_node_row_visible(void* node, uint32_t cell_num, uint64_t snapshot) {
+    return leaf_node_begin_txn(node, cell_num) <= snapshot && snapshot < leaf_node_end_txn(node, cell_num);
+}
+
+const uint8_t* leaf_node_username(void* node, uint32_t cell_num, uint8_t* length) {
+    if (!is_pax_leaf(node)) {
+        const uint8_t* field = (const uint8_t*)leaf_node_value(node, cell_num) + ROW_HEADER_SIZE;
+        *length = field[0];
+        return field + STRING_LENGTH_SIZE;
+    }
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t ends_offset = pax_username_ends_offset(num_cells);
+    uint16_t start = pax_string_end(node, ends_offset, (int64_t)cell_num - 1);
+    *length = pax_string_end(node, ends_offset, cell_num) - start;
+    return node + pax_usernames_offset(num_cells) + start;
+}
+
+const uint8_t* leaf_node_email(void* node, uint32_t cell_num, uint8_t* length) {
+    if (!is_pax_leaf(node)) {
+        const uint8_t* field = (const uint8_t*)leaf_node_value(node, cell_num) + ROW_HEADER_SIZE;
+        field += STRING_LENGTH_SIZE + field[0];
+        *length = field[0];
+        return field + STRING_LENGTH_SIZE;
+    }
+    uint32_t ends_offset = pax_email_ends_offset(*leaf_node_num_cells(node));
+    uint16_t start = pax_string_end(node, ends_offset, (int64_t)cell_num - 1);
+    *length = pax_string_end(node, ends_offset, cell_num) - start;
+    return node + pax_emails_offset(node) + start;
+}
+
+/* Copies a row out of a leaf of either type. */
+void leaf_node_read_row(void* node, uint32_t cell_num, Row* row) {
+    if (!is_pax_leaf(node)) {
+        deserialize_row(row, leaf_node_value(node, cell_num));
+        return;
+    }
+    uint8_t length;
+    const uint8_t* bytes;
+    row->id = *leaf_node_key(node, cell_num);
+    row->begin_txn = leaf_node_begin_txn(node, cell_num);
+    row->end_txn = leaf_node_end_txn(node, cell_num);
+    bytes = leaf_node_username(node, cell_num, &length);
+    memcpy(row->username, bytes, length);
+    row->username[length] = 0;
+    bytes = leaf_node_email(node, cell_num, &length);
+    memcpy(row->email, bytes, length);
+    row->email[length] = 0;
+}
+
+/* Points view at a row of a leaf of either type without copying it. */
+void leaf_node_row_view(void* node, uint32_t cell_num, DbRowView* view) {
+    view->id = *leaf_node_key(node, cell_num);
+    if (!is_pax_leaf(node)) {
+        const uint8_t* field = (const uint8_t*)leaf_node_value(node, cell_num) + ROW_HEADER_SIZE;
+        view->username_length = field[0];
+        view->username = (const char*)field + STRING_LENGTH_SIZE;
+        field += STRING_LENGTH_SIZE + field[0];
+        view->email_length = field[0];
+        view->email = (const char*)field + STRING_LENGTH_SIZE;
+        return;
+    }
+    view->username = (const char*)leaf_node_username(node, cell_num, &view->username_length);
+    view->email = (const char*)leaf_node_email(node, cell_num, &view->email_length);
+}
+
+/*
+ * Returns a cell's row in serialized form: in place for a slotted leaf,
+ * assembled into buffer (ROW_MAX_SIZE bytes) for a PAX one.
+ */
+const void* leaf_node_cell(void* node, uint32_t cell_num, void* buffer, uint32_t* length) {
+    if (!is_pax_leaf(node)) {
+        *length = *leaf_node_cell_length(node, cell_num);
+        return leaf_node_value(node, cell_num);
+    }
+    Row row;
+    leaf_node_read_row(node, cell_num, &row);
+    *length = serialize_row(&row, buffer);
+    return buffer;
+}
+
+uint32_t leaf_node_cell_size(void* node, uint32_t cell_num) {
+    if (!is_pax_leaf(node)) {
+        return *leaf_node_cell_length(node, cell_num);
+    }
+    uint8_t username_length;
+    uint8_t email_length;
+    leaf_node_username(node, cell_num, &username_length);
+    leaf_node_email(node, cell_num, &email_length);
+    return ROW_HEADER_SIZE + 2 * STRING_LENGTH_SIZE + username_length + email_length;
+}
+
+/* Whether a serialized row of the given length fits without a split. */
+bool leaf_node_fits(void* node, uint32_t length) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (!is_pax_leaf(node)) {
+        uint32_t free_space = *leaf_node_content_start(node) - LEAF_NODE_HEADER_SIZE - num_cells * LEAF_NODE_SLOT_SIZE;
+        return free_space >= length + LEAF_NODE_SLOT_SIZE;
+    }
+    uint32_t used = pax_emails_offset(node) + pax_string_end(node, pax_email_ends_offset(num_cells), (int64_t)num_cells - 1);
+    return PAGE_SIZE - used >= length - ROW_HEADER_SIZE - 2 * STRING_LENGTH_SIZE + PAX_ROW_FIXED_SIZE;
+}
+
+/*
+ * Moves a minipage from old_offset to new_offset (never lower) and opens a
+ * gap of value_size bytes at position inside it for value. Callers shift
+ * the minipages last to first, so none is overwritten before it moves.
+ */
+void pax_shift_minipage(void* node, uint32_t old_offset, uint32_t old_size, uint32_t position, uint32_t new_offset,
+                        const void* value, uint32_t value_size) {
+    memmove(node + new_offset + position + value_size, node + old_offset + position, old_size - position);
+    memmove(node + new_offset, node + old_offset, position);
+    memcpy(node + new_offset + position, value, value_size);
+}
+
+void pax_leaf_insert_cell(void* node, uint32_t cell_num, uint32_t key, const void* cell) {
+    Row row;
+    deserialize_row(&row, (void*)cell);
+    uint8_t username_length = strlen(row.username);
+    uint8_t email_length = strlen(row.email);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t old_username_ends = pax_username_ends_offset(num_cells);
+    uint32_t old_email_ends = pax_email_ends_offset(num_cells);
+    uint16_t usernames_size = pax_string_end(node, old_username_ends, (int64_t)num_cells - 1);
+    uint16_t emails_size = pax_string_end(node, old_email_ends, (int64_t)num_cells - 1);
+    uint16_t username_start = pax_string_end(node, old_username_ends, (int64_t)cell_num - 1);
+    uint16_t email_start = pax_string_end(node, old_email_ends, (int64_t)cell_num - 1);
+    uint16_t username_end = username_start + username_length;
+    uint16_t email_end = email_start + email_length;
+
+    uint32_t new_usernames = pax_usernames_offset(num_cells + 1);
+    pax_shift_minipage(node, pax_usernames_offset(num_cells) + usernames_size, emails_size, email_start,
+                       new_usernames + usernames_size + username_length, row.email, email_length);
+    pax_shift_minipage(node, pax_usernames_offset(num_cells), usernames_size, username_start, new_usernames,
+                       row.username, username_length);
+    pax_shift_minipage(node, old_email_ends, num_cells * sizeof(uint16_t), cell_num * sizeof(uint16_t),
+                       pax_email_ends_offset(num_cells + 1), &email_end, sizeof(uint16_t));
+    pax_shift_minipage(node, old_username_ends, num_cells * sizeof(uint16_t), cell_num * sizeof(uint16_t),
+                       pax_username_ends_offset(num_cells + 1), &username_end, sizeof(uint16_t));
+    pax_shift_minipage(node, pax_end_txns_offset(num_cells), num_cells * sizeof(uint64_t),
+                       cell_num * sizeof(uint64_t), pax_end_txns_offset(num_cells + 1), &row.end_txn,
+                       sizeof(uint64_t));
+    pax_shift_minipage(node, pax_begin_txns_offset(num_cells), num_cells * sizeof(uint64_t),
+                       cell_num * sizeof(uint64_t), pax_begin_txns_offset(num_cells + 1), &row.begin_txn,
+                       sizeof(uint64_t));
+    pax_shift_minipage(node, LEAF_NODE_HEADER_SIZE, num_cells * sizeof(uint32_t), cell_num * sizeof(uint32_t),
+                       LEAF_NODE_HEADER_SIZE, &key, sizeof(uint32_t));
+    *leaf_node_num_cells(node) = num_cells + 1;
+
+    uint32_t username_ends = pax_username_ends_offset(num_cells + 1);
+    uint32_t email_ends = pax_email_ends_offset(num_cells + 1);
+    for (uint32_t i = cell_num + 1; i <= num_cells; ++i) {
+        uint16_t end = pax_string_end(node, username_ends, i) + username_length;
+        memcpy(node + username_ends + i * sizeof(uint16_t), &end, sizeof(uint16_t));
+        end = pax_string_end(node, email_ends, i) + email_length;
+        memcpy(node + email_ends + i * sizeof(uint16_t), &end, sizeof(uint16_t));
+    }
+}
+
+/*
+ * Inserts a serialized row as cell cell_num. In a slotted leaf the row goes
+ * into the gap between the slot directory and the content area; a PAX leaf
+ * splits it into its columns. The caller has checked the space.
+ */
+void leaf_node_insert_cell(void* node, uint32_t cell_num, uint32_t key, const void* cell, uint32_t length) {
+    if (is_pax_leaf(node)) {
+        pax_leaf_insert_cell(node, cell_num, key, cell);
+    } else {
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        if (cell_num < num_cells) {
+            memmove(leaf_node_slot(node, cell_num + 1), leaf_node_slot(node, cell_num),
+                    (num_cells - cell_num) * LEAF_NODE_SLOT_SIZE);
+        }
+        uint16_t offset = *leaf_node_content_start(node) - length;
+        memcpy(node + offset, cell, length);
+        *leaf_node_content_start(node) = offset;
+        *leaf_node_key(node, cell_num) = key;
+        *leaf_node_cell_offset(node, cell_num) = offset;
+        *leaf_node_cell_length(node, cell_num) = length;
+        *leaf_node_num_cells(node) = num_cells + 1;
+    }
+    uint64_t begin_txn = row_begin_txn(cell);
+    uint64_t end_txn = row_end_txn(cell);
+    if (begin_txn > *leaf_node_max_begin_txn(node)) {
+        *leaf_node_max_begin_txn(node) = begin_txn;
+    }
+    if (end_txn < *leaf_node_min_end_txn(node)) {
+        *leaf_node_min_end_txn(node) = end_txn;
+    }
+}
+
+uint32_t* internal_node_num_keys(void* node) {
+    return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+
+uint32_t* internal_node_right_child(void* node) {
+    return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+
+uint32_t* internal_node_cell(void* node, uint32_t cell_num) {
+    return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+}
+
+uint32_t* internal_node_key(void* node, uint32_t key_num) {
+    return (void*)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+}
+
+/* Child 0..num_keys-1 live in the cells, child num_keys is right_child. */
+uint32_t* internal_node_child(void* node, uint32_t child_num) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    if (child_num > num_keys) {
+        db_fatal("Tried to access child_num %u > num_keys %u", child_num, num_keys);
+    }
+    if (child_num == num_keys) {
+        return internal_node_right_child(node);
+    }
+    return internal_node_cell(node, child_num);
+}
+
+/* type is NODE_LEAF or NODE_PAX_LEAF. */
+void initialize_leaf_node(void* node, NodeType type) {
+    memset(node, 0, PAGE_SIZE);
+    set_node_type(node, type);
+    set_node_root(node, false);
+    *leaf_node_num_cells(node) = 0;
+    *leaf_node_next_leaf(node) = 0;
+    *leaf_node_content_start(node) = PAGE_SIZE;
+    *leaf_node_max_begin_txn(node) = 0;
+    *leaf_node_min_end_txn(node) = TXN_ID_MAX;
+}
+
+void initialize_internal_node(void* node) {
+    memset(node, 0, PAGE_SIZE);
+    set_node_type(node, NODE_INTERNAL);
+    set_node_root(node, false);
+    *internal_node_num_keys(node) = 0;
+}
+
+/* Index of the first cell whose key is >= key. */
+uint32_t leaf_node_find(void* node, uint32_t key) {
+    uint32_t min_index = 0;
+    uint32_t one_past_max_index = *leaf_node_num_cells(node);
+    while (one_past_max_index != min_index) {
+        uint32_t index = min_index + (one_past_max_index - min_index) / 2;
+        if (*leaf_node_key(node, index) < key) {
+            min_index = index + 1;
+        } else {
+            one_past_max_index = index;
+        }
+    }
+    return min_index;
+}
+
+/* Index of the child whose subtree may contain key. */
+uint32_t internal_node_find_child(void* node, uint32_t key) {
+    uint32_t min_index = 0;
+    uint32_t max_index = *internal_node_num_keys(node);
+    while (min_index != max_index) {
+        uint32_t index = min_index + (max_index - min_index) / 2;
+        if (key < *internal_node_key(node, index)) {
+            max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index;
+}
+
+/*
+ * A cursor keeps its current leaf pinned and latched; cursor_close releases
+ * it. Cursors live on the caller's stack.
+ */
+typedef struct {
+    DbTable* table;
+    uint32_t page_num;
+    uint32_t cell_num;
+    void* node;
+    bool end_of_table;
+} Cursor;
+
+void cursor_skip_empty_leaves(Cursor* cursor) {
+    while (cursor->cell_num >= *leaf_node_num_cells(cursor->node)) {
+        Pager* pager = cursor->table->pager;
+        uint32_t next_page_num = *leaf_node_next_leaf(cursor->node);
+        void* next_node = next_page_num == 0 ? NULL : get_page_latched(pager, next_page_num, false);
+        release_page(pager, cursor->page_num);
+        if (next_node == NULL) {
+            cursor->node = NULL;
+            cursor->end_of_table = true;
+            return;
+        }
+        cursor->page_num = next_page_num;
+        cursor->cell_num = 0;
+        cursor->node = next_node;
+    }
+}
+
+/*
+ * Positions the cursor at the first row with id >= key. Descends with shared
+ * latches, taking each child's before letting go of its parent.
+ */
+void table_find(DbTable* table, uint32_t key, Cursor* cursor) {
+    Pager* pager = table->pager;
+    uint32_t page_num = table->root_page_num;
+    void* node = get_page_latched(pager, page_num, false);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_child(node, internal_node_find_child(node, key));
+        void* child = get_page_latched(pager, child_page_num, false);
+        release_page(pager, page_num);
+        page_num = child_page_num;
+        node = child;
+    }
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->node = node;
+    cursor->cell_num = leaf_node_find(node, key);
+    cursor->end_of_table = false;
+    cursor_skip_empty_leaves(cursor);
+}
+
+void table_start(DbTable* table, Cursor* cursor) {
+    table_find(table, 0, cursor);
+}
+
+uint32_t cursor_key(Cursor* cursor) {
+    return *leaf_node_key(cursor->node, cursor->cell_num);
+}
+
+void cursor_advance(Cursor* cursor) {
+    ++cursor->cell_num;
+    cursor_skip_empty_leaves(cursor);
+}
+
+void cursor_close(Cursor* cursor) {
+    if (!cursor->end_of_table) {
+        release_page(cursor->table->pager, cursor->page_num);
+        cursor->end_of_table = true;
+    }
+}
+
+int compare_keys(const void* a, const void* b) {
+    uint32_t left = *(const uint32_t*)a;
+    uint32_t right = *(const uint32_t*)b;
+    return (left > right) - (left < right);
+}
+
+/*
+ * Splits [low, high] into at most max_morsels key ranges along the tree's
+ * separator keys, so that each range covers a run of whole leaves. The
+ * separators are gathered a level at a time, with each internal node
+ * latched only while its keys are copied, stopping at the leaves or once
+ * there are enough of them. A split racing with the walk can make the
+ * ranges uneven but not wrong, since any set of keys cuts [low, high] into
+ * ranges that cover it exactly. Range i runs from bounds[i] up to
+ * bounds[i + 1] - 1, the last one up to high. Returns the number of ranges.
+ */
+uint32_t table_partition(DbTable* table, uint32_t low, uint32_t high, uint32_t max_morsels, uint32_t* bounds) {
+    Pager* pager = table->pager;
+    uint32_t capacity = (max_morsels + 1) * (INTERNAL_NODE_MAX_KEYS + 1);
+    uint32_t* keys = checked_malloc(capacity * sizeof(uint32_t));
+    uint32_t* pages = checked_malloc(capacity * sizeof(uint32_t));
+    uint32_t* children = checked_malloc(capacity * sizeof(uint32_t));
+    uint32_t num_keys = 0;
+    uint32_t num_pages = 1;
+    pages[0] = table->root_page_num;
+
+    while (num_pages > 0 && num_keys + 1 < max_morsels) {
+        uint32_t num_children = 0;
+        for (uint32_t p = 0; p < num_pages; ++p) {
+            void* node = get_page_latched(pager, pages[p], false);
+            if (get_node_type(node) == NODE_INTERNAL) {
+                uint32_t node_keys = *internal_node_num_keys(node);
+                for (uint32_t i = 0; i <= node_keys; ++i) {
+                    uint32_t child_low = i == 0 ? 0 : *internal_node_key(node, i - 1);
+                    if ((i < node_keys && *internal_node_key(node, i) <= low) || child_low > high) {
+                        continue;
+                    }
+                    if (i > 0 && child_low > low) {
+                        keys[num_keys++] = child_low;
+                    }
+                    children[num_children++] = *internal_node_child(node, i);
+                }
+            }
+            release_page(pager, pages[p]);
+        }
+        uint32_t* swap = pages;
+        pages = children;
+        children = swap;
+        num_pages = num_children;
+    }
+
+    qsort(keys, num_keys, sizeof(uint32_t), compare_keys);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < num_keys; ++i) {
+        if (unique == 0 || keys[i] != keys[unique - 1]) {
+            keys[unique++] = keys[i];
+        }
+    }
+    uint32_t num_morsels = unique + 1 < max_morsels ? unique + 1 : max_morsels;
+    bounds[0] = low;
+    for (uint32_t j = 1; j < num_morsels; ++j) {
+        bounds[j] = keys[(uint64_t)j * unique / num_morsels];
+    }
+    free(keys);
+    free(pages);
+    free(children);
+    return num_morsels;
+}
+
+typedef struct {
+    uint32_t depth;
+    uint32_t page_nums[BTREE_MAX_DEPTH];
+    uint32_t child_indexes[BTREE_MAX_DEPTH];
+} BtreePath;
+
+/*
+ * Copies the root into a fresh left child and turns the root into an
+ * internal node over (left, right). The root keeps its page number.
+ */
+void create_new_root(DbTable* table, uint32_t separator_key, uint32_t right_child_page_num) {
+    Pager* pager = table->pager;
+    void* root = get_page(pager, table->root_page_num);
+    uint32_t left_child_page_num = get_unused_page_num(pager);
+    void* left_child = get_page(pager, left_child_page_num);
+
+    mark_page_dirty(pager, table->root_page_num);
+    mark_page_dirty(pager, left_child_page_num);
+    memcpy(left_child, root, PAGE_SIZE);
+    set_node_root(left_child, false);
+
+    initialize_internal_node(root);
+    set_node_root(root, true);
+    *internal_node_num_keys(root) = 1;
+    *internal_node_cell(root, 0) = left_child_page_num;
+    *internal_node_key(root, 0) = separator_key;
+    *internal_node_right_child(root) = right_child_page_num;
+
+    unpin_page(pager, left_child_page_num);
+    unpin_page(pager, table->root_page_num);
+}
+
+/*
+ * Inserts separator_key and new_child_page_num just to the right of the
+ * child at path->child_indexes[level] in the internal node at that level,
+ * splitting upwards as needed.
+ */
+void internal_node_insert(DbTable* table, BtreePath* path, uint32_t level, uint32_t separator_key,
+                          uint32_t new_child_page_num) {
+    Pager* pager = table->pager;
+    uint32_t page_num = path->page_nums[level];
+    uint32_t index = path->child_indexes[level];
+    void* node = get_page(pager, page_num);
+    uint32_t num_keys = *internal_node_num_keys(node);
+
+    mark_page_dirty(pager, page_num);
+    if (num_keys < INTERNAL_NODE_MAX_KEYS) {
+        memmove(internal_node_cell(node, index + 1), internal_node_cell(node, index),
+                (num_keys - index) * INTERNAL_NODE_CELL_SIZE);
+        *internal_node_key(node, index) = separator_key;
+        *internal_node_num_keys(node) = num_keys + 1;
+        if (index == num_keys) {
+            *internal_node_cell(node, index) = *internal_node_right_child(node);
+            *internal_node_right_child(node) = new_child_page_num;
+        } else {
+            *internal_node_cell(node, index + 1) = new_child_page_num;
+        }
+        unpin_page(pager, page_num);
+        return;
+    }
+
+    /* Gather num_keys + 1 keys and num_keys + 2 children, then split around the middle key. */
+    uint32_t keys[INTERNAL_NODE_MAX_KEYS + 1];
+    uint32_t children[INTERNAL_NODE_MAX_KEYS + 2];
+    for (uint32_t i = 0, j = 0; i <= num_keys; ++i) {
+        children[j++] = *internal_node_child(node, i);
+        if (i == index) {
+            children[j++] = new_child_page_num;
+        }
+    }
+    for (uint32_t i = 0, j = 0; i < num_keys; ++i) {
+        if (i == index) {
+            keys[j++] = separator_key;
+        }
+        keys[j++] = *internal_node_key(node, i);
+    }
+    if (index == num_keys) {
+        keys[num_keys] = separator_key;
+    }
+
+    uint32_t total_keys = num_keys + 1;
+    uint32_t left_keys = total_keys / 2;
+    uint32_t push_up_key = keys[left_keys];
+    uint32_t right_keys = total_keys - left_keys - 1;
+
+    uint32_t right_page_num = get_unused_page_num(pager);
+    void* right = get_page(pager, right_page_num);
+    mark_page_dirty(pager, right_page_num);
+    initialize_internal_node(right);
+    *internal_node_num_keys(right) = right_keys;
+    for (uint32_t i = 0; i < right_keys; ++i) {
+        *internal_node_cell(right, i) = children[left_keys + 1 + i];
+        *internal_node_key(right, i) = keys[left_keys + 1 + i];
+    }
+    *internal_node_right_child(right) = children[total_keys];
+
+    bool is_root = is_node_root(node);
+    initialize_internal_node(node);
+    set_node_root(node, is_root);
+    *internal_node_num_keys(node) = left_keys;
+    for (uint32_t i = 0; i < left_keys; ++i) {
+        *internal_node_cell(node, i) = children[i];
+        *internal_node_key(node, i) = keys[i];
+    }
+    *internal_node_right_child(node) = children[left_keys];
+
+    unpin_page(pager, right_page_num);
+    unpin_page(pager, page_num);
+
+    if (level == 0) {
+        create_new_root(table, push_up_key, right_page_num);
+    } else {
+        internal_node_insert(table, path, level - 1, push_up_key, right_page_num);
+    }
+}
+
+/*
+ * Splits a full leaf: the cells, including the new one, are divided so each
+ * half holds about the same number of bytes. The upper half moves to a fresh
+ * page linked in after the old one, and the first key of the new page
+ * becomes the separator in the parent. Appending past the last key of the
+ * rightmost leaf is the common case for ascending ids, so then only the new
+ * cell moves and the old leaf stays full.
+ */
+void leaf_node_split_and_insert(Cursor* cursor, BtreePath* path, uint32_t key, void* cell, uint32_t length) {
+    Pager* pager = cursor->table->pager;
+    void* old_node = cursor->node;
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void* new_node = get_page(pager, new_page_num);
+    char old_copy[PAGE_SIZE];
+    memcpy(old_copy, old_node, PAGE_SIZE);
+
+    uint32_t num_cells = *leaf_node_num_cells(old_copy);
+    bool append = cursor->cell_num == num_cells && *leaf_node_next_leaf(old_copy) == 0;
+    uint32_t total_bytes = length;
+    for (uint32_t i = 0; i < num_cells; ++i) {
+        total_bytes += leaf_node_cell_size(old_copy, i);
+    }
+
+    mark_page_dirty(pager, new_page_num);
+    initialize_leaf_node(new_node, get_node_type(old_copy));
+    bool is_root = is_node_root(old_copy);
+    initialize_leaf_node(old_node, get_node_type(old_copy));
+    set_node_root(old_node, is_root);
+    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_copy);
+    *leaf_node_next_leaf(old_node) = new_page_num;
+
+    uint32_t left_bytes = 0;
+    void* destination_node = old_node;
+    char buffer[ROW_MAX_SIZE];
+    for (uint32_t i = 0; i <= num_cells; ++i) {
+        uint32_t cell_key;
+        const void* cell_data;
+        uint32_t cell_length;
+        if (i == cursor->cell_num) {
+            cell_key = key;
+            cell_data = cell;
+            cell_length = length;
+        } else {
+            uint32_t source = i < cursor->cell_num ? i : i - 1;
+            cell_key = *leaf_node_key(old_copy, source);
+            cell_data = leaf_node_cell(old_copy, source, buffer, &cell_length);
+        }
+        /* Keep at least one cell on each side. */
+        if (destination_node == old_node && i > 0 &&
+            (i == num_cells || (!append && left_bytes + cell_length / 2 > total_bytes / 2))) {
+            destination_node = new_node;
+        }
+        if (destination_node == old_node) {
+            left_bytes += cell_length;
+        }
+        leaf_node_insert_cell(destination_node, *leaf_node_num_cells(destination_node), cell_key, cell_data,
+                              cell_length);
+    }
+
+    uint32_t separator_key = *leaf_node_key(new_node, 0);
+    unpin_page(pager, new_page_num);
+    cursor_close(cursor);
+
+    if (path->depth == 0) {
+        create_new_root(cursor->table, separator_key, new_page_num);
+    } else {
+        internal_node_insert(cursor->table, path, path->depth - 1, separator_key, new_page_num);
+    }
+}
+
+/*
+ * The writer descends without latches, since it is the only thread that
+ * modifies the tree. Before changing anything it exclusively latches, top
+ * down, every page the insert will modify: the leaf and, if the leaf
+ * splits, each ancestor that must take a separator key, up to the first
+ * one with room for it. Returns the topmost level latched.
+ */
+uint32_t latch_insert_path(DbTable* table, BtreePath* path, bool leaf_splits) {
+    Pager* pager = table->pager;
+    uint32_t top = path->depth;
+    while (leaf_splits && top > 0) {
+        --top;
+        void* node = get_page(pager, path->page_nums[top]);
+        bool full = *internal_node_num_keys(node) >= INTERNAL_NODE_MAX_KEYS;
+        unpin_page(pager, path->page_nums[top]);
+        if (!full) {
+            break;
+        }
+    }
+    for (uint32_t level = top; level < path->depth; ++level) {
+        get_page_latched(pager, path->page_nums[level], true);
+    }
+    return top;
+}
+
+/*
+ * Username index: an extendible hash table, kept in pages like the tree,
+ * that maps the crc32 of a username to the ids of the rows carrying it.
+ * The meta page holds the global depth and the page numbers of the
+ * directory pages. Directory slot i, for i the low global_depth bits of a
+ * hash, names the bucket page that holds that hash. A full bucket splits on
+ * its next hash bit, doubling the directory first when its local depth has
+ * caught up with the global depth. Entries sharing one hash (a common
+ * username) cannot be split apart, so such a bucket grows a chain of
+ * overflow pages instead, as does any bucket once the directory is at its
+ * largest.
+ *
+ * Entries hold just the hash and the id: a lookup fetches each candidate
+ * row from the tree and tests the username there. The writer latches the
+ * meta page exclusively while it changes the index and readers latch it
+ * shared while they probe, so the other index pages need no latches.
+ */
+const uint32_t HASH_INDEX_GLOBAL_DEPTH_OFFSET = 0;
+const uint32_t HASH_INDEX_NUM_DIRECTORY_PAGES_OFFSET = sizeof(uint32_t);
+const uint32_t HASH_INDEX_DIRECTORY_PAGES_OFFSET = 2 * sizeof(uint32_t);
+#define HASH_DIRECTORY_SLOTS_PER_PAGE (PAGE_SIZE / sizeof(uint32_t))
+#define HASH_INDEX_MAX_GLOBAL_DEPTH 19
+
+const uint32_t HASH_BUCKET_LOCAL_DEPTH_OFFSET = 0;
+const uint32_t HASH_BUCKET_NUM_ENTRIES_OFFSET = sizeof(uint32_t);
+const uint32_t HASH_BUCKET_OVERFLOW_PAGE_OFFSET = 2 * sizeof(uint32_t);
+const uint32_t HASH_BUCKET_HEADER_SIZE = 3 * sizeof(uint32_t);
+#define HASH_BUCKET_ENTRY_SIZE (2 * sizeof(uint32_t))
+#define HASH_BUCKET_MAX_ENTRIES ((PAGE_SIZE - HASH_BUCKET_HEADER_SIZE) / HASH_BUCKET_ENTRY_SIZE)
+
+uint32_t* hash_index_global_depth(void* meta) {
+    return meta + HASH_INDEX_GLOBAL_DEPTH_OFFSET;
+}
+
+uint32_t* hash_index_num_directory_pages(void* meta) {
+    return meta + HASH_INDEX_NUM_DIRECTORY_PAGES_OFFSET;
+}
+
+uint32_t* hash_index_directory_page(void* meta, uint32_t index) {
+    return meta + HASH_INDEX_DIRECTORY_PAGES_OFFSET + index * sizeof(uint32_t);
+}
+
+uint32_t* hash_bucket_local_depth(void* bucket) {
+    return bucket + HASH_BUCKET_LOCAL_DEPTH_OFFSET;
+}
+
+uint32_t* hash_bucket_num_entries(void* bucket) {
+    return bucket + HASH_BUCKET_NUM_ENTRIES_OFFSET;
+}
+
+uint32_t* hash_bucket_overflow_page(void* bucket) {
+    return bucket + HASH_BUCKET_OVERFLOW_PAGE_OFFSET;
+}
+
+/* Entry i is its hash followed by its id. */
+uint32_t* hash_bucket_entry(void* bucket, uint32_t entry_num) {
+    return bucket + HASH_BUCKET_HEADER_SIZE + entry_num * HASH_BUCKET_ENTRY_SIZE;
+}
+
+void initialize_hash_bucket(void* bucket, uint32_t local_depth) {
+    memset(bucket, 0, PAGE_SIZE);
+    *hash_bucket_local_depth(bucket) = local_depth;
+}
+
+uint32_t new_hash_bucket(Pager* pager, uint32_t local_depth) {
+    uint32_t page_num = get_unused_page_num(pager);
+    void* bucket = get_page(pager, page_num);
+    mark_page_dirty(pager, page_num);
+    initialize_hash_bucket(bucket, local_depth);
+    unpin_page(pager, page_num);
+    return page_num;
+}
+
+uint32_t hash_directory_get(Pager* pager, void* meta, uint32_t slot) {
+    uint32_t page_num = *hash_index_directory_page(meta, slot / HASH_DIRECTORY_SLOTS_PER_PAGE);
+    uint32_t* directory = get_page(pager, page_num);
+    uint32_t bucket_page_num = directory[slot % HASH_DIRECTORY_SLOTS_PER_PAGE];
+    unpin_page(pager, page_num);
+    return bucket_page_num;
+}
+
+void hash_directory_set(Pager* pager, void* meta, uint32_t slot, uint32_t bucket_page_num) {
+    uint32_t page_num = *hash_index_directory_page(meta, slot / HASH_DIRECTORY_SLOTS_PER_PAGE);
+    uint32_t* directory = get_page(pager, page_num);
+    mark_page_dirty(pager, page_num);
+    directory[slot % HASH_DIRECTORY_SLOTS_PER_PAGE] = bucket_page_num;
+    unpin_page(pager, page_num);
+}
+
+/* Creates an empty index, one bucket behind a one-slot directory, and returns its meta page. */
+uint32_t hash_index_create(Pager* pager) {
+    uint32_t meta_page_num = get_unused_page_num(pager);
+    uint32_t directory_page_num = get_unused_page_num(pager);
+    void* meta = get_page(pager, meta_page_num);
+    mark_page_dirty(pager, meta_page_num);
+    memset(meta, 0, PAGE_SIZE);
+    *hash_index_global_depth(meta) = 0;
+    *hash_index_num_directory_pages(meta) = 1;
+    *hash_index_directory_page(meta, 0) = directory_page_num;
+
+    void* directory = get_page(pager, directory_page_num);
+    mark_page_dirty(pager, directory_page_num);
+    memset(directory, 0, PAGE_SIZE);
+    unpin_page(pager, directory_page_num);
+    hash_directory_set(pager, meta, 0, new_hash_bucket(pager, 0));
+    unpin_page(pager, meta_page_num);
+    return meta_page_num;
+}
+
+void hash_index_double_directory(Pager* pager, uint32_t meta_page_num, void* meta) {
+    uint32_t size = 1u << *hash_index_global_depth(meta);
+    mark_page_dirty(pager, meta_page_num);
+    while (*hash_index_num_directory_pages(meta) * HASH_DIRECTORY_SLOTS_PER_PAGE < 2 * size) {
+        uint32_t page_num = get_unused_page_num(pager);
+        void* directory = get_page(pager, page_num);
+        mark_page_dirty(pager, page_num);
+        memset(directory, 0, PAGE_SIZE);
+        unpin_page(pager, page_num);
+        *hash_index_directory_page(meta, (*hash_index_num_directory_pages(meta))++) = page_num;
+    }
+    for (uint32_t slot = 0; slot < size; ++slot) {
+        hash_directory_set(pager, meta, slot + size, hash_directory_get(pager, meta, slot));
+    }
+    ++*hash_index_global_depth(meta);
+}
+
+/*
+ * Splits the bucket that hash maps to on its next hash bit. A bucket with
+ * an overflow chain holds a single hash, so the chain keeps its pages and
+ * the new bucket takes the half of the slots that hash does not use.
+ */
+void hash_bucket_split(Pager* pager, void* meta, uint32_t hash, uint32_t page_num, void* bucket) {
+    uint32_t depth = *hash_bucket_local_depth(bucket);
+    uint32_t bit = 1u << depth;
+    uint32_t new_page_num = new_hash_bucket(pager, depth + 1);
+    mark_page_dirty(pager, page_num);
+    *hash_bucket_local_depth(bucket) = depth + 1;
+
+    uint32_t high_page_num = new_page_num;
+    uint32_t low_page_num = page_num;
+    if (*hash_bucket_overflow_page(bucket) != 0) {
+        if (*hash_bucket_entry(bucket, 0) & bit) {
+            high_page_num = page_num;
+            low_page_num = new_page_num;
+        }
+    } else {
+        void* new_bucket = get_page(pager, new_page_num);
+        mark_page_dirty(pager, new_page_num);
+        uint32_t kept = 0;
+        uint32_t num_entries = *hash_bucket_num_entries(bucket);
+        for (uint32_t i = 0; i < num_entries; ++i) {
+            uint32_t* entry = hash_bucket_entry(bucket, i);
+            uint32_t* destination = entry[0] & bit
+                ? hash_bucket_entry(new_bucket, (*hash_bucket_num_entries(new_bucket))++)
+                : hash_bucket_entry(bucket, kept++);
+            memmove(destination, entry, HASH_BUCKET_ENTRY_SIZE);
+        }
+        *hash_bucket_num_entries(bucket) = kept;
+        unpin_page(pager, new_page_num);
+    }
+
+    uint32_t directory_size = 1u << *hash_index_global_depth(meta);
+    for (uint32_t slot = hash & (bit - 1); slot < directory_size; slot += bit) {
+        hash_directory_set(pager, meta, slot, slot & bit ? high_page_num : low_page_num);
+    }
+}
+
+/* Appends an entry to the last page of a bucket's overflow chain, extending the chain when it is full. */
+void hash_bucket_append_overflow(Pager* pager, uint32_t page_num, uint32_t hash, uint32_t id) {
+    void* bucket = get_page(pager, page_num);
+    while (*hash_bucket_overflow_page(bucket) != 0 || *hash_bucket_num_entries(bucket) == HASH_BUCKET_MAX_ENTRIES) {
+        uint32_t next_page_num = *hash_bucket_overflow_page(bucket);
+        if (next_page_num == 0) {
+            next_page_num = new_hash_bucket(pager, *hash_bucket_local_depth(bucket));
+            mark_page_dirty(pager, page_num);
+            *hash_bucket_overflow_page(bucket) = next_page_num;
+        }
+        unpin_page(pager, page_num);
+        page_num = next_page_num;
+        bucket = get_page(pager, page_num);
+    }
+    mark_page_dirty(pager, page_num);
+    uint32_t* entry = hash_bucket_entry(bucket, (*hash_bucket_num_entries(bucket))++);
+    entry[0] = hash;
+    entry[1] = id;
+    unpin_page(pager, page_num);
+}
+
+/* Files one entry. The caller holds the meta page latched exclusively. */
+void hash_index_add(Pager* pager, uint32_t meta_page_num, void* meta, uint32_t hash, uint32_t id) {
+    while (1) {
+        uint32_t global_depth = *hash_index_global_depth(meta);
+        uint32_t page_num = hash_directory_get(pager, meta, hash & ((1u << global_depth) - 1));
+        void* bucket = get_page(pager, page_num);
+        uint32_t local_depth = *hash_bucket_local_depth(bucket);
+        uint32_t num_entries = *hash_bucket_num_entries(bucket);
+        if (*hash_bucket_overflow_page(bucket) == 0 && num_entries < HASH_BUCKET_MAX_ENTRIES) {
+            mark_page_dirty(pager, page_num);
+            uint32_t* entry = hash_bucket_entry(bucket, num_entries);
+            entry[0] = hash;
+            entry[1] = id;
+            *hash_bucket_num_entries(bucket) = num_entries + 1;
+            unpin_page(pager, page_num);
+            break;
+        }
+        bool same_hash = true;
+        for (uint32_t i = 0; i < num_entries && same_hash; ++i) {
+            same_hash = *hash_bucket_entry(bucket, i) == hash;
+        }
+        if (same_hash || local_depth == HASH_INDEX_MAX_GLOBAL_DEPTH) {
+            unpin_page(pager, page_num);
+            hash_bucket_append_overflow(pager, page_num, hash, id);
+            break;
+        }
+        if (local_depth == global_depth) {
+            hash_index_double_directory(pager, meta_page_num, meta);
+        }
+        hash_bucket_split(pager, meta, hash, page_num, bucket);
+        unpin_page(pager, page_num);
+    }
+}
+
+void hash_index_insert(DbTable* table, const char* username, uint32_t id) {
+    Pager* pager = table->pager;
+    uint32_t meta_page_num = table->username_index_page;
+    void* meta = get_page_latched(pager, meta_page_num, true);
+    hash_index_add(pager, meta_page_num, meta, crc32(username, strlen(username)), id);
+    release_page(pager, meta_page_num);
+}
+
+uint32_t reverse_bits(uint32_t value) {
+    value = ((value >> 1) & 0x55555555u) | ((value & 0x55555555u) << 1);
+    value = ((value >> 2) & 0x33333333u) | ((value & 0x33333333u) << 2);
+    value = ((value >> 4) & 0x0F0F0F0Fu) | ((value & 0x0F0F0F0Fu) << 4);
+    value = ((value >> 8) & 0x00FF00FFu) | ((value & 0x00FF00FFu) << 8);
+    return (value >> 16) | (value << 16);
+}
+
+int compare_u64(const void* a, const void* b) {
+    uint64_t left = *(const uint64_t*)a;
+    uint64_t right = *(const uint64_t*)b;
+    return (left > right) - (left < right);
+}
+
+/*
+ * Files a batch of entries, each a bit-reversed hash in the high half and an
+ * id in the low half. Sorted that way, entries for one bucket arrive
+ * together at every directory depth, so the batch visits each bucket once
+ * instead of once per entry.
+ */
+void hash_index_insert_batch(DbTable* table, uint64_t* entries, uint32_t count) {
+    Pager* pager = table->pager;
+    uint32_t meta_page_num = table->username_index_page;
+    qsort(entries, count, sizeof(uint64_t), compare_u64);
+    void* meta = get_page_latched(pager, meta_page_num, true);
+    for (uint32_t i = 0; i < count; ++i) {
+        hash_index_add(pager, meta_page_num, meta, reverse_bits(entries[i] >> 32), (uint32_t)entries[i]);
+    }
+    release_page(pager, meta_page_num);
+}
+
+/* Collects the ids filed under the hash of username into *ids, growing it as needed. Returns their number. */
+uint32_t hash_index_lookup(DbTable* table, const char* username, uint32_t length, uint32_t** ids,
+                           uint32_t* capacity) {
+    Pager* pager = table->pager;
+    uint32_t hash = crc32(username, length);
+    uint32_t meta_page_num = table->username_index_page;
+    void* meta = get_page_latched(pager, meta_page_num, false);
+    uint32_t global_depth = *hash_index_global_depth(meta);
+    uint32_t page_num = hash_directory_get(pager, meta, hash & ((1u << global_depth) - 1));
+    uint32_t count = 0;
+    while (page_num != 0) {
+        void* bucket = get_page(pager, page_num);
+        uint32_t num_entries = *hash_bucket_num_entries(bucket);
+        for (uint32_t i = 0; i < num_entries; ++i) {
+            uint32_t* entry = hash_bucket_entry(bucket, i);
+            if (entry[0] != hash) {
+                continue;
+            }
+            if (count == *capacity) {
+                *capacity = *capacity ? *capacity * 2 : 64;
+                *ids = checked_realloc(*ids, *capacity * sizeof(uint32_t));
+            }
+            (*ids)[count++] = entry[1];
+        }
+        uint32_t next_page_num = *hash_bucket_overflow_page(bucket);
+        unpin_page(pager, page_num);
+        page_num = next_page_num;
+    }
+    release_page(pager, meta_page_num);
+    return count;
+}
+
+EXECUTE_RESULT table_insert(DbTable* table, Row* value) {
+    Pager* pager = table->pager;
+    uint32_t key = value->id;
+    BtreePath path;
+    path.depth = 0;
+
+    uint32_t page_num = table->root_page_num;
+    void* node = get_page(pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        if (path.depth == BTREE_MAX_DEPTH) {
+            db_fatal("B+tree is deeper than %d levels.", BTREE_MAX_DEPTH);
+        }
+        uint32_t child_index = internal_node_find_child(node, key);
+        uint32_t child_page_num = *internal_node_child(node, child_index);
+        path.page_nums[path.depth] = page_num;
+        path.child_indexes[path.depth] = child_index;
+        ++path.depth;
+        unpin_page(pager, page_num);
+        page_num = child_page_num;
+        node = get_page(pager, page_num);
+    }
+
+    uint32_t cell_num = leaf_node_find(node, key);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (cell_num < num_cells && *leaf_node_key(node, cell_num) == key) {
+        unpin_page(pager, page_num);
+        return EXECUTE_DUPLICATE_KEY;
+    }
+
+    char cell[ROW_MAX_SIZE];
+    uint32_t length = serialize_row(value, cell);
+    bool leaf_splits = !leaf_node_fits(node, length);
+    uint32_t top = latch_insert_path(table, &path, leaf_splits);
+    latch_page(pager, page_num, true);
+
+    Cursor cursor;
+    cursor.table = table;
+    cursor.page_num = page_num;
+    cursor.node = node;
+    cursor.cell_num = cell_num;
+    cursor.end_of_table = false;
+
+    mark_page_dirty(pager, page_num);
+    if (leaf_splits) {
+        leaf_node_split_and_insert(&cursor, &path, key, cell, length);
+    } else {
+        leaf_node_insert_cell(node, cursor.cell_num, key, cell, length);
+        cursor_close(&cursor);
+    }
+    for (uint32_t level = top; level < path.depth; ++level) {
+        release_page(pager, path.page_nums[level]);
+    }
+    hash_index_insert(table, value->username, key);
+    return EXECUTE_SUCCESS;
+}
+
+/*
+ * Page 0 holds the file header; the B+tree root lives at page 1 and the
+ * username index's meta page right after it in a new file. The header
+ * is rewritten through the pager at every checkpoint, so it is covered by
+ * the same before-image logging as the data pages and always describes the
+ * checkpointed file. db_open reads it with a single pread and validates the
+ * file before touching any data page. leaf_node_type is the leaf layout the
+ * table was created with.
+ */
+#define DB_HEADER_MAGIC "SIMPLEDB"
+#define DB_FORMAT_VERSION 4
+#define DB_HEADER_PAGE_NUM 0
+#define DB_ROOT_PAGE_NUM 1
+#define DB_SCHEMA "id integer, username varchar(32), email varchar(255)"
+
+typedef struct {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t page_size;
+    uint32_t num_pages;
+    uint32_t root_page_num;
+    uint32_t free_list_head;
+    uint32_t schema_hash;
+    uint64_t num_rows;
+    uint64_t next_txn_id;
+    uint32_t username_index_page;
+    uint32_t leaf_node_type;
+} DbHeader;
+
+uint32_t schema_hash() {
+    return crc32(DB_SCHEMA, strlen(DB_SCHEMA));
+}
+
+void db_write_header(DbTable* table) {
+    Pager* pager = table->pager;
+    DbHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DB_HEADER_MAGIC, sizeof(header.magic));
+    header.format_version = DB_FORMAT_VERSION;
+    header.page_size = PAGE_SIZE;
+    header.num_pages = pager->num_pages;
+    header.root_page_num = table->root_page_num;
+    header.free_list_head = 0;
+    header.schema_hash = schema_hash();
+    header.num_rows = table->num_rows;
+    header.next_txn_id = table->next_txn_id;
+    header.username_index_page = table->username_index_page;
+    header.leaf_node_type = table->pax ? NODE_PAX_LEAF : NODE_LEAF;
+
+    void* page = get_page(pager, DB_HEADER_PAGE_NUM);
+    if (memcmp(page, &header, sizeof(header)) != 0) {
+        mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+        memcpy(page, &header, sizeof(header));
+    }
+    unpin_page(pager, DB_HEADER_PAGE_NUM);
+}
+
+DbResult db_read_header(Pager* pager, DbHeader* header) {
+    if (pread(pager->fd, header, sizeof(DbHeader), 0) != sizeof(DbHeader) ||
+        memcmp(header->magic, DB_HEADER_MAGIC, sizeof(header->magic)) != 0) {
+        return DB_NOT_A_DATABASE;
+    }
+    if (header->format_version != DB_FORMAT_VERSION || header->page_size != PAGE_SIZE ||
+        header->schema_hash != schema_hash()) {
+        return DB_UNSUPPORTED_FORMAT;
+    }
+    if (header->num_pages > pager->num_pages || header->root_page_num == DB_HEADER_PAGE_NUM ||
+        header->root_page_num >= header->num_pages || header->username_index_page == DB_HEADER_PAGE_NUM ||
+        header->username_index_page >= header->num_pages ||
+        (header->leaf_node_type != NODE_LEAF && header->leaf_node_type != NODE_PAX_LEAF)) {
+        return DB_CORRUPT;
+    }
+    if (header->num_pages < pager->num_pages) {
+        /* Pages past the header's count were never checkpointed. */
+        if (ftruncate(pager->fd, (off_t)header->num_pages * PAGE_SIZE) == -1) {
+            db_fatal("Error truncating file.");
+        }
+        pager->num_pages = header->num_pages;
+        pager->file_length = (off_t)header->num_pages * PAGE_SIZE;
+        pager->map_file_length = pager->file_length;
+    }
+    return DB_SUCCESS;
+}
+
+/* Makes a transaction's rows visible to snapshots taken from now on. */
+void table_commit(DbTable* table, uint64_t txn_id, uint64_t rows) {
+    __atomic_add_fetch(&table->num_rows, rows, __ATOMIC_RELAXED);
+    __atomic_store_n(&table->visible_txn_id, txn_id, __ATOMIC_RELEASE);
+}
+
+uint64_t table_snapshot(DbTable* table) {
+    return __atomic_load_n(&table->visible_txn_id, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Makes the database file self-contained: every dirty page is written and
+ * synced, after which the log can be discarded. Called by the writer.
+ */
+void db_checkpoint(DbTable* table) {
+    Pager* pager = table->pager;
+
+    db_write_header(table);
+    pager_flush_all(pager);
+    if (pager->compressed) {
+        pager_write_translation_table(pager);
+    } else {
+        if (pager->mode == DB_PAGER_MODE_MMAP && msync(pager->map, pager->map_file_length, MS_SYNC) == -1) {
+            db_fatal("Error syncing file mapping.");
+        }
+        if (ftruncate(pager->fd, (off_t)pager->num_pages * PAGE_SIZE) == -1) {
+            db_fatal("Error truncating file.");
+        }
+        pager->map_file_length = (size_t)pager->num_pages * PAGE_SIZE;
+        if (fsync(pager->fd) == -1) {
+            db_fatal("Error syncing file.");
+        }
+    }
+    wal_truncate(table->wal);
+    pager_reset_logged_pages(pager);
+    wal_append(table->wal, WAL_RECORD_CHECKPOINT, &pager->num_pages, sizeof(uint32_t));
+}
+
+/*
+ * First recovery pass: puts the database file back into the state of the
+ * last checkpoint by writing back the logged page images and dropping pages
+ * allocated since. Runs before anything is read through the pager. A
+ * compressed file opens at its last checkpoint already.
+ */
+void wal_restore_pages(Wal* wal, Pager* pager) {
+    if (wal->file_length == 0 || pager->compressed) {
+        return;
+    }
+    char* log = wal_read_log(wal);
+    off_t offset = 0;
+    uint32_t type;
+    char* payload;
+    uint32_t length;
+    if (!wal_next_record(log, wal->file_length, &offset, &type, &payload, &length) ||
+        type != WAL_RECORD_CHECKPOINT) {
+        free(log);
+        return;
+    }
+    uint32_t num_pages;
+    memcpy(&num_pages, payload, sizeof(uint32_t));
+
+    while (wal_next_record(log, wal->file_length, &offset, &type, &payload, &length)) {
+        if (type != WAL_RECORD_PAGE_IMAGE) {
+            continue;
+        }
+        uint32_t page_num;
+        memcpy(&page_num, payload, sizeof(uint32_t));
+        if (pwrite(pager->fd, payload + sizeof(uint32_t), PAGE_SIZE, (off_t)page_num * PAGE_SIZE) != PAGE_SIZE) {
+            db_fatal("Error restoring page %u.", page_num);
+        }
+    }
+    free(log);
+
+    if (ftruncate(pager->fd, (off_t)num_pages * PAGE_SIZE) == -1 || fsync(pager->fd) == -1) {
+        db_fatal("Error restoring file.");
+    }
+    pager->num_pages = num_pages;
+    pager->file_length = (off_t)num_pages * PAGE_SIZE;
+    pager->map_file_length = pager->file_length;
+}
+
+/*
+ * Second recovery pass: replays the inserts on top of the checkpointed file,
+ * both single rows and the batches committed by explicit transactions.
+ * Inserts are replayed by id, so replaying is idempotent. Ends with a
+ * checkpoint, which also leaves a fresh log behind.
+ */
+void wal_replay_inserts(DbTable* table) {
+    Wal* wal = table->wal;
+    uint32_t replayed = 0;
+    if (wal->file_length > 0) {
+        char* log = wal_read_log(wal);
+        off_t offset = 0;
+        uint32_t type;
+        char* payload;
+        uint32_t length;
+        while (wal_next_record(log, wal->file_length, &offset, &type, &payload, &length)) {
+            if (type != WAL_RECORD_INSERT && type != WAL_RECORD_TRANSACTION) {
+                continue;
+            }
+            uint32_t position = 0;
+            while (position + ROW_HEADER_SIZE + 2 * STRING_LENGTH_SIZE <= length) {
+                Row row;
+                deserialize_row(&row, payload + position);
+                position += serialized_row_size(&row);
+                if (table_insert(table, &row) == EXECUTE_SUCCESS) {
+                    ++replayed;
+                    if (row.begin_txn >= table->next_txn_id) {
+                        table->next_txn_id = row.begin_txn + 1;
+                    }
+                    table_commit(table, table->next_txn_id - 1, 1);
+                }
+            }
+        }
+        free(log);
+    }
+    table->recovered_rows = replayed;
+    db_checkpoint(table);
+}
+
+DbResult db_open(const char* filename, const DbOptions* options, DbTable** result) {
+    DbOptions default_options;
+    if (options == NULL) {
+        default_options = db_default_options();
+        options = &default_options;
+    }
+    if (options->pager_mode == DB_PAGER_MODE_BUFFERED && options->pool_frames < MIN_POOL_FRAMES) {
+        return DB_INVALID_OPTIONS;
+    }
+    Pager* pager;
+    DbResult status = pager_open(filename, options->pager_mode, options->pool_frames, options->compress, &pager);
+    if (status != DB_SUCCESS) {
+        return status;
+    }
+    Wal* wal;
+    status = wal_open(filename, options->commit_interval_ms, &wal);
+    if (status != DB_SUCCESS) {
+        pager_release(pager);
+        return status;
+    }
+    wal_restore_pages(wal, pager);
+    DbHeader header;
+    if (pager->num_pages > 0 && (status = db_read_header(pager, &header)) != DB_SUCCESS) {
+        wal_release(wal);
+        pager_release(pager);
+        return status;
+    }
+
+    DbTable* table = (DbTable*) malloc(sizeof(DbTable));
+    ThreadPool* scan_pool = NULL;
+    uint32_t scan_threads = options->scan_threads < MAX_SCAN_THREADS ? options->scan_threads : MAX_SCAN_THREADS;
+    if (table != NULL && scan_threads > 1) {
+        scan_pool = new_thread_pool(scan_threads);
+    }
+    if (table == NULL || (scan_threads > 1 && scan_pool == NULL)) {
+        free(table);
+        wal_release(wal);
+        pager_release(pager);
+        return DB_OUT_OF_MEMORY;
+    }
+    table->pager = pager;
+    table->root_page_num = DB_ROOT_PAGE_NUM;
+    table->num_rows = 0;
+    table->next_txn_id = 1;
+    table->visible_txn_id = 0;
+    pthread_mutex_init(&table->write_lock, NULL);
+    table->txn = NULL;
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&table->rollback_lock, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+    table->scan_pool = scan_pool;
+    table->wal = wal;
+
+    if (pager->num_pages == 0) {
+        table->pax = options->pax;
+        get_unused_page_num(pager);
+        uint32_t root_page_num = get_unused_page_num(pager);
+        void* root_node = get_page(pager, root_page_num);
+        mark_page_dirty(pager, root_page_num);
+        initialize_leaf_node(root_node, table->pax ? NODE_PAX_LEAF : NODE_LEAF);
+        set_node_root(root_node, true);
+        unpin_page(pager, root_page_num);
+        table->username_index_page = hash_index_create(pager);
+    } else {
+        table->root_page_num = header.root_page_num;
+        table->username_index_page = header.username_index_page;
+        table->pax = header.leaf_node_type == NODE_PAX_LEAF;
+        table->num_rows = header.num_rows;
+        table->next_txn_id = header.next_txn_id;
+        table->visible_txn_id = header.next_txn_id - 1;
+    }
+    wal_replay_inserts(table);
+    pager->wal = table->wal;
+    wal_start_flusher(table->wal);
+    *result = table;
+    return DB_SUCCESS;
+}
+
+/* Throws away the open transaction's changes. Called by the writer. */
+void table_rollback(DbTable* table) {
+    pthread_rwlock_wrlock(&table->rollback_lock);
+    pager_rollback_transaction(table->pager);
+    pthread_rwlock_unlock(&table->rollback_lock);
+    table->txn->active = false;
+    table->txn = NULL;
+}
+
+/* A transaction still open at close is rolled back. */
+void db_close(DbTable* table) {
+    if (table->scan_pool != NULL) {
+        free_thread_pool(table->scan_pool);
+    }
+    if (table->txn != NULL) {
+        table_rollback(table);
+    }
+    db_checkpoint(table);
+    pager_close(table->pager);
+    wal_close(table->wal);
+    pthread_mutex_destroy(&table->write_lock);
+    pthread_rwlock_destroy(&table->rollback_lock);
+    free(table);
+}
+
+OutputSink* new_output_sink(int fd) {
+    OutputSink* sink = checked_malloc(sizeof(OutputSink));
+    sink->fd = fd;
+    sink->format = OUTPUT_FORMAT_TUPLE;
+    sink->ordered = true;
+    sink->capacity = OUTPUT_BUFFER_SIZE;
+    sink->buffer = checked_malloc(sink->capacity);
+    sink->used = 0;
+    sink->soft_limit = 0;
+    sink->failed = false;
+    return sink;
+}
+
+OutputSink* new_memory_sink(OutputFormat format) {
+    OutputSink* sink = checked_malloc(sizeof(OutputSink));
+    sink->fd = -1;
+    sink->format = format;
+    sink->ordered = true;
+    sink->capacity = 16u << 10;
+    sink->buffer = checked_malloc(sink->capacity);
+    sink->used = 0;
+    sink->soft_limit = 0;
+    sink->failed = false;
+    return sink;
+}
+
+void free_output_sink(OutputSink* sink) {
+    free(sink->buffer);
+    free(sink);
+}
+
+/* A failed write (say, a client that hung up) drops the output and marks the sink failed. */
+void sink_write_out(OutputSink* sink, const char* data, size_t length) {
+    if (sink->failed) {
+        return;
+    }
+    while (length > 0) {
+        ssize_t written = write(sink->fd, data, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sink->failed = true;
+            break;
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+void sink_flush(OutputSink* sink) {
+    if (sink->fd >= 0) {
+        sink_write_out(sink, sink->buffer, sink->used);
+        sink->used = 0;
+    }
+}
+
+/* Makes room for length bytes; a single row never exceeds the buffer. */
+char* sink_reserve(OutputSink* sink, size_t length) {
+    if (sink->used + length > sink->capacity) {
+        if (sink->fd >= 0) {
+            sink_flush(sink);
+        } else {
+            while (sink->used + length > sink->capacity) {
+                sink->capacity *= 2;
+            }
+            sink->buffer = checked_realloc(sink->buffer, sink->capacity);
+        }
+    }
+    return sink->buffer + sink->used;
+}
+
+/* Appends a block of already formatted output, writing large blocks straight through to a descriptor. */
+void sink_write_block(OutputSink* sink, const char* data, size_t length) {
+    if (sink->fd >= 0 && sink->used + length > sink->capacity) {
+        sink_flush(sink);
+        sink_write_out(sink, data, length);
+        return;
+    }
+    memcpy(sink_reserve(sink, length), data, length);
+    sink->used += length;
+}
+
+void sink_write(OutputSink* sink, const void* data, size_t length) {
+    memcpy(sink_reserve(sink, length), data, length);
+    sink->used += length;
+}
+
+void sink_write_char(OutputSink* sink, char c) {
+    *sink_reserve(sink, 1) = c;
+    ++sink->used;
+}
+
+void sink_write_uint(OutputSink* sink, uint64_t value) {
+    char digits[20];
+    int length = 0;
+    do {
+        digits[sizeof(digits) - 1 - length++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    sink_write(sink, digits + sizeof(digits) - length, length);
+}
+
+void sink_write_csv_field(OutputSink* sink, const char* data, size_t length) {
+    if (memchr(data, ',', length) == NULL && memchr(data, '"', length) == NULL &&
+        memchr(data, '\n', length) == NULL) {
+        sink_write(sink, data, length);
+        return;
+    }
+    sink_write_char(sink, '"');
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] == '"') {
+            sink_write_char(sink, '"');
+        }
+        sink_write_char(sink, data[i]);
+    }
+    sink_write_char(sink, '"');
+}
+
+void sink_write_tsv_field(OutputSink* sink, const char* data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        switch (data[i]) {
+            case ('\t'):
+                sink_write(sink, "\\t", 2);
+                break;
+            case ('\n'):
+                sink_write(sink, "\\n", 2);
+                break;
+            case ('\\'):
+                sink_write(sink, "\\\\", 2);
+                break;
+            default:
+                sink_write_char(sink, data[i]);
+        }
+    }
+}
+
+void sink_write_json_string(OutputSink* sink, const char* data, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    sink_write_char(sink, '"');
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = data[i];
+        if (c == '"' || c == '\\') {
+            sink_write_char(sink, '\\');
+            sink_write_char(sink, c);
+        } else if (c < 0x20) {
+            char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            sink_write(sink, escape, sizeof(escape));
+        } else {
+            sink_write_char(sink, c);
+        }
+    }
+    sink_write_char(sink, '"');
+}
+
+/*
+ * Formats the given columns of a row straight from its page; nothing is
+ * copied out first. The binary format writes the id as 4 bytes and each
+ * string with a one-byte length, as rows are stored minus their
+ * transaction ids.
+ */
+void print_row(OutputSink* sink, const DbRowView* row, const Column* columns, uint32_t num_columns) {
+    static const char* const json_keys[] = {"\"id\":", "\"username\":", "\"email\":"};
+    for (uint32_t i = 0; i < num_columns; ++i) {
+        Column column = columns[i];
+        const char* text = column == COLUMN_USERNAME ? row->username : row->email;
+        size_t length = column == COLUMN_USERNAME ? row->username_length : row->email_length;
+        switch (sink->format) {
+            case (OUTPUT_FORMAT_TUPLE):
+                sink_write(sink, i == 0 ? "(" : ", ", i == 0 ? 1 : 2);
+                if (column == COLUMN_ID) {
+                    sink_write_uint(sink, row->id);
+                } else {
+                    sink_write(sink, text, length);
+                }
+                break;
+            case (OUTPUT_FORMAT_CSV):
+            case (OUTPUT_FORMAT_TSV):
+                if (i > 0) {
+                    sink_write_char(sink, sink->format == OUTPUT_FORMAT_CSV ? ',' : '\t');
+                }
+                if (column == COLUMN_ID) {
+                    sink_write_uint(sink, row->id);
+                } else if (sink->format == OUTPUT_FORMAT_CSV) {
+                    sink_write_csv_field(sink, text, length);
+                } else {
+                    sink_write_tsv_field(sink, text, length);
+                }
+                break;
+            case (OUTPUT_FORMAT_JSON):
+                sink_write_char(sink, i == 0 ? '{' : ',');
+                sink_write(sink, json_keys[column], strlen(json_keys[column]));
+                if (column == COLUMN_ID) {
+                    sink_write_uint(sink, row->id);
+                } else {
+                    sink_write_json_string(sink, text, length);
+                }
+                break;
+            case (OUTPUT_FORMAT_BINARY):
+                if (column == COLUMN_ID) {
+                    sink_write(sink, &row->id, ID_SIZE);
+                } else {
+                    sink_write_char(sink, length);
+                    sink_write(sink, text, length);
+                }
+                break;
+        }
+    }
+    switch (sink->format) {
+        case (OUTPUT_FORMAT_TUPLE):
+            sink_write(sink, ")\n", 2);
+            break;
+        case (OUTPUT_FORMAT_JSON):
+            sink_write(sink, "}\n", 2);
+            break;
+        case (OUTPUT_FORMAT_BINARY):
+            break;
+        default:
+            sink_write_char(sink, '\n');
+    }
+}
+
+void print_count(OutputSink* sink, uint64_t count) {
+    switch (sink->format) {
+        case (OUTPUT_FORMAT_JSON):
+            sink_write(sink, "{\"count\":", 9);
+            sink_write_uint(sink, count);
+            sink_write(sink, "}\n", 2);
+            break;
+        case (OUTPUT_FORMAT_BINARY):
+            sink_write(sink, &count, sizeof(count));
+            break;
+        case (OUTPUT_FORMAT_TUPLE):
+            sink_write_char(sink, '(');
+            sink_write_uint(sink, count);
+            sink_write(sink, ")\n", 2);
+            break;
+        case (OUTPUT_FORMAT_CSV):
+        case (OUTPUT_FORMAT_TSV):
+            sink_write_uint(sink, count);
+            sink_write_char(sink, '\n');
+            break;
+    }
+}
+
+bool parse_output_format(const char* name, OutputFormat* format) {
+    static const char* names[] = {"tuple", "csv", "tsv", "json", "binary"};
+    for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (strcmp(name, names[i]) == 0) {
+            *format = (OutputFormat) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void bulk_loader_release(BulkLoader* loader) {
+    if (loader->leaf != NULL) {
+        unpin_page(loader->table->pager, loader->leaf_page_num);
+        loader->leaf = NULL;
+    }
+}
+
+/* Pins the rightmost leaf, whose last key is the largest id in the table. */
+void bulk_loader_position(BulkLoader* loader) {
+    Pager* pager = loader->table->pager;
+    uint32_t page_num = loader->table->root_page_num;
+    void* node = get_page(pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_right_child(node);
+        unpin_page(pager, page_num);
+        page_num = child_page_num;
+        node = get_page(pager, page_num);
+    }
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    loader->leaf = node;
+    loader->leaf_page_num = page_num;
+    loader->leaf_dirty = false;
+    loader->has_max_key = num_cells > 0;
+    if (num_cells > 0) {
+        loader->max_key = *leaf_node_key(node, num_cells - 1);
+    }
+}
+
+void bulk_loader_begin(BulkLoader* loader, DbTable* table) {
+    loader->table = table;
+    loader->leaf = NULL;
+    loader->index_entries = NULL;
+    loader->num_index_entries = 0;
+    loader->index_capacity = 0;
+    bulk_loader_position(loader);
+}
+
+EXECUTE_RESULT bulk_loader_add(BulkLoader* loader, Row* row) {
+    bool appends = !loader->has_max_key || row->id > loader->max_key;
+    if (appends && loader->leaf != NULL) {
+        char cell[ROW_MAX_SIZE];
+        uint32_t length = serialize_row(row, cell);
+        if (leaf_node_fits(loader->leaf, length)) {
+            Pager* pager = loader->table->pager;
+            latch_page(pager, loader->leaf_page_num, true);
+            if (!loader->leaf_dirty) {
+                mark_page_dirty(pager, loader->leaf_page_num);
+                loader->leaf_dirty = true;
+            }
+            leaf_node_insert_cell(loader->leaf, *leaf_node_num_cells(loader->leaf), row->id, cell, length);
+            unlatch_page(pager, loader->leaf_page_num);
+            if (loader->num_index_entries == loader->index_capacity) {
+                loader->index_capacity = loader->index_capacity ? loader->index_capacity * 2 : 4096;
+                loader->index_entries = checked_realloc(loader->index_entries, loader->index_capacity * sizeof(uint64_t));
+            }
+            uint32_t hash = crc32(row->username, strlen(row->username));
+            loader->index_entries[loader->num_index_entries++] = (uint64_t)reverse_bits(hash) << 32 | row->id;
+            loader->has_max_key = true;
+            loader->max_key = row->id;
+            return EXECUTE_SUCCESS;
+        }
+    }
+
+    bulk_loader_release(loader);
+    EXECUTE_RESULT result = table_insert(loader->table, row);
+    if (result == EXECUTE_SUCCESS && appends) {
+        bulk_loader_position(loader);
+    }
+    return result;
+}
+
+void bulk_loader_end(BulkLoader* loader) {
+    bulk_loader_release(loader);
+    hash_index_insert_batch(loader->table, loader->index_entries, loader->num_index_entries);
+    free(loader->index_entries);
+}
+
+void arena_init(Arena* arena) {
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->used = 0;
+}
+
+size_t arena_align(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = arena_align(size);
+    if (arena->current == NULL || arena->used + size > arena->current->capacity) {
+        ArenaBlock** link = arena->current == NULL ? &arena->first : &arena->current->next;
+        if (*link == NULL || (*link)->capacity < size) {
+            size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+            ArenaBlock* block = malloc(sizeof(ArenaBlock) + capacity);
+            if (block == NULL) {
+                db_fatal("Error: out of memory.");
+            }
+            block->capacity = capacity;
+            block->next = *link;
+            *link = block;
+        }
+        arena->current = *link;
+        arena->used = 0;
+    }
+    void* memory = arena->current->data + arena->used;
+    arena->used += size;
+    return memory;
+}
+
+/*
+ * Resizes memory, the latest allocation, in place when its block has room
+ * and by copying otherwise.
+ */
+void* arena_grow(Arena* arena, void* memory, size_t old_size, size_t new_size) {
+    size_t aligned_size = arena_align(old_size);
+    if (memory != NULL && (char*)memory + aligned_size == arena->current->data + arena->used &&
+        arena->used - aligned_size + arena_align(new_size) <= arena->current->capacity) {
+        arena->used -= aligned_size;
+        return arena_alloc(arena, new_size);
+    }
+    void* grown = arena_alloc(arena, new_size);
+    if (old_size > 0) {
+        memcpy(grown, memory, old_size);
+    }
+    return grown;
+}
+
+/* Releases everything allocated since the last reset, keeping the blocks. */
+void arena_reset(Arena* arena) {
+    arena->current = NULL;
+    arena->used = 0;
+}
+
+void arena_free(Arena* arena) {
+    ArenaBlock* block = arena->first;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena_init(arena);
+}
+
+/* Resets statement to a select of every column of every row. */
+void init_statement(Statement* statement) {
+    statement->type = STATEMENT_SELECT;
+    statement->rows = NULL;
+    statement->num_rows = 0;
+    statement->where = NULL;
+    statement->count_only = false;
+    statement->columns[0] = COLUMN_ID;
+    statement->columns[1] = COLUMN_USERNAME;
+    statement->columns[2] = COLUMN_EMAIL;
+    statement->num_columns = 3;
+    statement->limit = NO_LIMIT;
+    statement->index_key = NULL;
+    statement->parameters = NULL;
+    statement->num_parameters = 0;
+    statement->progress.suspended = false;
+}
+
+Statement* create_statement(Arena* arena) {
+    Statement* statement = arena_alloc(arena, sizeof(Statement));
+    init_statement(statement);
+    return statement;
+}
+
+/*
+ * Statement parsing. A single-pass lexer feeds a recursive-descent parser
+ * that fills in a Statement, which is the parse tree the executors run. The
+ * lexer never modifies the line and keeps all of its state in the Lexer, so
+ * any number of threads can parse at once; whatever a statement needs
+ * beyond that comes from the caller's arena.
+ *
+ * statement := insert | select | BEGIN | COMMIT | ROLLBACK
+ * insert    := INSERT value value value
+ *            | INSERT VALUES tuple (',' tuple)*
+ * tuple     := '(' value ',' value ',' value ')'
+ * select    := SELECT [columns] [WHERE or] [LIMIT number]
+ * columns   := '*' | COUNT '(' '*' ')' | column (',' column)*
+ *
+ * Keywords are case-insensitive. A value is a quoted string, in which a
+ * doubled quote stands for one quote, or a bare word; the bare values of
+ * the first insert form run to the next whitespace. In a prepared
+ * statement a ? may stand for any value, literal or LIMIT; the parser
+ * records each one in the statement's parameter list.
+ */
+typedef enum {
+    TOKEN_END,
+    TOKEN_WORD,
+    TOKEN_NUMBER,
+    TOKEN_STRING,
+    TOKEN_OPERATOR,
+    TOKEN_LEFT_PAREN,
+    TOKEN_RIGHT_PAREN,
+    TOKEN_COMMA,
+    TOKEN_PARAMETER,
+    TOKEN_INVALID
+} TokenType;
+
+/* A token points into the line. Quoted strings exclude their quotes, and quote is 0 for anything else. */
+typedef struct {
+    TokenType type;
+    const char* start;
+    uint32_t length;
+    char quote;
+} Token;
+
+typedef struct {
+    const char* position;
+    Token current;
+    Arena* arena;
+    Statement* statement;
+    uint32_t parameter_capacity;
+} Lexer;
+
+const char* lexer_skip_blanks(const char* p) {
+    while (*p == ' ' || *p == '\t') {
+        ++p;
+    }
+    return p;
+}
+
+/* Reads the quoted string whose opening quote is at p. */
+void lexer_read_string(Lexer* lexer, const char* p) {
+    Token* token = &lexer->current;
+    char quote = *p++;
+    token->start = p;
+    token->quote = quote;
+    while (*p && (*p != quote || p[1] == quote)) {
+        p += *p == quote ? 2 : 1;
+    }
+    if (*p != quote) {
+        token->type = TOKEN_INVALID;
+        token->length = 0;
+        lexer->position = p;
+        return;
+    }
+    token->type = TOKEN_STRING;
+    token->length = p - token->start;
+    lexer->position = p + 1;
+}
+
+void lexer_advance(Lexer* lexer) {
+    const char* p = lexer_skip_blanks(lexer->position);
+    Token* token = &lexer->current;
+    token->start = p;
+    token->length = 0;
+    token->quote = 0;
+    if (*p == 0) {
+        token->type = TOKEN_END;
+    } else if (*p == '(' || *p == ')') {
+        token->type = *p == '(' ? TOKEN_LEFT_PAREN : TOKEN_RIGHT_PAREN;
+        token->length = 1;
+    } else if (*p == ',' || *p == '?') {
+        token->type = *p == ',' ? TOKEN_COMMA : TOKEN_PARAMETER;
+        token->length = 1;
+    } else if (*p == '\'' || *p == '"') {
+        lexer_read_string(lexer, p);
+        return;
+    } else if (strchr("=!<>", *p)) {
+        token->type = TOKEN_OPERATOR;
+        token->length = (p[1] == '=' || (p[0] == '<' && p[1] == '>')) ? 2 : 1;
+    } else if (*p == '-' || (*p >= '0' && *p <= '9')) {
+        token->type = TOKEN_NUMBER;
+        const char* q = p + 1;
+        while (*q >= '0' && *q <= '9') {
+            ++q;
+        }
+        token->length = q - p;
+    } else {
+        token->type = TOKEN_WORD;
+        const char* q = p;
+        while (*q && !strchr(" \t(),=!<>'\"", *q)) {
+            ++q;
+        }
+        token->length = q - p;
+    }
+    lexer->position = p + token->length;
+}
+
+/* Reads an insert value: a quoted string, or a bare word running to whitespace or one of stops. */
+void lexer_advance_value(Lexer* lexer, const char* stops) {
+    const char* p = lexer_skip_blanks(lexer->position);
+    Token* token = &lexer->current;
+    if (*p == '\'' || *p == '"') {
+        lexer_read_string(lexer, p);
+        return;
+    }
+    const char* q = p;
+    while (*q && *q != ' ' && *q != '\t' && !strchr(stops, *q)) {
+        ++q;
+    }
+    token->type = *p == 0 ? TOKEN_END : q - p == 1 && *p == '?' ? TOKEN_PARAMETER : TOKEN_WORD;
+    token->start = p;
+    token->length = q - p;
+    token->quote = 0;
+    lexer->position = q;
+}
+
+bool token_is_keyword(Token* token, const char* keyword) {
+    return token->type == TOKEN_WORD && strlen(keyword) == token->length &&
+           strncasecmp(token->start, keyword, token->length) == 0;
+}
+
+bool token_is_operator(Token* token, const char* op) {
+    return token->type == TOKEN_OPERATOR && strlen(op) == token->length &&
+           strncmp(token->start, op, token->length) == 0;
+}
+
+bool token_is_star(Token* token) {
+    return token->type == TOKEN_WORD && token->length == 1 && token->start[0] == '*';
+}
+
+bool token_column(Token* token, Column* column) {
+    if (token_is_keyword(token, "id")) {
+        *column = COLUMN_ID;
+    } else if (token_is_keyword(token, "username")) {
+        *column = COLUMN_USERNAME;
+    } else if (token_is_keyword(token, "email")) {
+        *column = COLUMN_EMAIL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Copies a string token into destination as a terminated string, undoubling
+ * quotes. Returns its length, or -1 if that would exceed max_length.
+ */
+int32_t token_copy_string(Token* token, char* destination, uint32_t max_length) {
+    uint32_t length = 0;
+    for (uint32_t i = 0; i < token->length; ++i) {
+        if (length == max_length) {
+            return -1;
+        }
+        destination[length++] = token->start[i];
+        if (token->quote && token->start[i] == token->quote) {
+            ++i;
+        }
+    }
+    destination[length] = 0;
+    return length;
+}
+
+/* Reads an unquoted decimal number no larger than max. */
+bool token_to_uint(Token* token, uint64_t max, uint64_t* value) {
+    if (token->length == 0 || token->quote) {
+        return false;
+    }
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < token->length; ++i) {
+        char c = token->start[i];
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        result = result * 10 + (c - '0');
+        if (result > max) {
+            return false;
+        }
+    }
+    *value = result;
+    return true;
+}
+
+/* Records a ? of the statement being parsed. */
+Parameter* add_parameter(Lexer* lexer, ParameterType type, void* target) {
+    Statement* statement = lexer->statement;
+    if (statement->num_parameters == lexer->parameter_capacity) {
+        uint32_t capacity = lexer->parameter_capacity ? lexer->parameter_capacity * 2 : 4;
+        statement->parameters = arena_grow(lexer->arena, statement->parameters,
+                                           lexer->parameter_capacity * sizeof(Parameter), capacity * sizeof(Parameter));
+        lexer->parameter_capacity = capacity;
+    }
+    Parameter* parameter = &statement->parameters[statement->num_parameters++];
+    parameter->type = type;
+    parameter->target = target;
+    parameter->row_num = 0;
+    parameter->bound = false;
+    return parameter;
+}
+
+/* Sets one field of a row to insert; ids must be positive decimal numbers. */
+PrepareResult set_row_field(Row* row, ParameterType field, Token* token) {
+    if (field == PARAMETER_USERNAME || field == PARAMETER_EMAIL) {
+        char* destination = field == PARAMETER_USERNAME ? row->username : row->email;
+        uint32_t max_length = field == PARAMETER_USERNAME ? DB_USERNAME_SIZE : DB_EMAIL_SIZE;
+        return token_copy_string(token, destination, max_length) < 0 ? PREPARE_STRING_TOO_LONG : PREPARE_SUCCESS;
+    }
+    Token digits = *token;
+    bool negative = !token->quote && token->length > 0 && token->start[0] == '-';
+    if (negative) {
+        ++digits.start;
+        --digits.length;
+    }
+    uint64_t value;
+    if (!token_to_uint(&digits, UINT32_MAX, &value)) {
+        return PREPARE_NOT_ID;
+    }
+    if (negative && value > 0) {
+        return PREPARE_NEGATIVE_ID;
+    }
+    if (negative || value == 0) {
+        return PREPARE_NOT_ID;
+    }
+    row->id = value;
+    return PREPARE_SUCCESS;
+}
+
+/* Fills the statement's row row_num from the id, username and email tokens of one insert row. */
+PrepareResult parse_row(Lexer* lexer, Token* fields, uint32_t row_num) {
+    static const ParameterType field_types[] = {PARAMETER_ID, PARAMETER_USERNAME, PARAMETER_EMAIL};
+    Row* row = &lexer->statement->rows[row_num];
+    for (uint32_t i = 0; i < 3; ++i) {
+        if (fields[i].type == TOKEN_END || fields[i].type == TOKEN_INVALID ||
+            (fields[i].length == 0 && !fields[i].quote)) {
+            return PREPARE_STRING_NOT_RIGHT;
+        }
+    }
+    for (uint32_t i = 0; i < 3; ++i) {
+        if (fields[i].type == TOKEN_PARAMETER) {
+            add_parameter(lexer, field_types[i], NULL)->row_num = row_num;
+            continue;
+        }
+        PrepareResult result = set_row_field(row, field_types[i], &fields[i]);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+    }
+    return PREPARE_SUCCESS;
+}
+
+/* Makes room for one more insert row; the rows stay contiguous in the arena. */
+void statement_reserve_row(Statement* statement, Arena* arena, uint32_t* capacity) {
+    if (statement->num_rows < *capacity) {
+        return;
+    }
+    uint32_t new_capacity = *capacity ? *capacity * 2 : 4;
+    statement->rows = arena_grow(arena, statement->rows, *capacity * sizeof(Row), new_capacity * sizeof(Row));
+    *capacity = new_capacity;
+}
+
+PrepareResult parse_insert(Lexer* lexer, Statement* statement) {
+    statement->type = STATEMENT_INSERT;
+    Token fields[3];
+    uint32_t capacity = 0;
+    lexer_advance_value(lexer, "(,)");
+    if (!token_is_keyword(&lexer->current, "values")) {
+        fields[0] = lexer->current;
+        for (uint32_t i = 1; i < 3; ++i) {
+            lexer_advance_value(lexer, "");
+            fields[i] = lexer->current;
+        }
+        lexer_advance(lexer);
+        if (lexer->current.type != TOKEN_END) {
+            return PREPARE_STRING_NOT_RIGHT;
+        }
+        statement_reserve_row(statement, lexer->arena, &capacity);
+        statement->num_rows = 1;
+        return parse_row(lexer, fields, 0);
+    }
+
+    lexer_advance(lexer);
+    while (true) {
+        if (lexer->current.type != TOKEN_LEFT_PAREN) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        for (uint32_t i = 0; i < 3; ++i) {
+            lexer_advance_value(lexer, "(,)");
+            fields[i] = lexer->current;
+            lexer_advance(lexer);
+            if (lexer->current.type != (i < 2 ? TOKEN_COMMA : TOKEN_RIGHT_PAREN)) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+        }
+        statement_reserve_row(statement, lexer->arena, &capacity);
+        PrepareResult result = parse_row(lexer, fields, statement->num_rows);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        ++statement->num_rows;
+        lexer_advance(lexer);
+        if (lexer->current.type != TOKEN_COMMA) {
+            break;
+        }
+        lexer_advance(lexer);
+    }
+    return lexer->current.type == TOKEN_END ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+Predicate* new_predicate(Lexer* lexer, PredicateType type) {
+    Predicate* predicate = arena_alloc(lexer->arena, sizeof(Predicate));
+    memset(predicate, 0, sizeof(Predicate));
+    predicate->type = type;
+    return predicate;
+}
+
+Predicate* new_binary_predicate(Lexer* lexer, PredicateType type, Predicate* left, Predicate* right) {
+    Predicate* predicate = new_predicate(lexer, type);
+    predicate->left = left;
+    predicate->right = right;
+    return predicate;
+}
+
+/* Sets the literal a predicate compares its column with. */
+PrepareResult set_literal(Predicate* predicate, Token* token) {
+    if (predicate->column == COLUMN_ID) {
+        if (!token->quote && token->length > 1 && token->start[0] == '-') {
+            return PREPARE_NEGATIVE_ID;
+        }
+        uint64_t value;
+        if (!token_to_uint(token, UINT32_MAX, &value)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        predicate->id_value = value;
+    } else {
+        if (token->type != TOKEN_STRING && token->type != TOKEN_WORD && token->type != TOKEN_NUMBER) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        uint32_t max_length = predicate->column == COLUMN_USERNAME ? DB_USERNAME_SIZE : DB_EMAIL_SIZE;
+        int32_t length = token_copy_string(token, predicate->string_value, max_length);
+        if (length < 0) {
+            return PREPARE_STRING_TOO_LONG;
+        }
+        predicate->string_length = length;
+    }
+    return PREPARE_SUCCESS;
+}
+
+/* Sets a LIKE pattern: 'prefix%' matches by prefix, a pattern without % by equality. */
+PrepareResult set_like_pattern(Predicate* predicate, Token* token) {
+    Token pattern = *token;
+    const char* percent = memchr(pattern.start, '%', pattern.length);
+    if (percent != NULL && percent != pattern.start + pattern.length - 1) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (percent != NULL) {
+        predicate->type = PREDICATE_LIKE_PREFIX;
+        --pattern.length;
+    } else {
+        predicate->type = PREDICATE_COMPARE;
+        predicate->op = COMPARE_EQ;
+    }
+    return set_literal(predicate, &pattern);
+}
+
+/* Reads a literal, or a ? that will supply it, for predicate. */
+PrepareResult parse_literal(Lexer* lexer, Predicate* predicate) {
+    Token* token = &lexer->current;
+    if (token->type == TOKEN_PARAMETER) {
+        add_parameter(lexer, PARAMETER_LITERAL, predicate);
+    } else {
+        if (token->type != TOKEN_NUMBER && predicate->column == COLUMN_ID) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        PrepareResult result = set_literal(predicate, token);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+    }
+    lexer_advance(lexer);
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult parse_or(Lexer* lexer, Predicate** result);
+
+/*
+ * comparison := '(' or ')'
+ *             | column op literal
+ *             | column BETWEEN literal AND literal
+ *             | column LIKE 'prefix%'
+ */
+PrepareResult parse_comparison(Lexer* lexer, Predicate** result) {
+    Token* token = &lexer->current;
+    if (token->type == TOKEN_LEFT_PAREN) {
+        lexer_advance(lexer);
+        PrepareResult inner = parse_or(lexer, result);
+        if (inner != PREPARE_SUCCESS) {
+            return inner;
+        }
+        if (token->type != TOKEN_RIGHT_PAREN) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        lexer_advance(lexer);
+        return PREPARE_SUCCESS;
+    }
+
+    Column column;
+    if (!token_column(token, &column)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    lexer_advance(lexer);
+
+    Predicate* predicate = new_predicate(lexer, PREDICATE_COMPARE);
+    predicate->column = column;
+    *result = predicate;
+
+    if (token_is_keyword(token, "between")) {
+        lexer_advance(lexer);
+        Predicate* upper = new_predicate(lexer, PREDICATE_COMPARE);
+        upper->column = column;
+        upper->op = COMPARE_LE;
+        predicate->op = COMPARE_GE;
+        *result = new_binary_predicate(lexer, PREDICATE_AND, predicate, upper);
+        PrepareResult lower_result = parse_literal(lexer, predicate);
+        if (lower_result != PREPARE_SUCCESS) {
+            return lower_result;
+        }
+        if (!token_is_keyword(token, "and")) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        lexer_advance(lexer);
+        return parse_literal(lexer, upper);
+    }
+
+    if (token_is_keyword(token, "like")) {
+        lexer_advance(lexer);
+        PrepareResult result = PREPARE_SUCCESS;
+        if (column != COLUMN_ID && token->type == TOKEN_PARAMETER) {
+            /* Until a pattern is bound the plan must not treat this as an equality. */
+            predicate->type = PREDICATE_LIKE_PREFIX;
+            add_parameter(lexer, PARAMETER_LIKE_PATTERN, predicate);
+        } else if (column != COLUMN_ID && token->type == TOKEN_STRING) {
+            result = set_like_pattern(predicate, token);
+        } else {
+            result = PREPARE_SYNTAX_ERROR;
+        }
+        lexer_advance(lexer);
+        return result;
+    }
+
+    if (token->type != TOKEN_OPERATOR) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (token_is_operator(token, "=")) {
+        predicate->op = COMPARE_EQ;
+    } else if (token_is_operator(token, "!=") || token_is_operator(token, "<>")) {
+        predicate->op = COMPARE_NE;
+    } else if (token_is_operator(token, "<")) {
+        predicate->op = COMPARE_LT;
+    } else if (token_is_operator(token, "<=")) {
+        predicate->op = COMPARE_LE;
+    } else if (token_is_operator(token, ">")) {
+        predicate->op = COMPARE_GT;
+    } else if (token_is_operator(token, ">=")) {
+        predicate->op = COMPARE_GE;
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    lexer_advance(lexer);
+    return parse_literal(lexer, predicate);
+}
+
+/* and := comparison (AND comparison)* */
+PrepareResult parse_and(Lexer* lexer, Predicate** result) {
+    PrepareResult status = parse_comparison(lexer, result);
+    while (status == PREPARE_SUCCESS && token_is_keyword(&lexer->current, "and")) {
+        lexer_advance(lexer);
+        Predicate* right = NULL;
+        status = parse_comparison(lexer, &right);
+        *result = new_binary_predicate(lexer, PREDICATE_AND, *result, right);
+    }
+    return status;
+}
+
+/* or := and (OR and)* */
+PrepareResult parse_or(Lexer* lexer, Predicate** result) {
+    PrepareResult status = parse_and(lexer, result);
+    while (status == PREPARE_SUCCESS && token_is_keyword(&lexer->current, "or")) {
+        lexer_advance(lexer);
+        Predicate* right = NULL;
+        status = parse_and(lexer, &right);
+        *result = new_binary_predicate(lexer, PREDICATE_OR, *result, right);
+    }
+    return status;
+}
+
+/* Returns the username = 'x' comparison the whole predicate depends on, if there is one. */
+Predicate* username_index_key(Predicate* predicate) {
+    if (predicate == NULL) {
+        return NULL;
+    }
+    if (predicate->type == PREDICATE_AND) {
+        Predicate* key = username_index_key(predicate->left);
+        return key != NULL ? key : username_index_key(predicate->right);
+    }
+    if (predicate->type == PREDICATE_COMPARE && predicate->column == COLUMN_USERNAME && predicate->op == COMPARE_EQ) {
+        return predicate;
+    }
+    return NULL;
+}
+
+/*
+ * Predicates compare id, username or email with =, !=, <, >, <=, >=,
+ * BETWEEN .. AND .. or LIKE 'prefix%', combined with AND, OR and
+ * parentheses.
+ */
+PrepareResult parse_select(Lexer* lexer, Statement* statement) {
+    statement->type = STATEMENT_SELECT;
+    Token* token = &lexer->current;
+    lexer_advance(lexer);
+    if (token_is_keyword(token, "count")) {
+        lexer_advance(lexer);
+        bool star = token->type == TOKEN_LEFT_PAREN;
+        lexer_advance(lexer);
+        star = star && token_is_star(token);
+        lexer_advance(lexer);
+        if (!star || token->type != TOKEN_RIGHT_PAREN) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->count_only = true;
+        lexer_advance(lexer);
+    } else if (token_is_star(token)) {
+        lexer_advance(lexer);
+    } else if (token_column(token, &statement->columns[0])) {
+        statement->num_columns = 1;
+        lexer_advance(lexer);
+        while (token->type == TOKEN_COMMA) {
+            lexer_advance(lexer);
+            if (statement->num_columns == SELECT_MAX_COLUMNS ||
+                !token_column(token, &statement->columns[statement->num_columns])) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            ++statement->num_columns;
+            lexer_advance(lexer);
+        }
+    }
+
+    if (token_is_keyword(token, "where")) {
+        lexer_advance(lexer);
+        PrepareResult result = parse_or(lexer, &statement->where);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+    }
+    if (token_is_keyword(token, "limit")) {
+        lexer_advance(lexer);
+        if (token->type == TOKEN_PARAMETER) {
+            add_parameter(lexer, PARAMETER_LIMIT, NULL);
+        } else if (token->type != TOKEN_NUMBER || !token_to_uint(token, NO_LIMIT - 1, &statement->limit)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        lexer_advance(lexer);
+    }
+    if (token->type != TOKEN_END) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    statement->index_key = username_index_key(statement->where);
+    return PREPARE_SUCCESS;
+}
+
+/* Parses a statement from the lexer's first token on into statement. */
+PrepareResult parse_statement(Lexer* lexer, Statement* statement) {
+    Token* token = &lexer->current;
+    lexer->statement = statement;
+    lexer->parameter_capacity = 0;
+    if (token_is_keyword(token, "insert")) {
+        return parse_insert(lexer, statement);
+    }
+    if (token_is_keyword(token, "select")) {
+        return parse_select(lexer, statement);
+    }
+
+    if (token_is_keyword(token, "begin")) {
+        statement->type = STATEMENT_BEGIN;
+    } else if (token_is_keyword(token, "commit")) {
+        statement->type = STATEMENT_COMMIT;
+    } else if (token_is_keyword(token, "rollback")) {
+        statement->type = STATEMENT_ROLLBACK;
+    } else {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+    lexer_advance(lexer);
+    return token->type == TOKEN_END ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+/* Binds a value, written as a token, to a parameter. A value that does not fit leaves it unbound. */
+PrepareResult bind_parameter(Statement* statement, Parameter* parameter, Token* value) {
+    PrepareResult result;
+    switch (parameter->type) {
+        case (PARAMETER_LITERAL):
+            result = set_literal(parameter->target, value);
+            break;
+        case (PARAMETER_LIKE_PATTERN):
+            result = set_like_pattern(parameter->target, value);
+            break;
+        case (PARAMETER_LIMIT):
+            result = token_to_uint(value, NO_LIMIT - 1, &statement->limit) ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+            break;
+        default:
+            result = set_row_field(&statement->rows[parameter->row_num], parameter->type, value);
+    }
+    parameter->bound = result == PREPARE_SUCCESS;
+    return result;
+}
+
+bool compare_matches(CompareOp op, int comparison) {
+    switch (op) {
+        case (COMPARE_EQ):
+            return comparison == 0;
+        case (COMPARE_NE):
+            return comparison != 0;
+        case (COMPARE_LT):
+            return comparison < 0;
+        case (COMPARE_LE):
+            return comparison <= 0;
+        case (COMPARE_GT):
+            return comparison > 0;
+        case (COMPARE_GE):
+            return comparison >= 0;
+    }
+    return false;
+}
+
+/*
+ * Evaluates the predicate against a row still in its page, reading only the
+ * columns it tests, so rows that do not match are never copied out.
+ */
+bool predicate_matches(Predicate* predicate, void* node, uint32_t cell_num) {
+    switch (predicate->type) {
+        case (PREDICATE_AND):
+            return predicate_matches(predicate->left, node, cell_num) &&
+                   predicate_matches(predicate->right, node, cell_num);
+        case (PREDICATE_OR):
+            return predicate_matches(predicate->left, node, cell_num) ||
+                   predicate_matches(predicate->right, node, cell_num);
+        case (PREDICATE_COMPARE):
+        case (PREDICATE_LIKE_PREFIX):
+            break;
+    }
+    if (predicate->column == COLUMN_ID) {
+        uint32_t id = *leaf_node_key(node, cell_num);
+        int comparison = id < predicate->id_value ? -1 : id > predicate->id_value;
+        return compare_matches(predicate->op, comparison);
+    }
+
+    uint8_t length;
+    const uint8_t* bytes = predicate->column == COLUMN_EMAIL ? leaf_node_email(node, cell_num, &length)
+                                                             : leaf_node_username(node, cell_num, &length);
+    if (predicate->type == PREDICATE_LIKE_PREFIX) {
+        return length >= predicate->string_length && memcmp(bytes, predicate->string_value, predicate->string_length) == 0;
+    }
+    uint8_t common = length < predicate->string_length ? length : predicate->string_length;
+    int comparison = memcmp(bytes, predicate->string_value, common);
+    if (comparison == 0) {
+        comparison = (int)length - (int)predicate->string_length;
+    }
+    return compare_matches(predicate->op, comparison);
+}
+
+/*
+ * The id part of a WHERE clause as a sorted list of disjoint, closed id
+ * ranges. Comparisons on other columns contribute "any id", so every row the
+ * predicate can match falls inside some range. exact is set when the ranges
+ * are the whole predicate and rows inside them need no further test. When
+ * the list would overflow, it collapses to its hull and stops being exact.
+ * IdFilter itself is in simpledb_internal.h, for the kernel tests.
+ */
+
+void id_filter_set(IdFilter* filter, uint32_t low, uint32_t high, bool exact) {
+    filter->num_ranges = low <= high ? 1 : 0;
+    filter->low[0] = low;
+    filter->high[0] = high;
+    filter->exact = exact;
+}
+
+/* Sorts and merges up to count candidate ranges into filter. */
+void id_filter_normalize(IdFilter* filter, uint32_t* low, uint32_t* high, uint32_t count, bool exact) {
+    for (uint32_t i = 1; i < count; ++i) {
+        for (uint32_t j = i; j > 0 && low[j - 1] > low[j]; --j) {
+            uint32_t t = low[j]; low[j] = low[j - 1]; low[j - 1] = t;
+            t = high[j]; high[j] = high[j - 1]; high[j - 1] = t;
+        }
+    }
+    uint32_t merged = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (merged > 0 && (low[i] <= high[merged - 1] || low[i] - 1 == high[merged - 1])) {
+            if (high[i] > high[merged - 1]) {
+                high[merged - 1] = high[i];
+            }
+        } else {
+            low[merged] = low[i];
+            high[merged] = high[i];
+            ++merged;
+        }
+    }
+    if (merged > ID_FILTER_MAX_RANGES) {
+        id_filter_set(filter, low[0], high[merged - 1], false);
+        return;
+    }
+    filter->num_ranges = merged;
+    memcpy(filter->low, low, merged * sizeof(uint32_t));
+    memcpy(filter->high, high, merged * sizeof(uint32_t));
+    filter->exact = exact;
+}
+
+/* Narrows filter down to the ids from low to high. */
+void id_filter_clip(const IdFilter* filter, uint32_t low, uint32_t high, IdFilter* clipped) {
+    uint32_t clipped_low[ID_FILTER_MAX_RANGES];
+    uint32_t clipped_high[ID_FILTER_MAX_RANGES];
+    uint32_t count = 0;
+    for (uint32_t r = 0; r < filter->num_ranges; ++r) {
+        uint32_t l = filter->low[r] > low ? filter->low[r] : low;
+        uint32_t h = filter->high[r] < high ? filter->high[r] : high;
+        if (l <= h) {
+            clipped_low[count] = l;
+            clipped_high[count] = h;
+            ++count;
+        }
+    }
+    id_filter_normalize(clipped, clipped_low, clipped_high, count, filter->exact);
+}
+
+void build_id_filter(Predicate* predicate, IdFilter* filter) {
+    if (predicate == NULL) {
+        id_filter_set(filter, 0, UINT32_MAX, true);
+        return;
+    }
+    IdFilter left;
+    IdFilter right;
+    uint32_t low[ID_FILTER_MAX_RANGES * ID_FILTER_MAX_RANGES];
+    uint32_t high[ID_FILTER_MAX_RANGES * ID_FILTER_MAX_RANGES];
+    uint32_t count = 0;
+    switch (predicate->type) {
+        case (PREDICATE_AND):
+            build_id_filter(predicate->left, &left);
+            build_id_filter(predicate->right, &right);
+            for (uint32_t i = 0; i < left.num_ranges; ++i) {
+                for (uint32_t j = 0; j < right.num_ranges; ++j) {
+                    uint32_t l = left.low[i] > right.low[j] ? left.low[i] : right.low[j];
+                    uint32_t h = left.high[i] < right.high[j] ? left.high[i] : right.high[j];
+                    if (l <= h) {
+                        low[count] = l;
+                        high[count] = h;
+                        ++count;
+                    }
+                }
+            }
+            id_filter_normalize(filter, low, high, count, left.exact && right.exact);
+            return;
+        case (PREDICATE_OR):
+            build_id_filter(predicate->left, &left);
+            build_id_filter(predicate->right, &right);
+            memcpy(low, left.low, left.num_ranges * sizeof(uint32_t));
+            memcpy(high, left.high, left.num_ranges * sizeof(uint32_t));
+            memcpy(low + left.num_ranges, right.low, right.num_ranges * sizeof(uint32_t));
+            memcpy(high + left.num_ranges, right.high, right.num_ranges * sizeof(uint32_t));
+            id_filter_normalize(filter, low, high, left.num_ranges + right.num_ranges, left.exact && right.exact);
+            return;
+        case (PREDICATE_LIKE_PREFIX):
+            id_filter_set(filter, 0, UINT32_MAX, false);
+            return;
+        case (PREDICATE_COMPARE):
+            break;
+    }
+    if (predicate->column != COLUMN_ID) {
+        id_filter_set(filter, 0, UINT32_MAX, false);
+        return;
+    }
+    uint32_t value = predicate->id_value;
+    switch (predicate->op) {
+        case (COMPARE_EQ):
+            id_filter_set(filter, value, value, true);
+            break;
+        case (COMPARE_NE):
+            count = 0;
+            if (value > 0) {
+                low[count] = 0;
+                high[count++] = value - 1;
+            }
+            if (value < UINT32_MAX) {
+                low[count] = value + 1;
+                high[count++] = UINT32_MAX;
+            }
+            id_filter_normalize(filter, low, high, count, true);
+            break;
+        case (COMPARE_LT):
+            id_filter_set(filter, value == 0 ? 1 : 0, value == 0 ? 0 : value - 1, true);
+            break;
+        case (COMPARE_LE):
+            id_filter_set(filter, 0, value, true);
+            break;
+        case (COMPARE_GT):
+            id_filter_set(filter, value == UINT32_MAX ? 1 : value + 1, value == UINT32_MAX ? 0 : UINT32_MAX, true);
+            break;
+        case (COMPARE_GE):
+            id_filter_set(filter, value, UINT32_MAX, true);
+            break;
+    }
+}
+
+/*
+ * Page scan kernels: test the key of every cell in a leaf against an
+ * IdFilter and set one bit per matching cell. In a slotted leaf the keys
+ * sit at a stride of LEAF_NODE_SLOT_SIZE (8) bytes, so the vector versions
+ * load whole slots and pack the key lanes before comparing; a PAX leaf's
+ * id minipage is loaded as is. Unsigned comparison is done as signed
+ * comparison with the sign bit flipped on both sides. PAX rows are the
+ * smaller, so they bound the cells per page (LEAF_NODE_MAX_SLOTS).
+ */
+
+void id_filter_scalar(const uint8_t* keys, uint32_t stride, uint32_t first_slot, uint32_t num_slots,
+                      const IdFilter* filter, uint64_t* bitmap) {
+    for (uint32_t i = first_slot; i < num_slots; ++i) {
+        uint32_t key;
+        memcpy(&key, keys + i * stride, sizeof(uint32_t));
+        for (uint32_t r = 0; r < filter->num_ranges; ++r) {
+            if (key >= filter->low[r] && key <= filter->high[r]) {
+                bitmap[i / 64] |= 1ull << (i % 64);
+                break;
+            }
+        }
+    }
+}
+
+void id_filter_kernel_scalar(const uint8_t* keys, uint32_t stride, uint32_t num_slots, const IdFilter* filter,
+                             uint64_t* bitmap) {
+    memset(bitmap, 0, SLOT_BITMAP_WORDS * sizeof(uint64_t));
+    id_filter_scalar(keys, stride, 0, num_slots, filter, bitmap);
+}
+
+__attribute__((target("sse4.2")))
+void id_filter_kernel_sse42(const uint8_t* keys, uint32_t stride, uint32_t num_slots, const IdFilter* filter,
+                            uint64_t* bitmap) {
+    memset(bitmap, 0, SLOT_BITMAP_WORDS * sizeof(uint64_t));
+    const __m128i sign = _mm_set1_epi32(INT32_MIN);
+    __m128i low[ID_FILTER_MAX_RANGES];
+    __m128i high[ID_FILTER_MAX_RANGES];
+    for (uint32_t r = 0; r < filter->num_ranges; ++r) {
+        low[r] = _mm_xor_si128(_mm_set1_epi32(filter->low[r]), sign);
+        high[r] = _mm_xor_si128(_mm_set1_epi32(filter->high[r]), sign);
+    }
+    uint32_t i = 0;
+    for (; i + 4 <= num_slots; i += 4) {
+        __m128i lanes;
+        if (stride == sizeof(uint32_t)) {
+            lanes = _mm_loadu_si128((const __m128i*)(keys + i * stride));
+        } else {
+            __m128 first = _mm_loadu_ps((const float*)(keys + i * stride));
+            __m128 second = _mm_loadu_ps((const float*)(keys + (i + 2) * stride));
+            lanes = _mm_castps_si128(_mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)));
+        }
+        lanes = _mm_xor_si128(lanes, sign);
+        __m128i match = _mm_setzero_si128();
+        for (uint32_t r = 0; r < filter->num_ranges; ++r) {
+            __m128i outside = _mm_or_si128(_mm_cmpgt_epi32(low[r], lanes), _mm_cmpgt_epi32(lanes, high[r]));
+            match = _mm_or_si128(match, _mm_andnot_si128(outside, _mm_set1_epi32(-1)));
+        }
+        uint64_t bits = _mm_movemask_ps(_mm_castsi128_ps(match));
+        bitmap[i / 64] |= bits << (i % 64);
+    }
+    id_filter_scalar(keys, stride, i, num_slots, filter, bitmap);
+}
+
+__attribute__((target("avx2")))
+void id_filter_kernel_avx2(const uint8_t* keys, uint32_t stride, uint32_t num_slots, const IdFilter* filter,
+                           uint64_t* bitmap) {
+    memset(bitmap, 0, SLOT_BITMAP_WORDS * sizeof(uint64_t));
+    const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+    __m256i low[ID_FILTER_MAX_RANGES];
+    __m256i high[ID_FILTER_MAX_RANGES];
+    for (uint32_t r = 0; r < filter->num_ranges; ++r) {
+        low[r] = _mm256_xor_si256(_mm256_set1_epi32(filter->low[r]), sign);
+        high[r] = _mm256_xor_si256(_mm256_set1_epi32(filter->high[r]), sign);
+    }
+    uint32_t i = 0;
+    for (; i + 8 <= num_slots; i += 8) {
+        __m256i lanes;
+        if (stride == sizeof(uint32_t)) {
+            lanes = _mm256_loadu_si256((const __m256i*)(keys + i * stride));
+        } else {
+            __m256 first = _mm256_loadu_ps((const float*)(keys + i * stride));
+            __m256 second = _mm256_loadu_ps((const float*)(keys + (i + 4) * stride));
+            /* Lanes come out as slots 0 1 4 5 2 3 6 7; the permute restores slot order. */
+            lanes = _mm256_castps_si256(_mm256_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)));
+            lanes = _mm256_permute4x64_epi64(lanes, _MM_SHUFFLE(3, 1, 2, 0));
+        }
+        lanes = _mm256_xor_si256(lanes, sign);
+        __m256i outside_all = _mm256_set1_epi32(-1);
+        for (uint32_t r = 0; r < filter->num_ranges; ++r) {
+            __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(low[r], lanes), _mm256_cmpgt_epi32(lanes, high[r]));
+            outside_all = _mm256_and_si256(outside_all, outside);
+        }
+        uint64_t bits = (~_mm256_movemask_ps(_mm256_castsi256_ps(outside_all))) & 0xFF;
+        bitmap[i / 64] |= bits << (i % 64);
+    }
+    id_filter_scalar(keys, stride, i, num_slots, filter, bitmap);
+}
+
+IdFilterKernel id_filter_kernel = NULL;
+
+/* Picks the widest kernel the CPU supports, once. */
+IdFilterKernel get_id_filter_kernel() {
+    if (id_filter_kernel == NULL) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            id_filter_kernel = id_filter_kernel_avx2;
+        } else if (__builtin_cpu_supports("sse4.2")) {
+            id_filter_kernel = id_filter_kernel_sse42;
+        } else {
+            id_filter_kernel = id_filter_kernel_scalar;
+        }
+    }
+    return id_filter_kernel;
+}
+
+/* Applies and logs an insert; the caller commits *lsn once it may wait for the log. */
+EXECUTE_RESULT apply_insert(Row* row, DbTable* table, uint64_t* lsn) {
+    pthread_mutex_lock(&table->write_lock);
+    if (table->txn != NULL) {
+        pthread_mutex_unlock(&table->write_lock);
+        return EXECUTE_LOCKED;
+    }
+    row->begin_txn = table->next_txn_id;
+    row->end_txn = TXN_ID_MAX;
+    EXECUTE_RESULT result = table_insert(table, row);
+    if (result == EXECUTE_SUCCESS) {
+        ++table->next_txn_id;
+        table_commit(table, row->begin_txn, 1);
+        char record[ROW_MAX_SIZE];
+        uint32_t length = serialize_row(row, record);
+        *lsn = wal_append(table->wal, WAL_RECORD_INSERT, record, length);
+        if (wal_needs_checkpoint(table->wal)) {
+            db_checkpoint(table);
+        }
+    }
+    pthread_mutex_unlock(&table->write_lock);
+    return result;
+}
+
+/*
+ * Explicit transactions. BEGIN makes the session the table's only writer
+ * until COMMIT or ROLLBACK; meanwhile other sessions' writes fail with
+ * EXECUTE_LOCKED rather than wait on a client that may never return. Rows
+ * inserted in the transaction carry its id, which COMMIT publishes, so
+ * other readers skip them until then while the session itself reads at
+ * that id and sees them. COMMIT logs the rows as one record, costing one
+ * log write and fsync however many rows there are. ROLLBACK puts back the
+ * pages the pager shadowed.
+ */
+void init_transaction(Transaction* txn) {
+    txn->active = false;
+    txn->txn_id = 0;
+    txn->rows = 0;
+    txn->redo = NULL;
+    txn->redo_used = 0;
+    txn->redo_capacity = 0;
+}
+
+void free_transaction(Transaction* txn) {
+    free(txn->redo);
+}
+
+EXECUTE_RESULT execute_begin(DbTable* table, Transaction* txn) {
+    if (txn->active) {
+        return EXECUTE_TRANSACTION_OPEN;
+    }
+    pthread_mutex_lock(&table->write_lock);
+    if (table->txn != NULL) {
+        pthread_mutex_unlock(&table->write_lock);
+        return EXECUTE_LOCKED;
+    }
+    table->txn = txn;
+    txn->active = true;
+    txn->txn_id = table->next_txn_id;
+    txn->rows = 0;
+    txn->redo_used = 0;
+    pager_begin_transaction(table->pager);
+    pthread_mutex_unlock(&table->write_lock);
+    return EXECUTE_SUCCESS;
+}
+
+void transaction_log_row(Transaction* txn, Row* row) {
+    if (txn->redo_used + ROW_MAX_SIZE > txn->redo_capacity) {
+        txn->redo_capacity = txn->redo_capacity ? txn->redo_capacity * 2 : WAL_INITIAL_BUFFER_SIZE;
+        txn->redo = checked_realloc(txn->redo, txn->redo_capacity);
+    }
+    txn->redo_used += serialize_row(row, txn->redo + txn->redo_used);
+}
+
+EXECUTE_RESULT transaction_insert(Row* row, DbTable* table, Transaction* txn) {
+    pthread_mutex_lock(&table->write_lock);
+    row->begin_txn = txn->txn_id;
+    row->end_txn = TXN_ID_MAX;
+    EXECUTE_RESULT result = table_insert(table, row);
+    if (result == EXECUTE_SUCCESS) {
+        ++txn->rows;
+        transaction_log_row(txn, row);
+    }
+    pthread_mutex_unlock(&table->write_lock);
+    return result;
+}
+
+/*
+ * Inserts the rows of a multi-row statement in one pass. The rows go in through a bulk
+ * loader, so ascending ids fill the rightmost leaf with one dirty decision
+ * per page. Outside a transaction the statement is a transaction of its
+ * own: the rows share one id and one log record, built in the session's
+ * redo buffer, and if any row fails the pages the statement touched are
+ * put back, so either every row goes in or none does. Inside a
+ * transaction the rows join it, and a failure leaves the rows before it
+ * in place, as separate inserts would.
+ */
+EXECUTE_RESULT apply_insert_batch(Row* rows, uint32_t num_rows, DbTable* table, Transaction* txn, uint64_t* lsn) {
+    pthread_mutex_lock(&table->write_lock);
+    bool implicit = !txn->active;
+    if (implicit && table->txn != NULL) {
+        pthread_mutex_unlock(&table->write_lock);
+        return EXECUTE_LOCKED;
+    }
+    uint64_t txn_id = implicit ? table->next_txn_id : txn->txn_id;
+    if (implicit) {
+        txn->redo_used = 0;
+        pager_begin_transaction(table->pager);
+    }
+
+    BulkLoader loader;
+    bulk_loader_begin(&loader, table);
+    EXECUTE_RESULT result = EXECUTE_SUCCESS;
+    uint32_t inserted = 0;
+    while (inserted < num_rows) {
+        Row* row = &rows[inserted];
+        row->begin_txn = txn_id;
+        row->end_txn = TXN_ID_MAX;
+        result = bulk_loader_add(&loader, row);
+        if (result != EXECUTE_SUCCESS) {
+            break;
+        }
+        transaction_log_row(txn, row);
+        ++inserted;
+    }
+    bulk_loader_end(&loader);
+
+    if (!implicit) {
+        txn->rows += inserted;
+    } else if (result == EXECUTE_SUCCESS) {
+        pager_commit_transaction(table->pager);
+        *lsn = wal_append(table->wal, WAL_RECORD_TRANSACTION, txn->redo, txn->redo_used);
+        ++table->next_txn_id;
+        table_commit(table, txn_id, inserted);
+        if (wal_needs_checkpoint(table->wal)) {
+            db_checkpoint(table);
+        }
+    } else {
+        pthread_rwlock_wrlock(&table->rollback_lock);
+        pager_rollback_transaction(table->pager);
+        pthread_rwlock_unlock(&table->rollback_lock);
+    }
+    pthread_mutex_unlock(&table->write_lock);
+    return result;
+}
+
+/* Inserts the statement's rows outside any transaction and waits until they are durable. */
+EXECUTE_RESULT execute_insert(Statement* statement, DbTable* table) {
+    uint64_t lsn = NO_LSN;
+    EXECUTE_RESULT result;
+    if (statement->num_rows == 1) {
+        result = apply_insert(&statement->rows[0], table, &lsn);
+    } else {
+        Transaction txn;
+        init_transaction(&txn);
+        result = apply_insert_batch(statement->rows, statement->num_rows, table, &txn, &lsn);
+        free_transaction(&txn);
+    }
+    if (lsn != NO_LSN) {
+        wal_commit(table->wal, lsn);
+    }
+    return result;
+}
+
+/* Logs and publishes the transaction; the caller commits *lsn unless it is NO_LSN. */
+EXECUTE_RESULT apply_commit(DbTable* table, Transaction* txn, uint64_t* lsn) {
+    *lsn = NO_LSN;
+    if (!txn->active) {
+        return EXECUTE_NO_TRANSACTION;
+    }
+    pthread_mutex_lock(&table->write_lock);
+    pager_commit_transaction(table->pager);
+    if (txn->rows > 0) {
+        *lsn = wal_append(table->wal, WAL_RECORD_TRANSACTION, txn->redo, txn->redo_used);
+        ++table->next_txn_id;
+        table_commit(table, txn->txn_id, txn->rows);
+    }
+    txn->active = false;
+    table->txn = NULL;
+    if (wal_needs_checkpoint(table->wal)) {
+        db_checkpoint(table);
+    }
+    pthread_mutex_unlock(&table->write_lock);
+    return EXECUTE_SUCCESS;
+}
+
+EXECUTE_RESULT execute_rollback(DbTable* table, Transaction* txn) {
+    if (!txn->active) {
+        return EXECUTE_NO_TRANSACTION;
+    }
+    pthread_mutex_lock(&table->write_lock);
+    table_rollback(table);
+    pthread_mutex_unlock(&table->write_lock);
+    return EXECUTE_SUCCESS;
+}
+
+/*
+ * Scans the rows whose ids fall in filter, adding them to *count and,
+ * unless counting, printing them to output until *count reaches the
+ * statement's LIMIT. Works a leaf at a time: the id filter kernel marks
+ * the candidate slots of the whole page, and only those are tested
+ * against the rest of the predicate and printed. Pure id
+ * predicates need no per-row test, and counting them is a popcount per
+ * page.
+ *
+ * Pages written since the snapshot have rows it must not see, and only on
+ * those pages are the candidates checked one by one. Once a bounded output
+ * sink is past its soft limit, the scan stops after the current leaf and
+ * records in the statement's progress where to pick up. Returns false if
+ * there were no rows at or past the first id to scan.
+ */
+bool scan_range(DbTable* table, Statement* statement, const IdFilter* filter, uint64_t snapshot, OutputSink* output,
+                uint64_t* count) {
+    uint64_t bitmap[SLOT_BITMAP_WORDS];
+    IdFilterKernel kernel = get_id_filter_kernel();
+    uint32_t id_end = filter->high[filter->num_ranges - 1];
+    bool test_rows = statement->where != NULL && !filter->exact;
+    Cursor cursor;
+    DbRowView row;
+
+    table_find(table, filter->low[0], &cursor);
+    if (cursor.end_of_table) {
+        return false;
+    }
+    while (!cursor.end_of_table) {
+        void* node = cursor.node;
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        uint32_t stride;
+        const uint8_t* keys = leaf_node_keys(node, &stride);
+        kernel(keys, stride, num_cells, filter, bitmap);
+        for (uint32_t word = 0; word < SLOT_BITMAP_WORDS; ++word) {
+            if (word * 64 < cursor.cell_num) {
+                bitmap[word] &= cursor.cell_num - word * 64 >= 64 ? 0 : ~0ull << (cursor.cell_num - word * 64);
+            }
+        }
+        if (!leaf_node_all_visible(node, snapshot)) {
+            for (uint32_t word = 0; word < SLOT_BITMAP_WORDS; ++word) {
+                uint64_t bits = bitmap[word];
+                while (bits) {
+                    uint32_t cell_num = word * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+                    if (!leaf_node_row_visible(node, cell_num, snapshot)) {
+                        bitmap[word] &= ~(1ull << (cell_num % 64));
+                    }
+                }
+            }
+        }
+
+        if (statement->count_only && !test_rows) {
+            for (uint32_t word = 0; word < SLOT_BITMAP_WORDS; ++word) {
+                *count += __builtin_popcountll(bitmap[word]);
+            }
+        } else {
+            for (uint32_t word = 0; word < SLOT_BITMAP_WORDS; ++word) {
+                uint64_t bits = bitmap[word];
+                while (bits) {
+                    uint32_t cell_num = word * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+                    if (test_rows && !predicate_matches(statement->where, node, cell_num)) {
+                        continue;
+                    }
+                    ++*count;
+                    if (!statement->count_only) {
+                        leaf_node_row_view(node, cell_num, &row);
+                        print_row(output, &row, statement->columns, statement->num_columns);
+                        if (*count == statement->limit) {
+                            cursor_close(&cursor);
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (num_cells > 0) {
+            uint32_t last_key = *leaf_node_key(node, num_cells - 1);
+            if (last_key >= id_end) {
+                break;
+            }
+            if (output->soft_limit > 0 && output->used > output->soft_limit) {
+                statement->progress.suspended = true;
+                statement->progress.next_id = last_key + 1;
+                break;
+            }
+        }
+        cursor.cell_num = num_cells;
+        cursor_skip_empty_leaves(&cursor);
+    }
+    cursor_close(&cursor);
+    return true;
+}
+
+/*
+ * A parallel scan cuts the id range into morsels along the tree's
+ * separators and hands them to the scan pool, where idle workers steal
+ * morsels from busy ones. Each morsel is printed into its own memory sink;
+ * the calling thread copies the sinks out as they finish, in key order
+ * unless the client turned ordering off.
+ */
+#define SCAN_MORSELS_PER_THREAD 4
+
+typedef struct {
+    uint32_t low;
+    uint32_t high;
+    OutputSink* output;
+    uint64_t count;
+    bool done;
+    bool merged;
+} Morsel;
+
+typedef struct {
+    DbTable* table;
+    Statement* statement;
+    const IdFilter* filter;
+    uint64_t snapshot;
+    Morsel* morsels;
+    pthread_mutex_t lock;
+    pthread_cond_t morsel_done;
+} ParallelScan;
+
+void scan_morsel(void* arg, uint32_t task) {
+    ParallelScan* scan = arg;
+    Morsel* morsel = &scan->morsels[task];
+    IdFilter filter;
+    id_filter_clip(scan->filter, morsel->low, morsel->high, &filter);
+    if (filter.num_ranges > 0) {
+        scan_range(scan->table, scan->statement, &filter, scan->snapshot, morsel->output, &morsel->count);
+    }
+    pthread_mutex_lock(&scan->lock);
+    morsel->done = true;
+    pthread_cond_broadcast(&scan->morsel_done);
+    pthread_mutex_unlock(&scan->lock);
+}
+
+/*
+ * Returns false, having done nothing, when the scan is not worth splitting
+ * or the pool is busy. A LIMIT wants the first rows in order and an early
+ * stop, so those scans are not split either, and neither are scans printing
+ * into a bounded sink, since the morsels' own sinks could not stop early.
+ */
+bool parallel_scan(DbTable* table, Statement* statement, const IdFilter* filter, uint64_t snapshot,
+                   OutputSink* output, uint64_t* count) {
+    ThreadPool* pool = table->scan_pool;
+    uint32_t low = filter->low[0];
+    uint32_t high = filter->high[filter->num_ranges - 1];
+    if (pool == NULL || low == high ||
+        (!statement->count_only && (statement->limit != NO_LIMIT || output->soft_limit > 0))) {
+        return false;
+    }
+    uint32_t max_morsels = pool->num_threads * SCAN_MORSELS_PER_THREAD;
+    uint32_t* bounds = malloc(max_morsels * sizeof(uint32_t));
+    if (bounds == NULL) {
+        return false;
+    }
+    uint32_t num_morsels = table_partition(table, low, high, max_morsels, bounds);
+    if (num_morsels < 2) {
+        free(bounds);
+        return false;
+    }
+
+    ParallelScan scan;
+    scan.table = table;
+    scan.statement = statement;
+    scan.filter = filter;
+    scan.snapshot = snapshot;
+    scan.morsels = malloc(num_morsels * sizeof(Morsel));
+    if (scan.morsels == NULL) {
+        free(bounds);
+        return false;
+    }
+    pthread_mutex_init(&scan.lock, NULL);
+    pthread_cond_init(&scan.morsel_done, NULL);
+    for (uint32_t i = 0; i < num_morsels; ++i) {
+        Morsel* morsel = &scan.morsels[i];
+        morsel->low = bounds[i];
+        morsel->high = i + 1 < num_morsels ? bounds[i + 1] - 1 : high;
+        morsel->output = statement->count_only ? NULL : new_memory_sink(output->format);
+        morsel->count = 0;
+        morsel->done = false;
+        morsel->merged = false;
+    }
+    free(bounds);
+    if (!thread_pool_begin(pool, num_morsels, scan_morsel, &scan)) {
+        for (uint32_t i = 0; i < num_morsels; ++i) {
+            if (scan.morsels[i].output != NULL) {
+                free_output_sink(scan.morsels[i].output);
+            }
+        }
+        free(scan.morsels);
+        pthread_mutex_destroy(&scan.lock);
+        pthread_cond_destroy(&scan.morsel_done);
+        return false;
+    }
+
+    pthread_mutex_lock(&scan.lock);
+    for (uint32_t merged = 0; merged < num_morsels; ++merged) {
+        Morsel* ready = NULL;
+        while (ready == NULL) {
+            for (uint32_t i = 0; i < num_morsels; ++i) {
+                Morsel* morsel = &scan.morsels[i];
+                if (!morsel->merged && (morsel->done || output->ordered)) {
+                    ready = morsel;
+                    break;
+                }
+            }
+            if (ready == NULL || !ready->done) {
+                ready = NULL;
+                pthread_cond_wait(&scan.morsel_done, &scan.lock);
+            }
+        }
+        ready->merged = true;
+        pthread_mutex_unlock(&scan.lock);
+        *count += ready->count;
+        if (ready->output != NULL) {
+            sink_write_block(output, ready->output->buffer, ready->output->used);
+            free_output_sink(ready->output);
+        }
+        pthread_mutex_lock(&scan.lock);
+    }
+    pthread_mutex_unlock(&scan.lock);
+    thread_pool_finish(pool);
+
+    free(scan.morsels);
+    pthread_mutex_destroy(&scan.lock);
+    pthread_cond_destroy(&scan.morsel_done);
+    return true;
+}
+
+/*
+ * Answers a select through the username index: each id filed under the
+ * key's hash is looked up in the tree, and its row kept if the snapshot
+ * sees it and it passes the whole predicate, which also weeds out hash
+ * collisions. The ids are sorted first so rows come out in id order, and
+ * those below first_id are skipped. Like scan_range, it stops early for a
+ * bounded sink past its soft limit.
+ */
+void index_select(DbTable* table, Statement* statement, Predicate* key, uint32_t first_id, uint64_t snapshot,
+                  OutputSink* output, uint64_t* count) {
+    uint32_t* ids = NULL;
+    uint32_t capacity = 0;
+    uint32_t num_ids = hash_index_lookup(table, key->string_value, key->string_length, &ids, &capacity);
+    qsort(ids, num_ids, sizeof(uint32_t), compare_keys);
+    DbRowView row;
+    for (uint32_t i = 0; i < num_ids && (statement->count_only || *count < statement->limit); ++i) {
+        if (ids[i] < first_id) {
+            continue;
+        }
+        if (output->soft_limit > 0 && output->used > output->soft_limit) {
+            statement->progress.suspended = true;
+            statement->progress.next_id = ids[i];
+            break;
+        }
+        Cursor cursor;
+        table_find(table, ids[i], &cursor);
+        if (!cursor.end_of_table && cursor_key(&cursor) == ids[i]) {
+            if (leaf_node_row_visible(cursor.node, cursor.cell_num, snapshot) &&
+                predicate_matches(statement->where, cursor.node, cursor.cell_num)) {
+                ++*count;
+                if (!statement->count_only) {
+                    leaf_node_row_view(cursor.node, cursor.cell_num, &row);
+                    print_row(output, &row, statement->columns, statement->num_columns);
+                }
+            }
+        }
+        cursor_close(&cursor);
+    }
+    free(ids);
+}
+
+/*
+ * Seeks to the lowest id the WHERE clause allows and scans up to the
+ * highest, splitting the range across the scan pool when there is one.
+ * A clause that pins down the username is answered from the username
+ * index instead.
+ * The scan reads the snapshot taken when it starts, or inside a
+ * transaction (txn may be NULL) the transaction's own rows as well.
+ *
+ * A select that stopped early for a bounded sink returns EXECUTE_SUSPENDED;
+ * running it again resumes it from its progress.
+ */
+EXECUTE_RESULT execute_select(Statement* statement, DbTable* table, Transaction* txn, OutputSink* output) {
+    IdFilter filter;
+    SelectProgress* progress = &statement->progress;
+    bool resuming = progress->suspended;
+    bool in_transaction = txn != NULL && txn->active;
+    uint64_t snapshot = resuming ? progress->snapshot : in_transaction ? txn->txn_id : table_snapshot(table);
+    uint64_t count = resuming ? progress->count : 0;
+    progress->suspended = false;
+
+    if (statement->limit == 0) {
+        return EXECUTE_SUCCESS;
+    }
+    if (statement->count_only && statement->where == NULL) {
+        uint64_t rows = __atomic_load_n(&table->num_rows, __ATOMIC_RELAXED);
+        print_count(output, in_transaction ? rows + txn->rows : rows);
+        sink_flush(output);
+        return EXECUTE_SUCCESS;
+    }
+    build_id_filter(statement->where, &filter);
+    if (resuming) {
+        id_filter_clip(&filter, progress->next_id, UINT32_MAX, &filter);
+    }
+    if (filter.num_ranges == 0) {
+        if (statement->count_only) {
+            print_count(output, 0);
+            sink_flush(output);
+        }
+        return EXECUTE_SUCCESS;
+    }
+    get_id_filter_kernel();
+
+    pthread_rwlock_rdlock(&table->rollback_lock);
+    bool found = true;
+    if (statement->index_key != NULL) {
+        index_select(table, statement, statement->index_key, filter.low[0], snapshot, output, &count);
+    } else {
+        found = parallel_scan(table, statement, &filter, snapshot, output, &count) ||
+                scan_range(table, statement, &filter, snapshot, output, &count);
+    }
+    pthread_rwlock_unlock(&table->rollback_lock);
+    if (progress->suspended) {
+        progress->snapshot = snapshot;
+        progress->count = count;
+        return EXECUTE_SUSPENDED;
+    }
+    if (!found && !resuming && statement->where == NULL && !statement->count_only) {
+        return EXECUTE_TABLE_EMPTY;
+    }
+    if (statement->count_only) {
+        print_count(output, count);
+    }
+    sink_flush(output);
+    return EXECUTE_SUCCESS;
+}
+
+/*
+ * Runs a statement for a session up to the point where it would wait for
+ * the log, leaving in *lsn the record to commit before acknowledging it,
+ * or NO_LSN.
+ */
+EXECUTE_RESULT apply_statement(Statement* statement, DbTable* table, Transaction* txn, OutputSink* output,
+                               uint64_t* lsn) {
+    *lsn = NO_LSN;
+    switch (statement->type) {
+    case (STATEMENT_INSERT):
+        if (statement->num_rows > 1) {
+            return apply_insert_batch(statement->rows, statement->num_rows, table, txn, lsn);
+        }
+        return txn->active ? transaction_insert(&statement->rows[0], table, txn)
+                           : apply_insert(&statement->rows[0], table, lsn);
+    case (STATEMENT_SELECT):
+        return execute_select(statement, table, txn, output);
+    case (STATEMENT_BEGIN):
+        return execute_begin(table, txn);
+    case (STATEMENT_COMMIT):
+        return apply_commit(table, txn, lsn);
+    case (STATEMENT_ROLLBACK):
+        return execute_rollback(table, txn);
+    case (STATEMENT_PREPARE):
+    case (STATEMENT_DEALLOCATE):
+        /* Carried out when the line was parsed. */
+        return EXECUTE_SUCCESS;
+    }
+    db_fatal("Unknown statement type %d.", statement->type);
+}
+
+EXECUTE_RESULT execute_statement(Statement* statement, DbTable* table, Transaction* txn, OutputSink* output) {
+    uint64_t lsn;
+    EXECUTE_RESULT result = apply_statement(statement, table, txn, output, &lsn);
+    if (lsn != NO_LSN) {
+        wal_commit(table->wal, lsn);
+    }
+    return result;
+}
+
+/*
+ * Prepared statements. Preparing parses and plans a statement once, into
+ * an arena of its own; each execution binds values straight into the
+ * parsed rows and literals and runs the same Statement again. A session
+ * keeps its named statements, from PREPARE, in a PlanCache: a small hash
+ * table that lives as long as the session. db_prepare, db_bind_* and
+ * db_step offer the same to C callers, with parameters numbered from 1.
+ */
+#define PREPARED_NAME_SIZE 32
+
+struct PreparedStatement {
+    char name[PREPARED_NAME_SIZE + 1];
+    Statement* statement;
+    Arena arena;
+    struct PreparedStatement* next;
+};
+
+void free_prepared(PreparedStatement* prepared) {
+    arena_free(&prepared->arena);
+    free(prepared);
+}
+
+/* Parses and plans text, which runs from the lexer's current token to the end of the line. */
+PrepareResult prepare_from(Lexer* lexer, PreparedStatement** result) {
+    PreparedStatement* prepared = checked_malloc(sizeof(PreparedStatement));
+    prepared->name[0] = 0;
+    prepared->next = NULL;
+    arena_init(&prepared->arena);
+    prepared->statement = create_statement(&prepared->arena);
+    lexer->arena = &prepared->arena;
+    PrepareResult status = parse_statement(lexer, prepared->statement);
+    if (status != PREPARE_SUCCESS) {
+        free_prepared(prepared);
+        prepared = NULL;
+    }
+    *result = prepared;
+    return status;
+}
+
+PrepareResult prepared_bind_text(PreparedStatement* prepared, uint32_t index, const char* text, size_t length) {
+    if (index == 0 || index > prepared->statement->num_parameters) {
+        return PREPARE_PARAMETER_COUNT;
+    }
+    Token value;
+    value.type = TOKEN_WORD;
+    value.start = text;
+    value.length = length;
+    value.quote = 0;
+    return bind_parameter(prepared->statement, &prepared->statement->parameters[index - 1], &value);
+}
+
+PrepareResult prepared_bind_int(PreparedStatement* prepared, uint32_t index, int64_t value) {
+    char text[24];
+    int length = snprintf(text, sizeof(text), "%lld", (long long)value);
+    return prepared_bind_text(prepared, index, text, length);
+}
+
+bool prepared_fully_bound(PreparedStatement* prepared) {
+    Statement* statement = prepared->statement;
+    for (uint32_t i = 0; i < statement->num_parameters; ++i) {
+        if (!statement->parameters[i].bound) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void init_plan_cache(PlanCache* plans) {
+    memset(plans->buckets, 0, sizeof(plans->buckets));
+}
+
+void free_plan_cache(PlanCache* plans) {
+    for (uint32_t i = 0; i < PLAN_CACHE_BUCKETS; ++i) {
+        while (plans->buckets[i] != NULL) {
+            PreparedStatement* next = plans->buckets[i]->next;
+            free_prepared(plans->buckets[i]);
+            plans->buckets[i] = next;
+        }
+    }
+}
+
+/* Returns the link that points, or would point, at the statement called name. */
+PreparedStatement** plan_cache_find(PlanCache* plans, Token* name) {
+    PreparedStatement** link = &plans->buckets[crc32(name->start, name->length) % PLAN_CACHE_BUCKETS];
+    while (*link != NULL && (strlen((*link)->name) != name->length ||
+                             memcmp((*link)->name, name->start, name->length) != 0)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+/* PREPARE name AS statement: replaces any statement of the same name. */
+PrepareResult prepare_named(Lexer* lexer, PlanCache* plans) {
+    Token name = lexer->current;
+    if (name.type != TOKEN_WORD) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (name.length > PREPARED_NAME_SIZE) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    lexer_advance(lexer);
+    if (!token_is_keyword(&lexer->current, "as")) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    lexer_advance(lexer);
+    PreparedStatement* prepared;
+    PrepareResult result = prepare_from(lexer, &prepared);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    memcpy(prepared->name, name.start, name.length);
+    prepared->name[name.length] = 0;
+    PreparedStatement** link = plan_cache_find(plans, &name);
+    if (*link != NULL) {
+        prepared->next = (*link)->next;
+        free_prepared(*link);
+    }
+    *link = prepared;
+    return PREPARE_SUCCESS;
+}
+
+/* EXECUTE name [(value, ...)]: binds every parameter and hands back the prepared statement. */
+PrepareResult execute_named(Lexer* lexer, PlanCache* plans, Statement* statement) {
+    Token* token = &lexer->current;
+    PreparedStatement* prepared = token->type == TOKEN_WORD ? *plan_cache_find(plans, token) : NULL;
+    if (prepared == NULL) {
+        return token->type == TOKEN_WORD ? PREPARE_UNKNOWN_PREPARED : PREPARE_SYNTAX_ERROR;
+    }
+    Statement* prepared_statement = prepared->statement;
+    uint32_t num_values = 0;
+    lexer_advance(lexer);
+    if (token->type == TOKEN_LEFT_PAREN) {
+        const char* values = lexer->position;
+        lexer_advance(lexer);
+        if (token->type != TOKEN_RIGHT_PAREN) {
+            lexer->position = values;
+            do {
+                lexer_advance_value(lexer, "(,)");
+                if (token->type != TOKEN_WORD && token->type != TOKEN_STRING) {
+                    return PREPARE_SYNTAX_ERROR;
+                }
+                if (token->length == 0 && !token->quote) {
+                    return PREPARE_SYNTAX_ERROR;
+                }
+                if (num_values == prepared_statement->num_parameters) {
+                    return PREPARE_PARAMETER_COUNT;
+                }
+                PrepareResult result =
+                    bind_parameter(prepared_statement, &prepared_statement->parameters[num_values++], token);
+                if (result != PREPARE_SUCCESS) {
+                    return result;
+                }
+                lexer_advance(lexer);
+            } while (token->type == TOKEN_COMMA);
+            if (token->type != TOKEN_RIGHT_PAREN) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+        }
+        lexer_advance(lexer);
+    }
+    if (token->type != TOKEN_END) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (num_values != prepared_statement->num_parameters) {
+        return PREPARE_PARAMETER_COUNT;
+    }
+    *statement = *prepared_statement;
+    return PREPARE_SUCCESS;
+}
+
+/*
+ * Parses a line into statement, allocating its parts from arena. PREPARE
+ * and DEALLOCATE update the session's plans right here; EXECUTE leaves a
+ * copy of the prepared statement, its parameters bound, in statement.
+ */
+PrepareResult prepare_statement(const char* line, Statement* statement, Arena* arena, PlanCache* plans) {
+    Lexer lexer;
+    lexer.position = line;
+    lexer.arena = arena;
+    lexer_advance(&lexer);
+    Token* token = &lexer.current;
+    if (token_is_keyword(token, "prepare")) {
+        statement->type = STATEMENT_PREPARE;
+        lexer_advance(&lexer);
+        return prepare_named(&lexer, plans);
+    }
+    if (token_is_keyword(token, "execute")) {
+        lexer_advance(&lexer);
+        return execute_named(&lexer, plans, statement);
+    }
+    if (token_is_keyword(token, "deallocate")) {
+        statement->type = STATEMENT_DEALLOCATE;
+        lexer_advance(&lexer);
+        Token name = *token;
+        lexer_advance(&lexer);
+        if (name.type != TOKEN_WORD || token->type != TOKEN_END) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        PreparedStatement** link = plan_cache_find(plans, &name);
+        if (*link == NULL) {
+            return PREPARE_UNKNOWN_PREPARED;
+        }
+        PreparedStatement* prepared = *link;
+        *link = prepared->next;
+        free_prepared(prepared);
+        return PREPARE_SUCCESS;
+    }
+
+    PrepareResult result = parse_statement(&lexer, statement);
+    if (result == PREPARE_SUCCESS && statement->num_parameters > 0) {
+        return PREPARE_PARAMETER_COUNT;
+    }
+    return result;
+}
+
+/*
+ * The library interface declared in simpledb.h. It calls the engine
+ * directly: no statement text, no parsing and no printing.
+ */
+const char* db_result_message(DbResult result) {
+    switch (result) {
+        case (DB_SUCCESS):
+            return "Success.";
+        case (DB_CANNOT_OPEN):
+            return "Unable to open file";
+        case (DB_NOT_A_DATABASE):
+            return "Not a simpledb database file.";
+        case (DB_UNSUPPORTED_FORMAT):
+            return "Unsupported database format version.";
+        case (DB_CORRUPT):
+            return "Corrupt file.";
+        case (DB_INVALID_OPTIONS):
+            return "Invalid options: the buffer pool needs at least 40 frames, and a compressed file cannot be mapped.";
+        case (DB_OUT_OF_MEMORY):
+            return "Out of memory.";
+        case (DB_INVALID_ID):
+            return "ID must be positive.";
+        case (DB_STRING_TOO_LONG):
+            return "String is too long.";
+        case (DB_DUPLICATE_KEY):
+            return "Duplicate key.";
+        case (DB_NOT_FOUND):
+            return "Not found.";
+        case (DB_LOCKED):
+            return "Database is locked by an open transaction.";
+        case (DB_SYNTAX_ERROR):
+            return "Syntax error.";
+        case (DB_PARAMETER_COUNT):
+            return "Wrong number of parameters.";
+        case (DB_UNBOUND_PARAMETER):
+            return "A parameter has no value bound.";
+        case (DB_UNSUPPORTED_STATEMENT):
+            return "Only inserts and selects of rows can be prepared.";
+        case (DB_ERROR):
+            return "The operation failed.";
+        case (DB_ROW):
+            return "A row is ready.";
+        case (DB_DONE):
+            return "The statement has finished.";
+    }
+    return "Unknown result.";
+}
+
+/* Results the library cannot produce still map to DB_ERROR rather than to a misleading code. */
+DbResult db_result_from_execute(EXECUTE_RESULT result) {
+    switch (result) {
+        case (EXECUTE_SUCCESS):
+            return DB_SUCCESS;
+        case (EXECUTE_DUPLICATE_KEY):
+            return DB_DUPLICATE_KEY;
+        case (EXECUTE_LOCKED):
+            return DB_LOCKED;
+        case (EXECUTE_TABLE_EMPTY):
+        case (EXECUTE_TABLE_FULL):
+        case (EXECUTE_TRANSACTION_OPEN):
+        case (EXECUTE_NO_TRANSACTION):
+        case (EXECUTE_SUSPENDED):
+            return DB_ERROR;
+        case (EXECUTE_UNBOUND_PARAMETER):
+            return DB_UNBOUND_PARAMETER;
+    }
+    return DB_ERROR;
+}
+
+DbResult db_result_from_prepare(PrepareResult result) {
+    switch (result) {
+        case (PREPARE_SUCCESS):
+            return DB_SUCCESS;
+        case (PREPARE_NEGATIVE_ID):
+        case (PREPARE_NOT_ID):
+            return DB_INVALID_ID;
+        case (PREPARE_STRING_TOO_LONG):
+            return DB_STRING_TOO_LONG;
+        case (PREPARE_STRING_NOT_RIGHT):
+        case (PREPARE_SYNTAX_ERROR):
+        case (PREPARE_UNRECOGNIZED_STATEMENT):
+            return DB_SYNTAX_ERROR;
+        case (PREPARE_PARAMETER_COUNT):
+            return DB_PARAMETER_COUNT;
+        case (PREPARE_UNKNOWN_PREPARED):
+            return DB_ERROR;
+    }
+    return DB_ERROR;
+}
+
+DbResult set_row(Row* row, uint32_t id, const char* username, size_t username_length, const char* email,
+                 size_t email_length) {
+    if (id == 0) {
+        return DB_INVALID_ID;
+    }
+    if (username_length > DB_USERNAME_SIZE || email_length > DB_EMAIL_SIZE) {
+        return DB_STRING_TOO_LONG;
+    }
+    row->id = id;
+    memcpy(row->username, username, username_length);
+    row->username[username_length] = 0;
+    memcpy(row->email, email, email_length);
+    row->email[email_length] = 0;
+    return DB_SUCCESS;
+}
+
+/* Inserts rows the way the insert statement does, one row or an atomic batch. */
+DbResult db_insert_statement(DbTable* table, Row* rows, uint32_t num_rows) {
+    Statement statement;
+    init_statement(&statement);
+    statement.type = STATEMENT_INSERT;
+    statement.rows = rows;
+    statement.num_rows = num_rows;
+    return db_result_from_execute(execute_insert(&statement, table));
+}
+
+DbResult db_insert(DbTable* table, uint32_t id, const char* username, const char* email) {
+    Row row;
+    DbResult result = set_row(&row, id, username, strlen(username), email, strlen(email));
+    if (result != DB_SUCCESS) {
+        return result;
+    }
+    return db_insert_statement(table, &row, 1);
+}
+
+DbResult db_insert_rows(DbTable* table, const DbRowView* rows, uint32_t num_rows) {
+    if (num_rows == 0) {
+        return DB_SUCCESS;
+    }
+    Row* copies = malloc((size_t)num_rows * sizeof(Row));
+    if (copies == NULL) {
+        return DB_OUT_OF_MEMORY;
+    }
+    DbResult result = DB_SUCCESS;
+    for (uint32_t i = 0; i < num_rows && result == DB_SUCCESS; ++i) {
+        result = set_row(&copies[i], rows[i].id, rows[i].username, rows[i].username_length, rows[i].email,
+                         rows[i].email_length);
+    }
+    if (result == DB_SUCCESS) {
+        result = db_insert_statement(table, copies, num_rows);
+    }
+    free(copies);
+    return result;
+}
+
+DbResult db_lookup(DbTable* table, uint32_t id, DbRow* row) {
+    uint64_t snapshot = table_snapshot(table);
+    Cursor cursor;
+    pthread_rwlock_rdlock(&table->rollback_lock);
+    table_find(table, id, &cursor);
+    bool found = !cursor.end_of_table && cursor_key(&cursor) == id &&
+                 leaf_node_row_visible(cursor.node, cursor.cell_num, snapshot);
+    if (found) {
+        Row stored;
+        leaf_node_read_row(cursor.node, cursor.cell_num, &stored);
+        row->id = stored.id;
+        memcpy(row->username, stored.username, sizeof(row->username));
+        memcpy(row->email, stored.email, sizeof(row->email));
+    }
+    cursor_close(&cursor);
+    pthread_rwlock_unlock(&table->rollback_lock);
+    return found ? DB_SUCCESS : DB_NOT_FOUND;
+}
+
+uint64_t db_count(DbTable* table) {
+    return __atomic_load_n(&table->num_rows, __ATOMIC_RELAXED);
+}
+
+/*
+ * A library cursor reads from a private copy of one leaf, so it pins and
+ * latches nothing between calls. Once the copy runs out it finds the leaf
+ * after the last id it returned. A username cursor instead walks the ids
+ * the hash index gave it, loading the leaf of each in turn.
+ */
+struct DbCursor {
+    DbTable* table;
+    uint64_t snapshot;
+    void* leaf;
+    uint32_t cell_num;
+    uint32_t high;
+    bool done;
+    Predicate* where;
+    bool by_username;
+    uint32_t* ids;
+    uint32_t num_ids;
+    uint32_t next_index;
+    char username[DB_USERNAME_SIZE];
+    uint8_t username_length;
+};
+
+/* Returns NULL if there is no memory for the cursor. */
+DbCursor* new_db_cursor(DbTable* table) {
+    DbCursor* cursor = calloc(1, sizeof(DbCursor));
+    void* leaf = malloc(PAGE_SIZE);
+    if (cursor == NULL || leaf == NULL) {
+        free(cursor);
+        free(leaf);
+        return NULL;
+    }
+    cursor->table = table;
+    cursor->snapshot = table_snapshot(table);
+    cursor->leaf = leaf;
+    return cursor;
+}
+
+/* Copies in the leaf holding the first row with id >= key; false past the last row. */
+bool db_cursor_load(DbCursor* cursor, uint32_t key) {
+    DbTable* table = cursor->table;
+    Cursor position;
+    pthread_rwlock_rdlock(&table->rollback_lock);
+    table_find(table, key, &position);
+    bool found = !position.end_of_table;
+    if (found) {
+        memcpy(cursor->leaf, position.node, PAGE_SIZE);
+        cursor->cell_num = position.cell_num;
+    }
+    cursor_close(&position);
+    pthread_rwlock_unlock(&table->rollback_lock);
+    return found;
+}
+
+DbResult db_scan(DbTable* table, uint32_t low, uint32_t high, DbCursor** result) {
+    DbCursor* cursor = new_db_cursor(table);
+    *result = cursor;
+    if (cursor == NULL) {
+        return DB_OUT_OF_MEMORY;
+    }
+    cursor->high = high;
+    cursor->done = low > high || !db_cursor_load(cursor, low);
+    return DB_SUCCESS;
+}
+
+DbCursor* open_username_cursor(DbTable* table, const char* username, size_t length) {
+    DbCursor* cursor = new_db_cursor(table);
+    if (cursor == NULL) {
+        return NULL;
+    }
+    cursor->by_username = true;
+    if (length <= DB_USERNAME_SIZE) {
+        uint32_t capacity = 0;
+        pthread_rwlock_rdlock(&table->rollback_lock);
+        cursor->num_ids = hash_index_lookup(table, username, length, &cursor->ids, &capacity);
+        pthread_rwlock_unlock(&table->rollback_lock);
+        qsort(cursor->ids, cursor->num_ids, sizeof(uint32_t), compare_keys);
+        memcpy(cursor->username, username, length);
+        cursor->username_length = length;
+    }
+    return cursor;
+}
+
+DbResult db_find_username(DbTable* table, const char* username, DbCursor** result) {
+    *result = open_username_cursor(table, username, strlen(username));
+    return *result != NULL ? DB_SUCCESS : DB_OUT_OF_MEMORY;
+}
+
+bool db_scan_next(DbCursor* cursor, DbRowView* row) {
+    while (!cursor->done) {
+        void* leaf = cursor->leaf;
+        uint32_t num_cells = *leaf_node_num_cells(leaf);
+        if (cursor->cell_num == num_cells) {
+            uint32_t last_key = *leaf_node_key(leaf, num_cells - 1);
+            cursor->done = last_key >= cursor->high || !db_cursor_load(cursor, last_key + 1);
+            continue;
+        }
+        uint32_t cell_num = cursor->cell_num++;
+        if (*leaf_node_key(leaf, cell_num) > cursor->high) {
+            cursor->done = true;
+        } else if (leaf_node_row_visible(leaf, cell_num, cursor->snapshot) &&
+                   (cursor->where == NULL || predicate_matches(cursor->where, leaf, cell_num))) {
+            leaf_node_row_view(leaf, cell_num, row);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool db_find_username_next(DbCursor* cursor, DbRowView* row) {
+    while (cursor->next_index < cursor->num_ids) {
+        uint32_t id = cursor->ids[cursor->next_index++];
+        if (!db_cursor_load(cursor, id)) {
+            continue;
+        }
+        void* leaf = cursor->leaf;
+        if (*leaf_node_key(leaf, cursor->cell_num) != id ||
+            !leaf_node_row_visible(leaf, cursor->cell_num, cursor->snapshot) ||
+            (cursor->where != NULL && !predicate_matches(cursor->where, leaf, cursor->cell_num))) {
+            continue;
+        }
+        leaf_node_row_view(leaf, cursor->cell_num, row);
+        if (row->username_length == cursor->username_length &&
+            memcmp(row->username, cursor->username, row->username_length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool db_cursor_next(DbCursor* cursor, DbRowView* row) {
+    return cursor->by_username ? db_find_username_next(cursor, row) : db_scan_next(cursor, row);
+}
+
+void db_cursor_close(DbCursor* cursor) {
+    free(cursor->ids);
+    free(cursor->leaf);
+    free(cursor);
+}
+
+/*
+ * A library statement wraps a PreparedStatement. A select runs as a cursor
+ * that also tests the WHERE clause, over the username index when the plan
+ * has a key and otherwise over the span of ids the clause allows; the
+ * cursor is opened by the first db_step and closed by db_reset.
+ */
+struct DbStatement {
+    DbTable* table;
+    PreparedStatement* prepared;
+    DbCursor* cursor;
+    uint64_t num_returned;
+};
+
+DbCursor* open_select_cursor(DbTable* table, Statement* statement) {
+    Predicate* key = statement->index_key;
+    DbCursor* cursor = key != NULL ? open_username_cursor(table, key->string_value, key->string_length)
+                                   : new_db_cursor(table);
+    if (cursor == NULL) {
+        return NULL;
+    }
+    if (key == NULL) {
+        IdFilter filter;
+        build_id_filter(statement->where, &filter);
+        if (filter.num_ranges == 0) {
+            cursor->done = true;
+        } else {
+            cursor->high = filter.high[filter.num_ranges - 1];
+            cursor->done = !db_cursor_load(cursor, filter.low[0]);
+        }
+    }
+    cursor->where = statement->where;
+    return cursor;
+}
+
+DbResult db_prepare(DbTable* table, const char* sql, DbStatement** result) {
+    *result = NULL;
+    Lexer lexer;
+    lexer.position = sql;
+    lexer_advance(&lexer);
+    PreparedStatement* prepared;
+    PrepareResult status = prepare_from(&lexer, &prepared);
+    if (status != PREPARE_SUCCESS) {
+        return db_result_from_prepare(status);
+    }
+    Statement* parsed = prepared->statement;
+    if (parsed->type != STATEMENT_INSERT && (parsed->type != STATEMENT_SELECT || parsed->count_only)) {
+        free_prepared(prepared);
+        return DB_UNSUPPORTED_STATEMENT;
+    }
+    DbStatement* statement = malloc(sizeof(DbStatement));
+    if (statement == NULL) {
+        free_prepared(prepared);
+        return DB_OUT_OF_MEMORY;
+    }
+    statement->table = table;
+    statement->prepared = prepared;
+    statement->cursor = NULL;
+    statement->num_returned = 0;
+    *result = statement;
+    return DB_SUCCESS;
+}
+
+DbResult db_bind_int(DbStatement* statement, uint32_t index, int64_t value) {
+    db_reset(statement);
+    return db_result_from_prepare(prepared_bind_int(statement->prepared, index, value));
+}
+
+DbResult db_bind_text(DbStatement* statement, uint32_t index, const char* text) {
+    db_reset(statement);
+    return db_result_from_prepare(prepared_bind_text(statement->prepared, index, text, strlen(text)));
+}
+
+DbResult db_step(DbStatement* statement, DbRowView* row) {
+    Statement* parsed = statement->prepared->statement;
+    if (statement->cursor == NULL) {
+        if (!prepared_fully_bound(statement->prepared)) {
+            return DB_UNBOUND_PARAMETER;
+        }
+        if (parsed->type == STATEMENT_INSERT) {
+            DbResult result = db_insert_statement(statement->table, parsed->rows, parsed->num_rows);
+            return result == DB_SUCCESS ? DB_DONE : result;
+        }
+        statement->cursor = open_select_cursor(statement->table, parsed);
+        if (statement->cursor == NULL) {
+            return DB_OUT_OF_MEMORY;
+        }
+    }
+    if (statement->num_returned < parsed->limit && db_cursor_next(statement->cursor, row)) {
+        ++statement->num_returned;
+        return DB_ROW;
+    }
+    db_reset(statement);
+    return DB_DONE;
+}
+
+void db_reset(DbStatement* statement) {
+    if (statement->cursor != NULL) {
+        db_cursor_close(statement->cursor);
+        statement->cursor = NULL;
+    }
+    statement->num_returned = 0;
+}
+
+void db_finalize(DbStatement* statement) {
+    db_reset(statement);
+    free_prepared(statement->prepared);
+    free(statement);
+}
@@ -0,0 +1,148 @@
+/*
+ * simpledb: an embeddable database holding one table of (id, username,
+ * email) rows. This header is the library's whole public interface; the
+ * library exports nothing else. Every function may be called from any
+ * thread, and any number of cursors may be open while rows are inserted.
+ *
+ * Failures a caller can act on come back as DbResult codes. An I/O error
+ * or damage found in the middle of an operation leaves the engine with
+ * pages it can no longer trust, so those go to the fatal handler instead,
+ * which by default reports them on stderr and aborts.
+ */
+#ifndef SIMPLEDB_H
+#define SIMPLEDB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SIMPLEDB_API __attribute__((visibility("default")))
+
+#define DB_USERNAME_SIZE 32
+#define DB_EMAIL_SIZE 255
+
+typedef struct DbTable DbTable;
+typedef struct DbCursor DbCursor;
+typedef struct DbStatement DbStatement;
+
+typedef enum {
+    DB_SUCCESS,
+    DB_CANNOT_OPEN,
+    DB_NOT_A_DATABASE,
+    DB_UNSUPPORTED_FORMAT,
+    DB_CORRUPT,
+    DB_INVALID_OPTIONS,
+    DB_OUT_OF_MEMORY,
+    DB_INVALID_ID,
+    DB_STRING_TOO_LONG,
+    DB_DUPLICATE_KEY,
+    DB_NOT_FOUND,
+    DB_LOCKED,
+    DB_SYNTAX_ERROR,
+    DB_PARAMETER_COUNT,
+    DB_UNBOUND_PARAMETER,
+    DB_UNSUPPORTED_STATEMENT,
+    DB_ERROR,
+    DB_ROW,
+    DB_DONE
+} DbResult;
+
+/* A row, copied out. */
+typedef struct {
+    uint32_t id;
+    char username[DB_USERNAME_SIZE + 1];
+    char email[DB_EMAIL_SIZE + 1];
+} DbRow;
+
+/*
+ * A read-only view of a row where it is stored: the id plus spans pointing
+ * into the page. The strings are not terminated. A view is valid only while
+ * its page stays pinned and latched; one returned by db_cursor_next, until
+ * the next call on that cursor.
+ */
+typedef struct {
+    uint32_t id;
+    const char* username;
+    uint8_t username_length;
+    const char* email;
+    uint8_t email_length;
+} DbRowView;
+
+typedef enum {
+    DB_PAGER_MODE_BUFFERED,
+    DB_PAGER_MODE_MMAP
+} DbPagerMode;
+
+/*
+ * pool_frames sizes the buffered pager's pool. db_open rejects pools of
+ * fewer than 40 frames, which a single insert could run out of.
+ * scan_threads of 0 or 1 scans serially; more than 64 are capped at 64.
+ */
+typedef struct {
+    DbPagerMode pager_mode;
+    uint32_t pool_frames;
+    uint32_t commit_interval_ms;
+    uint32_t scan_threads;
+    bool compress;
+    bool pax;
+} DbOptions;
+
+typedef void (*DbFatalHandler)(const char* message);
+
+SIMPLEDB_API DbOptions db_default_options(void);
+
+/*
+ * Opens or creates the database at filename, recovering it from its log if
+ * need be. NULL options means db_default_options().
+ */
+SIMPLEDB_API DbResult db_open(const char* filename, const DbOptions* options, DbTable** table);
+SIMPLEDB_API void db_close(DbTable* table);
+
+/*
+ * Inserts rows outside any transaction. A call returns once its rows are
+ * as durable as the commit interval promises. db_insert_rows inserts all
+ * of its rows or, if any of them fails, none.
+ */
+SIMPLEDB_API DbResult db_insert(DbTable* table, uint32_t id, const char* username, const char* email);
+SIMPLEDB_API DbResult db_insert_rows(DbTable* table, const DbRowView* rows, uint32_t num_rows);
+
+SIMPLEDB_API DbResult db_lookup(DbTable* table, uint32_t id, DbRow* row);
+SIMPLEDB_API uint64_t db_count(DbTable* table);
+
+/*
+ * Cursors read a snapshot taken when they are opened, in id order. They
+ * hold no locks between calls, so they may stay open as long as the caller
+ * likes. db_cursor_next returns false once the rows run out.
+ */
+SIMPLEDB_API DbResult db_scan(DbTable* table, uint32_t low, uint32_t high, DbCursor** cursor);
+SIMPLEDB_API DbResult db_find_username(DbTable* table, const char* username, DbCursor** cursor);
+SIMPLEDB_API bool db_cursor_next(DbCursor* cursor, DbRowView* row);
+SIMPLEDB_API void db_cursor_close(DbCursor* cursor);
+
+/*
+ * Prepared statements: an insert, or a select of rows, in the REPL's
+ * syntax with ? placeholders numbered from 1. db_step runs an insert and
+ * returns DB_DONE. A select returns DB_ROW once per matching row, whole
+ * whatever its column list, and DB_DONE after the last; the view stays
+ * valid until the next call on the statement. Bound values survive
+ * db_reset and a finished step, so a statement can run again at once;
+ * binding resets it first.
+ */
+SIMPLEDB_API DbResult db_prepare(DbTable* table, const char* sql, DbStatement** statement);
+SIMPLEDB_API DbResult db_bind_int(DbStatement* statement, uint32_t index, int64_t value);
+SIMPLEDB_API DbResult db_bind_text(DbStatement* statement, uint32_t index, const char* text);
+SIMPLEDB_API DbResult db_step(DbStatement* statement, DbRowView* row);
+SIMPLEDB_API void db_reset(DbStatement* statement);
+SIMPLEDB_API void db_finalize(DbStatement* statement);
+
+SIMPLEDB_API const char* db_result_message(DbResult result);
+
+/*
+ * Failures the engine cannot back out of, such as I/O errors, a corrupt
+ * page or running out of memory in the middle of a write, are fatal; where
+ * a call can still fail cleanly it returns DB_OUT_OF_MEMORY instead. The
+ * handler is called with a description of the failure; if it returns, the
+ * process aborts.
+ */
+SIMPLEDB_API void db_set_fatal_handler(DbFatalHandler handler);
+
+#endif
@@ -0,0 +1,407 @@
+/*
+ * The engine's internals, for the programs in this tree that drive it
+ * directly: the db REPL and server (main.c), the benchmarks (bench.c) and
+ * the kernel tests (tests/id_filter_test.c). They link simpledb.o; nothing
+ * declared here is exported from the libraries, whose interface is
+ * simpledb.h alone.
+ */
+#ifndef SIMPLEDB_INTERNAL_H
+#define SIMPLEDB_INTERNAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "simpledb.h"
+
+__attribute__((noreturn, format(printf, 1, 2))) void db_fatal(const char* format, ...);
+uint32_t online_processors(uint32_t max);
+void* checked_malloc(size_t size);
+void* checked_realloc(void* memory, size_t size);
+
+typedef enum {
+    PREPARE_NEGATIVE_ID,
+    PREPARE_NOT_ID,
+    PREPARE_STRING_NOT_RIGHT,
+    PREPARE_STRING_TOO_LONG,
+    PREPARE_SUCCESS,
+    PREPARE_SYNTAX_ERROR,
+    PREPARE_UNRECOGNIZED_STATEMENT,
+    PREPARE_PARAMETER_COUNT,
+    PREPARE_UNKNOWN_PREPARED,
+} PrepareResult;
+
+typedef enum {
+    STATEMENT_INSERT,
+    STATEMENT_SELECT,
+    STATEMENT_BEGIN,
+    STATEMENT_COMMIT,
+    STATEMENT_ROLLBACK,
+    STATEMENT_PREPARE,
+    STATEMENT_DEALLOCATE
+} StatementType;
+
+typedef enum {
+    EXECUTE_SUCCESS,
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_TABLE_EMPTY,
+    EXECUTE_TABLE_FULL,
+    EXECUTE_TRANSACTION_OPEN,
+    EXECUTE_NO_TRANSACTION,
+    EXECUTE_LOCKED,
+    EXECUTE_UNBOUND_PARAMETER,
+    EXECUTE_SUSPENDED,
+} EXECUTE_RESULT;
+
+typedef enum {
+    COLUMN_ID,
+    COLUMN_USERNAME,
+    COLUMN_EMAIL
+} Column;
+
+typedef enum {
+    COMPARE_EQ,
+    COMPARE_NE,
+    COMPARE_LT,
+    COMPARE_LE,
+    COMPARE_GT,
+    COMPARE_GE
+} CompareOp;
+
+typedef enum {
+    PREDICATE_COMPARE,
+    PREDICATE_LIKE_PREFIX,
+    PREDICATE_AND,
+    PREDICATE_OR
+} PredicateType;
+
+/*
+ * A row as the engine handles it: DbRow plus its version stamps, which
+ * are described with the row layout below.
+ */
+typedef struct {
+    uint32_t id;
+    uint64_t begin_txn;
+    uint64_t end_txn;
+    char username[DB_USERNAME_SIZE + 1];
+    char email[DB_EMAIL_SIZE + 1];
+} Row;
+
+/*
+ * WHERE clause tree. Leaves compare one column against a literal; string
+ * literals are kept with their length so they can be compared directly with
+ * the length-prefixed bytes of a serialized row.
+ */
+typedef struct Predicate {
+    PredicateType type;
+    Column column;
+    CompareOp op;
+    uint32_t id_value;
+    uint8_t string_length;
+    char string_value[DB_EMAIL_SIZE + 1];
+    struct Predicate* left;
+    struct Predicate* right;
+} Predicate;
+
+/*
+ * A ? placeholder in a prepared statement and where its value goes: a
+ * field of a row to insert (row_num is the row's index; the rows array
+ * moves as it grows during parsing), a predicate's literal or LIKE
+ * pattern (target is the Predicate), or the statement's LIMIT.
+ */
+typedef enum {
+    PARAMETER_ID,
+    PARAMETER_USERNAME,
+    PARAMETER_EMAIL,
+    PARAMETER_LITERAL,
+    PARAMETER_LIKE_PATTERN,
+    PARAMETER_LIMIT
+} ParameterType;
+
+typedef struct {
+    ParameterType type;
+    void* target;
+    uint32_t row_num;
+    bool bound;
+} Parameter;
+
+/*
+ * How far a select got before it stopped to let a bounded output sink
+ * drain (EXECUTE_SUSPENDED): running the statement again goes on from the
+ * first id at or past next_id, reading the same snapshot, with count rows
+ * already behind it.
+ */
+typedef struct {
+    bool suspended;
+    uint32_t next_id;
+    uint64_t snapshot;
+    uint64_t count;
+} SelectProgress;
+
+/*
+ * A parsed statement. An insert carries one or more rows; a select its
+ * column list, WHERE tree and LIMIT, plus its plan: the username = 'x'
+ * comparison it can answer through the username index, if any.
+ */
+#define SELECT_MAX_COLUMNS 8
+#define NO_LIMIT UINT64_MAX
+
+typedef struct {
+    StatementType type;
+    Row* rows;
+    uint32_t num_rows;
+    Predicate* where;
+    bool count_only;
+    Column columns[SELECT_MAX_COLUMNS];
+    uint32_t num_columns;
+    uint64_t limit;
+    Predicate* index_key;
+    Parameter* parameters;
+    uint32_t num_parameters;
+    SelectProgress progress;
+} Statement;
+
+/* Rows as stored; simpledb.c describes the layout. */
+#define ROW_HEADER_SIZE (sizeof(uint32_t) + 2 * sizeof(uint64_t))
+#define ROW_MAX_SIZE (ROW_HEADER_SIZE + 2 * sizeof(uint8_t) + DB_USERNAME_SIZE + DB_EMAIL_SIZE)
+#define TXN_ID_MAX UINT64_MAX
+
+extern const uint32_t PAGE_SIZE;
+
+#define NO_LSN UINT64_MAX
+
+typedef struct Pager Pager;
+typedef struct Wal Wal;
+typedef struct ThreadPool ThreadPool;
+
+/*
+ * An explicit transaction, opened by BEGIN. Its rows' redo records collect
+ * in redo until COMMIT logs them as one record.
+ */
+typedef struct {
+    bool active;
+    uint64_t txn_id;
+    uint64_t rows;
+    char* redo;
+    size_t redo_used;
+    size_t redo_capacity;
+} Transaction;
+
+/*
+ * Writers (inserts, imports, checkpoints) take write_lock, so there is one
+ * at a time; readers take no table lock and rely on page latches alone.
+ *
+ * Each write is a transaction: the writer stamps its rows with
+ * next_txn_id and, once they are all in place, publishes that id as
+ * visible_txn_id. A reader's snapshot is the visible_txn_id it loads when
+ * it starts, so rows written after that are skipped even when the scan
+ * reaches them. num_rows counts visible rows and is published together
+ * with them.
+ *
+ * txn is the open explicit transaction, if any; its session is the only
+ * writer until it ends. Scans hold rollback_lock shared, and a rollback
+ * holds it exclusively while it puts pages back, since a tree restored a
+ * page at a time is not consistent in between.
+ *
+ * recovered_rows counts the rows db_open replayed from the log.
+ */
+struct DbTable {
+    uint32_t root_page_num;
+    uint32_t username_index_page;
+    bool pax;
+    uint64_t num_rows;
+    uint64_t next_txn_id;
+    uint64_t visible_txn_id;
+    Pager* pager;
+    Wal* wal;
+    pthread_mutex_t write_lock;
+    Transaction* txn;
+    pthread_rwlock_t rollback_lock;
+    ThreadPool* scan_pool;
+    uint32_t recovered_rows;
+};
+
+/* B+tree pages; simpledb.c describes the layouts. */
+typedef enum {
+    NODE_INTERNAL,
+    NODE_LEAF,
+    NODE_PAX_LEAF
+} NodeType;
+
+extern const uint32_t COMMON_NODE_HEADER_SIZE;
+extern const uint32_t LEAF_NODE_HEADER_SIZE;
+extern const uint32_t INTERNAL_NODE_HEADER_SIZE;
+#define LEAF_NODE_SLOT_SIZE (sizeof(uint32_t) + 2 * sizeof(uint16_t))
+#define LEAF_NODE_SPACE_FOR_CELLS (PAGE_SIZE - LEAF_NODE_HEADER_SIZE)
+#define INTERNAL_NODE_CELL_SIZE (sizeof(uint32_t) + sizeof(uint32_t))
+#define INTERNAL_NODE_MAX_KEYS ((PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE)
+#define PAX_ROW_FIXED_SIZE (sizeof(uint32_t) + 2 * sizeof(uint64_t) + 2 * sizeof(uint16_t))
+
+/*
+ * Page scan kernels. Each sets bit i of bitmap (SLOT_BITMAP_WORDS words)
+ * when the key at keys + i * stride falls in one of the filter's ranges;
+ * the vector ones must agree with the scalar one bit for bit.
+ */
+#define ID_FILTER_MAX_RANGES 8
+#define LEAF_NODE_MAX_SLOTS (LEAF_NODE_SPACE_FOR_CELLS / PAX_ROW_FIXED_SIZE)
+#define SLOT_BITMAP_WORDS ((LEAF_NODE_MAX_SLOTS + 63) / 64)
+
+typedef struct {
+    uint32_t num_ranges;
+    uint32_t low[ID_FILTER_MAX_RANGES];
+    uint32_t high[ID_FILTER_MAX_RANGES];
+    bool exact;
+} IdFilter;
+
+typedef void (*IdFilterKernel)(const uint8_t* keys, uint32_t stride, uint32_t num_slots, const IdFilter* filter,
+                               uint64_t* bitmap);
+
+void id_filter_kernel_scalar(const uint8_t* keys, uint32_t stride, uint32_t num_slots, const IdFilter* filter,
+                             uint64_t* bitmap);
+void id_filter_kernel_sse42(const uint8_t* keys, uint32_t stride, uint32_t num_slots, const IdFilter* filter,
+                            uint64_t* bitmap);
+void id_filter_kernel_avx2(const uint8_t* keys, uint32_t stride, uint32_t num_slots, const IdFilter* filter,
+                           uint64_t* bitmap);
+
+/*
+ * Output sink for query results. Rows are formatted by hand into a large
+ * reusable buffer that goes out with a single write() whenever it fills up
+ * and once at the end of each statement. Anything printed through stdio
+ * before the first row is flushed first so the two streams stay in order.
+ */
+#define OUTPUT_BUFFER_SIZE (256u << 10)
+
+typedef enum {
+    OUTPUT_FORMAT_TUPLE,
+    OUTPUT_FORMAT_CSV,
+    OUTPUT_FORMAT_TSV,
+    OUTPUT_FORMAT_JSON,
+    OUTPUT_FORMAT_BINARY
+} OutputFormat;
+
+/*
+ * A sink with no file descriptor collects its output in memory, growing as
+ * needed; parallel scans give one to each morsel. A memory sink with a
+ * soft_limit asks a select to stop at the next leaf boundary once it holds
+ * more than that, so the caller can drain it and run the statement again.
+ * ordered is off when the client accepts rows in whatever order parallel
+ * workers produce them.
+ */
+typedef struct {
+    int fd;
+    OutputFormat format;
+    bool ordered;
+    char* buffer;
+    size_t used;
+    size_t capacity;
+    size_t soft_limit;
+    bool failed;
+} OutputSink;
+
+/*
+ * Bulk loading. Rows arriving in ascending id order go straight into the
+ * rightmost leaf, which stays pinned between rows, so a sorted load fills
+ * pages front to back and only descends the tree once per page. Anything
+ * else takes the regular table_insert path. The appended rows' username
+ * index entries are held back and filed as one batch at the end.
+ */
+typedef struct {
+    DbTable* table;
+    void* leaf;
+    uint32_t leaf_page_num;
+    bool leaf_dirty;
+    bool has_max_key;
+    uint32_t max_key;
+    uint64_t* index_entries;
+    uint32_t num_index_entries;
+    uint32_t index_capacity;
+} BulkLoader;
+
+/*
+ * Per-statement arena. A statement and everything hanging off it (the row
+ * to insert, the WHERE tree) are bump-allocated here and released together
+ * by arena_reset once the statement has run, so no error path can leak
+ * them. Blocks are kept across resets: after the first few statements the
+ * REPL and the server parse and execute without touching the heap, and the
+ * arena never holds more than the largest statement seen.
+ */
+#define ARENA_BLOCK_SIZE 8192
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t capacity;
+    char data[] __attribute__((aligned(ARENA_ALIGNMENT)));
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* first;
+    ArenaBlock* current;
+    size_t used;
+} Arena;
+
+/* A session's named prepared statements. */
+#define PLAN_CACHE_BUCKETS 64
+
+typedef struct PreparedStatement PreparedStatement;
+
+typedef struct {
+    PreparedStatement* buckets[PLAN_CACHE_BUCKETS];
+} PlanCache;
+
+void* get_page(Pager* pager, uint32_t page_num);
+uint32_t pager_num_pages(Pager* pager);
+void unpin_page(Pager* pager, uint32_t page_num);
+void wal_commit(Wal* wal, uint64_t lsn);
+void wal_wait_durable(Wal* wal, uint64_t lsn);
+
+uint32_t serialize_row(Row* source, void* destination);
+void deserialize_row(Row* destination, void* source);
+
+NodeType get_node_type(void* node);
+uint32_t* leaf_node_num_cells(void* node);
+uint32_t* leaf_node_key(void* node, uint32_t cell_num);
+uint32_t* internal_node_num_keys(void* node);
+uint32_t* internal_node_right_child(void* node);
+uint32_t* internal_node_key(void* node, uint32_t key_num);
+uint32_t* internal_node_child(void* node, uint32_t child_num);
+
+int compare_u64(const void* a, const void* b);
+
+void table_commit(DbTable* table, uint64_t txn_id, uint64_t rows);
+void db_checkpoint(DbTable* table);
+
+OutputSink* new_output_sink(int fd);
+OutputSink* new_memory_sink(OutputFormat format);
+void free_output_sink(OutputSink* sink);
+void sink_write(OutputSink* sink, const void* data, size_t length);
+void sink_write_char(OutputSink* sink, char c);
+bool parse_output_format(const char* name, OutputFormat* format);
+
+void bulk_loader_begin(BulkLoader* loader, DbTable* table);
+EXECUTE_RESULT bulk_loader_add(BulkLoader* loader, Row* row);
+void bulk_loader_end(BulkLoader* loader);
+
+void arena_init(Arena* arena);
+void arena_reset(Arena* arena);
+void arena_free(Arena* arena);
+
+void init_statement(Statement* statement);
+Statement* create_statement(Arena* arena);
+
+void init_transaction(Transaction* txn);
+void free_transaction(Transaction* txn);
+
+EXECUTE_RESULT execute_insert(Statement* statement, DbTable* table);
+EXECUTE_RESULT execute_rollback(DbTable* table, Transaction* txn);
+EXECUTE_RESULT execute_select(Statement* statement, DbTable* table, Transaction* txn, OutputSink* output);
+EXECUTE_RESULT apply_statement(Statement* statement, DbTable* table, Transaction* txn, OutputSink* output,
+                               uint64_t* lsn);
+EXECUTE_RESULT execute_statement(Statement* statement, DbTable* table, Transaction* txn, OutputSink* output);
+
+void init_plan_cache(PlanCache* plans);
+void free_plan_cache(PlanCache* plans);
+PrepareResult prepare_statement(const char* line, Statement* statement, Arena* arena, PlanCache* plans);
+
+#endif
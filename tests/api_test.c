@@ -0,0 +1,108 @@
+/*
+ * Exercises the library's prepared statements through simpledb.h alone:
+ * multi-row inserts bound one value at a time, selects answered by an id
+ * span, by the username index and by a scan with a residual WHERE clause,
+ * LIMIT, rerunning after DB_DONE and db_reset, the error codes, and
+ * reopening with default options.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simpledb.h"
+
+#define CHECK(condition)                                                \
+    do {                                                                \
+        if (!(condition)) {                                             \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1);                                                    \
+        }                                                               \
+    } while (0)
+
+uint32_t count_rows(DbStatement* statement) {
+    DbRowView row;
+    DbResult result;
+    uint32_t count = 0;
+    while ((result = db_step(statement, &row)) == DB_ROW) {
+        ++count;
+    }
+    CHECK(result == DB_DONE);
+    return count;
+}
+
+int main(void) {
+    DbOptions options = db_default_options();
+    DbTable* table;
+    DbStatement* statement;
+    DbRowView row;
+    CHECK(db_open("api.db", &options, &table) == DB_SUCCESS);
+
+    CHECK(db_prepare(table, "begin", &statement) == DB_UNSUPPORTED_STATEMENT && statement == NULL);
+    CHECK(db_prepare(table, "select count(*)", &statement) == DB_UNSUPPORTED_STATEMENT);
+    CHECK(db_prepare(table, "selec *", &statement) == DB_SYNTAX_ERROR);
+
+    CHECK(db_prepare(table, "insert values (?, ?, ?), (?, 'second', ?)", &statement) == DB_SUCCESS);
+    CHECK(db_step(statement, &row) == DB_UNBOUND_PARAMETER);
+    CHECK(db_bind_int(statement, 6, 1) == DB_PARAMETER_COUNT);
+    CHECK(db_bind_int(statement, 1, -1) == DB_INVALID_ID);
+    char username[DB_USERNAME_SIZE + 1];
+    char email[DB_EMAIL_SIZE + 2];
+    memset(email, 'x', DB_EMAIL_SIZE);
+    email[DB_EMAIL_SIZE] = 0;
+    CHECK(db_bind_text(statement, 3, email) == DB_SUCCESS);
+    strcat(email, "x");
+    CHECK(db_bind_text(statement, 3, email) == DB_STRING_TOO_LONG);
+    for (uint32_t id = 1; id <= 1000; ++id) {
+        snprintf(username, sizeof(username), "user%u", id % 10);
+        snprintf(email, sizeof(email), "person%u@example.com", id);
+        CHECK(db_bind_int(statement, 1, id) == DB_SUCCESS);
+        CHECK(db_bind_text(statement, 2, username) == DB_SUCCESS);
+        CHECK(db_bind_text(statement, 3, email) == DB_SUCCESS);
+        CHECK(db_bind_int(statement, 4, 100000 + id) == DB_SUCCESS);
+        CHECK(db_bind_text(statement, 5, email) == DB_SUCCESS);
+        CHECK(db_step(statement, &row) == DB_DONE);
+    }
+    CHECK(db_step(statement, &row) == DB_DUPLICATE_KEY);
+    db_finalize(statement);
+    CHECK(db_count(table) == 2000);
+
+    CHECK(db_prepare(table, "select * where id > ? and id <= ? limit ?", &statement) == DB_SUCCESS);
+    CHECK(db_bind_int(statement, 1, 10) == DB_SUCCESS);
+    CHECK(db_bind_int(statement, 2, 500) == DB_SUCCESS);
+    CHECK(db_bind_int(statement, 3, 1000) == DB_SUCCESS);
+    for (uint32_t id = 11; id <= 500; ++id) {
+        CHECK(db_step(statement, &row) == DB_ROW && row.id == id);
+    }
+    CHECK(db_step(statement, &row) == DB_DONE);
+    CHECK(count_rows(statement) == 490);
+    CHECK(db_bind_int(statement, 3, 5) == DB_SUCCESS);
+    CHECK(db_step(statement, &row) == DB_ROW && row.id == 11);
+    db_reset(statement);
+    CHECK(count_rows(statement) == 5);
+    db_finalize(statement);
+
+    CHECK(db_prepare(table, "select id where username = ? and id < 500", &statement) == DB_SUCCESS);
+    CHECK(db_bind_text(statement, 1, "user3") == DB_SUCCESS);
+    while (db_step(statement, &row) == DB_ROW) {
+        CHECK(row.id % 10 == 3 && row.id < 500);
+        CHECK(row.username_length == 5 && memcmp(row.username, "user3", 5) == 0);
+    }
+    CHECK(db_bind_text(statement, 1, "user3") == DB_SUCCESS);
+    CHECK(count_rows(statement) == 50);
+    CHECK(db_bind_text(statement, 1, "second") == DB_SUCCESS);
+    CHECK(count_rows(statement) == 0);
+    db_finalize(statement);
+
+    CHECK(db_prepare(table, "select * where email like 'person99%' or id = 100001", &statement) == DB_SUCCESS);
+    CHECK(count_rows(statement) == 1 + 2 * 11);
+    db_finalize(statement);
+
+    CHECK(db_prepare(table, "select * where id > 5 and id < 3", &statement) == DB_SUCCESS);
+    CHECK(count_rows(statement) == 0);
+    db_finalize(statement);
+
+    db_close(table);
+    CHECK(db_open("api.db", NULL, &table) == DB_SUCCESS && db_count(table) == 2000);
+    db_close(table);
+    return 0;
+}
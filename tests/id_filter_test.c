@@ -0,0 +1,119 @@
+/*
+ * Differential test of the page scan kernels: the SSE4.2 and AVX2 kernels
+ * must set exactly the bits the scalar one does. Runs random filters over
+ * random keys at both leaf layouts' strides (PAX minipage and slotted
+ * leaf), from unaligned buffers, with slot counts that leave every
+ * possible ragged tail. Keys cluster around the range bounds and the sign
+ * bit, where an unsigned comparison done as a signed one would slip.
+ * Kernels the CPU lacks are skipped.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simpledb_internal.h"
+
+#define TRIALS 20000
+
+uint64_t random_state = 0x9E3779B97F4A7C15ull;
+
+uint32_t random_u32(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state >> 32;
+}
+
+uint32_t random_below(uint32_t bound) {
+    return random_u32() % bound;
+}
+
+/* A value from everywhere, near the sign bit, near the ends or near a bound. */
+uint32_t random_key(const IdFilter* filter) {
+    uint32_t jitter = random_below(5) - 2;
+    switch (random_below(4)) {
+        case 0:
+            return random_u32();
+        case 1:
+            return 0x80000000u + jitter;
+        case 2:
+            return (random_below(2) ? 0 : UINT32_MAX) + jitter;
+        default:
+            if (filter->num_ranges == 0) {
+                return random_u32();
+            }
+            uint32_t r = random_below(filter->num_ranges);
+            return (random_below(2) ? filter->low[r] : filter->high[r]) + jitter;
+    }
+}
+
+void random_filter(IdFilter* filter) {
+    filter->num_ranges = random_below(ID_FILTER_MAX_RANGES + 1);
+    filter->exact = true;
+    for (uint32_t r = 0; r < filter->num_ranges; ++r) {
+        uint32_t low = random_below(2) ? random_u32() : 0x80000000u - random_below(1000);
+        uint32_t width = random_below(3) == 0 ? random_u32() : random_below(1000);
+        filter->low[r] = low;
+        filter->high[r] = width > UINT32_MAX - low ? UINT32_MAX : low + width;
+    }
+}
+
+/* Mostly short pages, so the tails past the last full vector get exercised. */
+uint32_t random_num_slots(void) {
+    return random_below(2) ? random_below(40) : random_below(LEAF_NODE_MAX_SLOTS + 1);
+}
+
+bool check(const char* name, IdFilterKernel kernel, const uint8_t* keys, uint32_t stride, uint32_t num_slots,
+           const IdFilter* filter, const uint64_t* expected) {
+    uint64_t bitmap[SLOT_BITMAP_WORDS];
+    memset(bitmap, 0xA5, sizeof(bitmap));
+    kernel(keys, stride, num_slots, filter, bitmap);
+    for (uint32_t word = 0; word < SLOT_BITMAP_WORDS; ++word) {
+        if (bitmap[word] != expected[word]) {
+            fprintf(stderr, "%s: stride %u, %u slots, %u ranges: word %u is %016llx, scalar gave %016llx\n", name,
+                    stride, num_slots, filter->num_ranges, word, (unsigned long long) bitmap[word],
+                    (unsigned long long) expected[word]);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void) {
+    __builtin_cpu_init();
+    bool sse42 = __builtin_cpu_supports("sse4.2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+    if (!sse42) {
+        printf("skipping id_filter_kernel_sse42: no SSE4.2\n");
+    }
+    if (!avx2) {
+        printf("skipping id_filter_kernel_avx2: no AVX2\n");
+    }
+
+    const uint32_t strides[] = {sizeof(uint32_t), LEAF_NODE_SLOT_SIZE};
+    size_t buffer_size = LEAF_NODE_MAX_SLOTS * LEAF_NODE_SLOT_SIZE + 16;
+    uint8_t* buffer = checked_malloc(buffer_size);
+    for (uint32_t trial = 0; trial < TRIALS; ++trial) {
+        IdFilter filter;
+        random_filter(&filter);
+        uint32_t stride = strides[random_below(2)];
+        uint32_t num_slots = random_num_slots();
+        uint8_t* keys = buffer + random_below(16);
+        for (size_t i = 0; i < buffer_size; ++i) {
+            buffer[i] = random_u32();
+        }
+        for (uint32_t i = 0; i < num_slots; ++i) {
+            uint32_t key = random_key(&filter);
+            memcpy(keys + i * stride, &key, sizeof(uint32_t));
+        }
+
+        uint64_t expected[SLOT_BITMAP_WORDS];
+        id_filter_kernel_scalar(keys, stride, num_slots, &filter, expected);
+        if ((sse42 && !check("sse42", id_filter_kernel_sse42, keys, stride, num_slots, &filter, expected)) ||
+            (avx2 && !check("avx2", id_filter_kernel_avx2, keys, stride, num_slots, &filter, expected))) {
+            return 1;
+        }
+    }
+    free(buffer);
+    return 0;
+}
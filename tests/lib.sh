@@ -0,0 +1,40 @@
+# Helpers for the test scripts. Each script runs in a temporary directory
+# that is removed when it exits. DB is the binary under test.
+set -eu
+
+DB=${DB:-$(pwd)/db}
+TEST_NAME=$(basename "$0" .sh)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+fail() {
+    echo "FAIL $TEST_NAME: $*" >&2
+    exit 1
+}
+
+pass() {
+    echo "PASS $TEST_NAME"
+}
+
+# Runs the REPL with the given arguments on stdin, dropping the prompts.
+repl() {
+    "$DB" "$@" | sed 's/db > //g'
+}
+
+# Compares the expected output, on stdin, with the file named by $1.
+check_output() {
+    if ! diff -u - "$1" >&2; then
+        fail "unexpected output in $1"
+    fi
+}
+
+# insert_lines FIRST LAST: one insert statement per id.
+insert_lines() {
+    seq "$1" "$2" | awk '{ printf "insert %d user%d person%d@example.com\n", $1, $1 % 50, $1 }'
+}
+
+# row_lines FIRST LAST: the rows insert_lines adds, as select prints them.
+row_lines() {
+    seq "$1" "$2" | awk '{ printf "(%d, user%d, person%d@example.com)\n", $1, $1 % 50, $1 }'
+}
@@ -0,0 +1,7 @@
+#!/bin/sh
+# Runs tests/api_test, the C program that checks prepared statements
+# through the library's public header. API_TEST is its path.
+. "$(dirname "$0")/lib.sh"
+
+"$API_TEST" || fail "api_test failed"
+pass
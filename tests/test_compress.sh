@@ -0,0 +1,26 @@
+#!/bin/sh
+# A compressed file keeps its format and contents across reopens, with or
+# without --compress, comes out smaller than a plain one, and refuses to be
+# memory-mapped.
+. "$(dirname "$0")/lib.sh"
+
+{ insert_lines 1 3000; echo ".exit"; } | repl --compress packed.db > /dev/null
+{ insert_lines 1 3000; echo ".exit"; } | repl plain.db > /dev/null
+[ "$(wc -c < packed.db)" -lt "$(wc -c < plain.db)" ] || fail "compressed file is not smaller"
+
+{ insert_lines 3001 4000; echo ".exit"; } | repl --frames 40 packed.db > /dev/null
+printf 'select\nselect where username = user7\n.exit\n' | repl --frames 40 packed.db > got
+{
+    echo "Welcome to db: packed.db"
+    row_lines 1 4000
+    echo "Executed."
+    row_lines 1 4000 | grep ', user7,'
+    echo "Executed."
+} | check_output got
+
+if echo ".exit" | "$DB" --mmap packed.db > got; then
+    fail "a compressed file opened in mmap mode"
+fi
+echo "Invalid options: the buffer pool needs at least 40 frames, and a compressed file cannot be mapped." |
+    check_output got
+pass
@@ -0,0 +1,7 @@
+#!/bin/sh
+# Runs tests/id_filter_test, the C program that checks the vector page
+# scan kernels against the scalar one. ID_FILTER_TEST is its path.
+. "$(dirname "$0")/lib.sh"
+
+"$ID_FILTER_TEST" || fail "id_filter_test failed"
+pass
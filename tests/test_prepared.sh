@@ -0,0 +1,37 @@
+#!/bin/sh
+# Prepared multi-row inserts bind every row, including those past the
+# first few, where the parser has had to grow its rows array, and a batch
+# with a bad row inserts nothing.
+. "$(dirname "$0")/lib.sh"
+
+cat > in <<'END'
+prepare p as insert values (?,?,?),(?,?,?),(?,?,?),(?,?,?),(?,?,?),(?,'six',?)
+execute p (1,a,a@x,2,b,b@x,3,c,c@x,4,d,d@x,5,e,e@x,6,f@x)
+execute p (11,k,k@x,12,l,l@x,13,m,m@x,14,n,n@x,15,o,o@x,16,p@x)
+execute p (21,u,u@x,22,v,v@x,23,w,w@x,24,x,x@x,5,dup,dup@x,26,z@x)
+prepare q as select id, username where id >= ? limit ?
+execute q (5, 4)
+select count(*)
+select where username = six
+.exit
+END
+repl prepared.db < in > got
+{
+    echo "Welcome to db: prepared.db"
+    echo "Executed."
+    echo "Executed."
+    echo "Executed."
+    echo "Error: Duplicate key."
+    echo "Executed."
+    echo "(5, e)"
+    echo "(6, six)"
+    echo "(11, k)"
+    echo "(12, l)"
+    echo "Executed."
+    echo "(12)"
+    echo "Executed."
+    echo "(6, six, f@x)"
+    echo "(16, six, p@x)"
+    echo "Executed."
+} | check_output got
+pass
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Kills the REPL with -9 once it has acknowledged a few thousand inserts
+# and checks that reopening replays every one of them, but nothing from a
+# transaction that was still open. A minimal pool keeps dirty pages going out
+# to the file while the log is being written. stdbuf makes each
+# acknowledgement visible as soon as it is printed.
+. "$(dirname "$0")/lib.sh"
+
+for mode in "" --mmap; do
+    rm -f crash.db crash.db-wal in out
+    mkfifo in
+    stdbuf -oL "$DB" --frames 40 --commit-interval 0 $mode crash.db < in > out &
+    pid=$!
+    exec 3> in
+    insert_lines 1 3000 >&3
+    printf 'begin\ninsert 5000 lost lost@example.com\n' >&3
+    tries=0
+    while [ "$(grep -o Executed out | wc -l)" -lt 3002 ]; do
+        tries=$((tries + 1))
+        [ $tries -lt 600 ] || fail "inserts were not acknowledged ($mode)"
+        sleep 0.1
+    done
+    kill -9 $pid
+    wait $pid 2> /dev/null || true
+    exec 3>&-
+
+    printf 'select\nselect where id = 5000\n.exit\n' | repl crash.db > got
+    {
+        echo "Recovered 3000 rows from the log."
+        echo "Welcome to db: crash.db"
+        row_lines 1 3000
+        echo "Executed."
+        echo "Executed."
+    } | check_output got
+done
+pass
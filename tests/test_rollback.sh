@@ -0,0 +1,42 @@
+#!/bin/sh
+# A rolled-back transaction leaves no trace: not in selects, counts or the
+# username index, and not after reopening. It is big enough to split
+# leaves, and a minimal pool forces some of its pages out before the rollback.
+. "$(dirname "$0")/lib.sh"
+
+{
+    insert_lines 1 10
+    echo begin
+    insert_lines 11 6000
+    echo "select count(*)"
+    echo rollback
+    echo "select count(*)"
+    echo "select where username = user11"
+    echo "select where id > 8"
+    echo "insert 11 again again@example.com"
+    echo ".exit"
+} | repl --frames 40 rollback.db > got
+{
+    echo "Welcome to db: rollback.db"
+    seq 1 6001 | sed 's/.*/Executed./'
+    echo "(6000)"
+    echo "Executed."
+    echo "Executed."
+    echo "(10)"
+    echo "Executed."
+    echo "Executed."
+    row_lines 9 10
+    echo "Executed."
+    echo "Executed."
+} | check_output got
+
+printf 'select where id > 9\nselect where username = again\n.exit\n' | repl rollback.db > got
+{
+    echo "Welcome to db: rollback.db"
+    row_lines 10 10
+    echo "(11, again, again@example.com)"
+    echo "Executed."
+    echo "(11, again, again@example.com)"
+    echo "Executed."
+} | check_output got
+pass